@@ -0,0 +1,124 @@
+#include "allocation_profiler.h"
+
+#include <iomanip>
+#include <iostream>
+#include <algorithm>
+#include <sys/resource.h>
+
+#include "allocations.h"
+
+AllocationProfiler::AllocationProfiler()
+{
+}
+
+void AllocationProfiler::enter(const Function &function)
+{
+	const SourceLocation &sourceLocation = function.sourceLocation();
+	Key key = { &sourceLocation.filename(), sourceLocation.line() };
+	// References to unordered_map elements survive rehashing
+	Counters &counters = functions_[key];
+	if (counters.calls == 0)
+	{
+		counters.name = function.name();
+	}
+	++counters.calls;
+	++counters.active;
+
+	Activation activation = { &counters, 0, 0, 0, 0 };
+	activations_.push_back(activation);
+	// Last, so the profiler's own allocations above are not charged
+	activations_.back().startAllocations = threadAllocationCount();
+	activations_.back().startBytes = threadAllocatedBytes();
+}
+
+void AllocationProfiler::leave()
+{
+	unsigned long long allocations = threadAllocationCount();
+	unsigned long long bytes = threadAllocatedBytes();
+
+	Activation &activation = activations_.back();
+	allocations -= activation.startAllocations;
+	bytes -= activation.startBytes;
+	Counters &counters = *activation.counters;
+	counters.exclusiveAllocations += allocations - activation.calleeAllocations;
+	counters.exclusiveBytes += bytes - activation.calleeBytes;
+	if (--counters.active == 0)
+	{
+		counters.inclusiveAllocations += allocations;
+		counters.inclusiveBytes += bytes;
+	}
+	activations_.pop_back();
+
+	if (!activations_.empty())
+	{
+		activations_.back().calleeAllocations += allocations;
+		activations_.back().calleeBytes += bytes;
+	}
+}
+
+const AllocationProfiler::Counters *AllocationProfiler::find(const SourceLocation &sourceLocation) const
+{
+	Key key = { &sourceLocation.filename(), sourceLocation.line() };
+	Functions::const_iterator it = functions_.find(key);
+	return it == functions_.end() ? nullptr : &it->second;
+}
+
+unsigned long long AllocationProfiler::exclusiveBytes(const SourceLocation &sourceLocation) const
+{
+	const Counters *counters = find(sourceLocation);
+	return counters ? counters->exclusiveBytes : 0;
+}
+
+unsigned long long AllocationProfiler::inclusiveBytes(const SourceLocation &sourceLocation) const
+{
+	const Counters *counters = find(sourceLocation);
+	return counters ? counters->inclusiveBytes : 0;
+}
+
+void AllocationProfiler::report(std::ostream &out, unsigned functions) const
+{
+	AllocationStats stats = allocationStats();
+	struct rusage usage;
+	long maxResidentKilobytes = getrusage(RUSAGE_SELF, &usage) == 0 ? usage.ru_maxrss : 0;
+
+	std::ios::fmtflags flags = out.flags();
+	out << "Memory: " << stats.allocations << " allocations of " << stats.allocatedBytes << " bytes";
+	out << ", peak " << stats.peakBytes << " bytes live";
+	out << ", " << stats.liveBytes << " still live";
+	out << ", max resident set " << maxResidentKilobytes << " KiB\n";
+	out << '\n';
+	out << std::left << std::setw(16) << "category" << std::right;
+	out << std::setw(14) << "live bytes" << std::setw(14) << "live allocs" << std::setw(18) << "allocated bytes" << '\n';
+	for (int i = 0 ; i < ALLOCATION_CATEGORY_COUNT ; ++i)
+	{
+		out << std::left << std::setw(16) << allocationCategoryName(static_cast<AllocationCategory>(i)) << std::right;
+		out << std::setw(14) << stats.liveBytesByCategory[i];
+		out << std::setw(14) << stats.liveAllocationsByCategory[i];
+		out << std::setw(18) << stats.allocatedBytesByCategory[i] << '\n';
+	}
+
+	std::vector<Functions::const_iterator> sorted;
+	for (Functions::const_iterator it = functions_.begin() ; it != functions_.end() ; ++it)
+	{
+		sorted.push_back(it);
+	}
+	std::size_t shown = std::min<std::size_t>(functions, sorted.size());
+	std::partial_sort(sorted.begin(), sorted.begin() + shown, sorted.end(), [](Functions::const_iterator a, Functions::const_iterator b) {
+		return a->second.exclusiveBytes != b->second.exclusiveBytes ? a->second.exclusiveBytes > b->second.exclusiveBytes : a->second.inclusiveBytes > b->second.inclusiveBytes;
+	});
+
+	out << '\n';
+	out << "Top " << shown << " of " << sorted.size() << " functions by bytes allocated:\n";
+	out << std::setw(16) << "exclusive bytes" << std::setw(14) << "allocations" << std::setw(16) << "inclusive bytes" << std::setw(12) << "calls" << "  function\n";
+	for (std::size_t i = 0 ; i < shown ; ++i)
+	{
+		const Key &key = sorted[i]->first;
+		const Counters &counters = sorted[i]->second;
+		out << std::setw(16) << counters.exclusiveBytes;
+		out << std::setw(14) << counters.exclusiveAllocations;
+		out << std::setw(16) << counters.inclusiveBytes;
+		out << std::setw(12) << counters.calls;
+		out << "  " << counters.name << " (" << *key.filename << ":" << key.line << ")\n";
+	}
+	out.flags(flags);
+}
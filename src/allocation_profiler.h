@@ -0,0 +1,119 @@
+#ifndef ALLOCATION_PROFILER_H
+#define ALLOCATION_PROFILER_H
+
+#include <iosfwd>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include "function.h"
+
+// Attributes the heap allocations made on the interpreter's thread to the
+// rasp functions, including builtins, being called when they were made.
+// Exclusive counts exclude the function's callees, inclusive counts include
+// them, once however deeply the function recurses.
+class AllocationProfiler
+{
+public:
+	AllocationProfiler();
+
+	void enter(const Function &function);
+	void leave();
+
+	// Bytes allocated by the function defined here, zero if never called
+	unsigned long long exclusiveBytes(const SourceLocation &sourceLocation) const;
+	unsigned long long inclusiveBytes(const SourceLocation &sourceLocation) const;
+
+	// The allocations by category, then the functions allocating most
+	void report(std::ostream &out, unsigned functions = 10) const;
+
+private:
+	// Deliberately private & unimplemented
+	AllocationProfiler(const AllocationProfiler &);
+	AllocationProfiler &operator=(const AllocationProfiler &);
+
+	// Functions are identified by where they are defined, as the
+	// Function objects themselves are copied and destroyed freely
+	struct Key
+	{
+		const std::string *filename;
+		unsigned line;
+
+		bool operator==(const Key &other) const
+		{
+			return filename == other.filename && line == other.line;
+		}
+	};
+
+	struct KeyHash
+	{
+		std::size_t operator()(const Key &key) const
+		{
+			return std::hash<const std::string *>()(key.filename) * 31 + key.line;
+		}
+	};
+
+	struct Counters
+	{
+		Counters() : calls(0), active(0), exclusiveAllocations(0), exclusiveBytes(0), inclusiveAllocations(0), inclusiveBytes(0)
+		{
+		}
+
+		std::string name;
+		unsigned long long calls;
+		unsigned active;
+		unsigned long long exclusiveAllocations;
+		unsigned long long exclusiveBytes;
+		unsigned long long inclusiveAllocations;
+		unsigned long long inclusiveBytes;
+	};
+
+	struct Activation
+	{
+		Counters *counters;
+		unsigned long long startAllocations;
+		unsigned long long startBytes;
+		unsigned long long calleeAllocations;
+		unsigned long long calleeBytes;
+	};
+
+	typedef std::unordered_map<Key, Counters, KeyHash> Functions;
+
+	const Counters *find(const SourceLocation &sourceLocation) const;
+
+	Functions functions_;
+	std::vector<Activation> activations_;
+};
+
+// Attributes the allocations made during a call to the function, if there
+// is a profiler
+class AllocationProfiledCall
+{
+public:
+	AllocationProfiledCall(AllocationProfiler *profiler, const Function &function)
+	:
+		profiler_(profiler)
+	{
+		if (profiler_)
+		{
+			profiler_->enter(function);
+		}
+	}
+
+	~AllocationProfiledCall()
+	{
+		if (profiler_)
+		{
+			profiler_->leave();
+		}
+	}
+
+private:
+	// Deliberately private & unimplemented
+	AllocationProfiledCall(const AllocationProfiledCall &);
+	AllocationProfiledCall &operator=(const AllocationProfiledCall &);
+
+	AllocationProfiler *profiler_;
+};
+
+#endif
@@ -0,0 +1,230 @@
+#include "allocations.h"
+
+#include <new>
+#include <cstdlib>
+#include <cstring>
+
+namespace
+{
+	// The counters use the GCC atomic builtins rather than std::atomic, as
+	// they cost no function calls in an unoptimised build, and operator new
+	// is hot enough for that to matter.
+
+	// Only ever updated by the owning thread, so without read-modify-write
+	// instructions, while other threads read them for the totals. Each on
+	// cache lines of its own, so threads allocating do not contend.
+	struct alignas(64) ThreadCounters
+	{
+		unsigned long long allocations;
+		unsigned long long allocatedBytes;
+		long long liveBytes[ALLOCATION_CATEGORY_COUNT];
+		long long liveAllocations[ALLOCATION_CATEGORY_COUNT];
+		unsigned long long categoryBytes[ALLOCATION_CATEGORY_COUNT];
+		ThreadCounters *next;
+	};
+
+	// Every thread's counters, kept after the thread exits so the totals
+	// still include its allocations. Memory freed on another thread than
+	// allocated it makes the per thread live counts negative, but not the sum.
+	ThreadCounters *threads = nullptr;
+
+	// Shared, as the peak is of all threads together, so only kept once
+	// trackPeakBytes() is called. Otherwise the peak is the most live bytes
+	// allocationStats() has summed from the threads' counters.
+	bool trackingPeak = false;
+	long long liveBytes = 0;
+	long long peakBytes = 0;
+
+	thread_local ThreadCounters *counters = nullptr;
+	thread_local AllocationCategory currentCategory = ALLOCATION_OTHER;
+
+	// Precedes each allocation, so operator delete knows what it frees.
+	// Sized to keep the allocation itself suitably aligned.
+	struct alignas(16) Header
+	{
+		std::size_t size;
+		AllocationCategory category;
+	};
+
+	ThreadCounters *registerThread()
+	{
+		// Not with new, which would recurse
+		void *memory = nullptr;
+		if (posix_memalign(&memory, alignof(ThreadCounters), sizeof(ThreadCounters)) != 0)
+		{
+			throw std::bad_alloc();
+		}
+		ThreadCounters *thread = static_cast<ThreadCounters *>(std::memset(memory, 0, sizeof(ThreadCounters)));
+		thread->next = __atomic_load_n(&threads, __ATOMIC_ACQUIRE);
+		while (!__atomic_compare_exchange_n(&threads, &thread->next, thread, true, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE))
+		{
+		}
+		return thread;
+	}
+
+	unsigned long long load(const unsigned long long &counter)
+	{
+		return __atomic_load_n(&counter, __ATOMIC_RELAXED);
+	}
+
+	long long load(const long long &counter)
+	{
+		return __atomic_load_n(&counter, __ATOMIC_RELAXED);
+	}
+
+	void raisePeak(long long live)
+	{
+		long long peak = __atomic_load_n(&peakBytes, __ATOMIC_RELAXED);
+		while (live > peak && !__atomic_compare_exchange_n(&peakBytes, &peak, live, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		{
+		}
+	}
+
+	long long threadsLiveBytes()
+	{
+		long long live = 0;
+		for (ThreadCounters *thread = __atomic_load_n(&threads, __ATOMIC_ACQUIRE) ; thread ; thread = thread->next)
+		{
+			for (int i = 0 ; i < ALLOCATION_CATEGORY_COUNT ; ++i)
+			{
+				live += load(thread->liveBytes[i]);
+			}
+		}
+		return live;
+	}
+}
+
+const char *allocationCategoryName(AllocationCategory category)
+{
+	switch (category)
+	{
+	case ALLOCATION_OTHER: return "other";
+	case ALLOCATION_STRING: return "string";
+	case ALLOCATION_ARRAY: return "array";
+	case ALLOCATION_OBJECT: return "object";
+	case ALLOCATION_FUNCTION: return "function";
+	case ALLOCATION_TYPE_DEFINITION: return "type";
+	case ALLOCATION_BINDING: return "binding";
+	case ALLOCATION_INSTRUCTIONS: return "instructions";
+	case ALLOCATION_TOKENS: return "tokens";
+	case ALLOCATION_CATEGORY_COUNT: break;
+	}
+	return "unknown";
+}
+
+AllocationScope::AllocationScope(AllocationCategory category)
+:
+	previous_(currentCategory)
+{
+	currentCategory = category;
+}
+
+AllocationScope::~AllocationScope()
+{
+	currentCategory = previous_;
+}
+
+AllocationStats allocationStats()
+{
+	AllocationStats stats = AllocationStats();
+	for (ThreadCounters *thread = __atomic_load_n(&threads, __ATOMIC_ACQUIRE) ; thread ; thread = thread->next)
+	{
+		stats.allocations += load(thread->allocations);
+		stats.allocatedBytes += load(thread->allocatedBytes);
+		for (int i = 0 ; i < ALLOCATION_CATEGORY_COUNT ; ++i)
+		{
+			stats.liveBytes += load(thread->liveBytes[i]);
+			stats.liveBytesByCategory[i] += load(thread->liveBytes[i]);
+			stats.liveAllocationsByCategory[i] += load(thread->liveAllocations[i]);
+			stats.allocatedBytesByCategory[i] += load(thread->categoryBytes[i]);
+		}
+	}
+	raisePeak(stats.liveBytes);
+	stats.peakBytes = load(peakBytes);
+	return stats;
+}
+
+void trackPeakBytes()
+{
+	if (!trackingPeak)
+	{
+		long long live = threadsLiveBytes();
+		__atomic_store_n(&liveBytes, live, __ATOMIC_RELAXED);
+		raisePeak(live);
+		trackingPeak = true;
+	}
+}
+
+unsigned long long allocationCount()
+{
+	unsigned long long allocations = 0;
+	for (ThreadCounters *thread = __atomic_load_n(&threads, __ATOMIC_ACQUIRE) ; thread ; thread = thread->next)
+	{
+		allocations += load(thread->allocations);
+	}
+	return allocations;
+}
+
+unsigned long long threadAllocationCount()
+{
+	return counters ? counters->allocations : 0;
+}
+
+unsigned long long threadAllocatedBytes()
+{
+	return counters ? counters->allocatedBytes : 0;
+}
+
+// The array and nothrow forms call these by default
+void *operator new(std::size_t size)
+{
+	Header *header = static_cast<Header *>(std::malloc(sizeof(Header) + size));
+	if (!header)
+	{
+		throw std::bad_alloc();
+	}
+	AllocationCategory category = currentCategory;
+	header->size = size;
+	header->category = category;
+
+	if (!counters)
+	{
+		counters = registerThread();
+	}
+	ThreadCounters *thread = counters;
+	__atomic_store_n(&thread->allocations, thread->allocations + 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&thread->allocatedBytes, thread->allocatedBytes + size, __ATOMIC_RELAXED);
+	__atomic_store_n(&thread->liveBytes[category], thread->liveBytes[category] + size, __ATOMIC_RELAXED);
+	__atomic_store_n(&thread->liveAllocations[category], thread->liveAllocations[category] + 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&thread->categoryBytes[category], thread->categoryBytes[category] + size, __ATOMIC_RELAXED);
+
+	if (trackingPeak)
+	{
+		raisePeak(__atomic_add_fetch(&liveBytes, size, __ATOMIC_RELAXED));
+	}
+	return header + 1;
+}
+
+void operator delete(void *pointer) noexcept
+{
+	if (!pointer)
+	{
+		return;
+	}
+	Header *header = static_cast<Header *>(pointer) - 1;
+	AllocationCategory category = header->category;
+	long long size = header->size;
+
+	if (!counters)
+	{
+		counters = registerThread();
+	}
+	ThreadCounters *thread = counters;
+	__atomic_store_n(&thread->liveBytes[category], thread->liveBytes[category] - size, __ATOMIC_RELAXED);
+	__atomic_store_n(&thread->liveAllocations[category], thread->liveAllocations[category] - 1, __ATOMIC_RELAXED);
+	if (trackingPeak)
+	{
+		__atomic_sub_fetch(&liveBytes, size, __ATOMIC_RELAXED);
+	}
+	std::free(header);
+}
@@ -0,0 +1,68 @@
+#ifndef ALLOCATIONS_H
+#define ALLOCATIONS_H
+
+// What the global operator new is allocating for, set by AllocationScope
+enum AllocationCategory
+{
+	ALLOCATION_OTHER,
+	// Value payloads, by Value::Type
+	ALLOCATION_STRING,
+	ALLOCATION_ARRAY,
+	ALLOCATION_OBJECT,
+	ALLOCATION_FUNCTION,
+	ALLOCATION_TYPE_DEFINITION,
+	// Bindings::ValuePtr, without the Value's own payload
+	ALLOCATION_BINDING,
+	ALLOCATION_INSTRUCTIONS,
+	ALLOCATION_TOKENS,
+	ALLOCATION_CATEGORY_COUNT
+};
+
+// e.g. "string", "instructions"
+const char *allocationCategoryName(AllocationCategory category);
+
+// Allocations on this thread are counted against the category until the
+// scope ends, or a nested scope starts
+class AllocationScope
+{
+public:
+	explicit AllocationScope(AllocationCategory category);
+	~AllocationScope();
+
+private:
+	// Deliberately private & unimplemented
+	AllocationScope(const AllocationScope &);
+	AllocationScope &operator=(const AllocationScope &);
+
+	AllocationCategory previous_;
+};
+
+struct AllocationStats
+{
+	unsigned long long allocations;
+	unsigned long long allocatedBytes;
+	long long liveBytes;
+	long long peakBytes;
+	long long liveBytesByCategory[ALLOCATION_CATEGORY_COUNT];
+	long long liveAllocationsByCategory[ALLOCATION_CATEGORY_COUNT];
+	unsigned long long allocatedBytesByCategory[ALLOCATION_CATEGORY_COUNT];
+};
+
+// Since startup, on all threads. Bytes are those requested, not including
+// the allocator's overheads. The peak is only exact once trackPeakBytes() is
+// called, before then it is the most live bytes any call here has seen.
+AllocationStats allocationStats();
+
+// Keeps an exact peak, at the cost of every allocation on every thread
+// updating one shared counter. For --mem-stats, called before any threads
+// start.
+void trackPeakBytes();
+
+// Number of calls to the global operator new since startup, on all threads
+unsigned long long allocationCount();
+
+// Since this thread started, for attributing allocations to the code it runs
+unsigned long long threadAllocationCount();
+unsigned long long threadAllocatedBytes();
+
+#endif
@@ -0,0 +1,659 @@
+#include "array_kernels.h"
+
+#include <atomic>
+#include <limits>
+#include <algorithm>
+
+#ifdef __x86_64__
+#include <immintrin.h>
+
+#define SSE42 __attribute__((target("sse4.2")))
+#define AVX2 __attribute__((target("avx2")))
+#endif
+
+namespace
+{
+	// -1 until first used
+	std::atomic<int> selectedLevel(-1);
+
+	namespace scalar
+	{
+		// The true sum is total plus wraps times 2^64, so only overflow of the
+		// whole sum is reported, as at the other levels
+		bool sumInts(const long long *values, std::size_t size, long long &result)
+		{
+			long long total = 0;
+			long long wraps = 0;
+			for (std::size_t i = 0 ; i < size ; ++i)
+			{
+				if (__builtin_add_overflow(total, values[i], &total))
+				{
+					wraps += (values[i] > 0) ? 1 : -1;
+				}
+			}
+			result = total;
+			return wraps == 0;
+		}
+
+		double sumFloats(const double *values, std::size_t size)
+		{
+			double total = 0;
+			for (std::size_t i = 0 ; i < size ; ++i)
+			{
+				total += values[i];
+			}
+			return total;
+		}
+
+		template <bool MAXIMUM, typename Number>
+		Number extreme(Number best, const Number *values, std::size_t size)
+		{
+			for (std::size_t i = 0 ; i < size ; ++i)
+			{
+				// As minpd and maxpd compare, for the same answer with NaNs
+				if (MAXIMUM ? values[i] > best : values[i] < best)
+				{
+					best = values[i];
+				}
+			}
+			return best;
+		}
+
+		template <bool MAXIMUM, typename Number>
+		Number extremeOf(const Number *values, std::size_t size)
+		{
+			return extreme<MAXIMUM>(values[0], values + 1, size - 1);
+		}
+
+		bool addInts(const long long *left, const long long *right, long long *result, std::size_t size)
+		{
+			for (std::size_t i = 0 ; i < size ; ++i)
+			{
+				if (__builtin_add_overflow(left[i], right[i], &result[i]))
+				{
+					return false;
+				}
+			}
+			return true;
+		}
+
+		void addFloats(const double *left, const double *right, double *result, std::size_t size)
+		{
+			for (std::size_t i = 0 ; i < size ; ++i)
+			{
+				result[i] = left[i] + right[i];
+			}
+		}
+
+		void scaleFloats(const double *values, double factor, double *result, std::size_t size)
+		{
+			for (std::size_t i = 0 ; i < size ; ++i)
+			{
+				result[i] = values[i] * factor;
+			}
+		}
+
+		double dotFloats(const double *left, const double *right, std::size_t size)
+		{
+			double total = 0;
+			for (std::size_t i = 0 ; i < size ; ++i)
+			{
+				total += left[i] * right[i];
+			}
+			return total;
+		}
+
+		template <typename Number>
+		std::size_t indexOf(const Number *values, std::size_t size, Number value)
+		{
+			for (std::size_t i = 0 ; i < size ; ++i)
+			{
+				if (values[i] == value)
+				{
+					return i;
+				}
+			}
+			return size;
+		}
+	}
+
+#ifdef __x86_64__
+	// Few enough elements that no lane's sums reach 2^64
+	const std::size_t SUM_BLOCK = std::size_t(1) << 30;
+
+	// Each lane summed the low and high halves of its elements separately,
+	// unsigned, and counted the negative ones, as a negative element is
+	// high * 2^32 + low - 2^64
+	__int128 combineLanes(const unsigned long long *lows, const unsigned long long *highs, const unsigned long long *negatives, int lanes)
+	{
+		__int128 total = 0;
+		for (int lane = 0 ; lane < lanes ; ++lane)
+		{
+			total += (static_cast<__int128>(highs[lane]) << 32) + lows[lane] - (static_cast<__int128>(negatives[lane]) << 64);
+		}
+		return total;
+	}
+
+	bool narrow(__int128 total, long long &result)
+	{
+		if (total < std::numeric_limits<long long>::min() || total > std::numeric_limits<long long>::max())
+		{
+			return false;
+		}
+		result = static_cast<long long>(total);
+		return true;
+	}
+
+	namespace sse42
+	{
+		SSE42 bool sumInts(const long long *values, std::size_t size, long long &result)
+		{
+			const __m128i lowMask = _mm_set1_epi64x(0xffffffffLL);
+			__int128 total = 0;
+			std::size_t i = 0;
+			std::size_t vectorEnd = size - size % 2;
+			while (i < vectorEnd)
+			{
+				std::size_t blockEnd = i + std::min(vectorEnd - i, SUM_BLOCK);
+				__m128i lows = _mm_setzero_si128();
+				__m128i highs = _mm_setzero_si128();
+				__m128i negatives = _mm_setzero_si128();
+				for ( ; i < blockEnd ; i += 2)
+				{
+					__m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(values + i));
+					lows = _mm_add_epi64(lows, _mm_and_si128(chunk, lowMask));
+					highs = _mm_add_epi64(highs, _mm_srli_epi64(chunk, 32));
+					negatives = _mm_add_epi64(negatives, _mm_srli_epi64(chunk, 63));
+				}
+				unsigned long long lanes[3][2];
+				_mm_storeu_si128(reinterpret_cast<__m128i *>(lanes[0]), lows);
+				_mm_storeu_si128(reinterpret_cast<__m128i *>(lanes[1]), highs);
+				_mm_storeu_si128(reinterpret_cast<__m128i *>(lanes[2]), negatives);
+				total += combineLanes(lanes[0], lanes[1], lanes[2], 2);
+			}
+			for ( ; i < size ; ++i)
+			{
+				total += values[i];
+			}
+			return narrow(total, result);
+		}
+
+		SSE42 double sumFloats(const double *values, std::size_t size)
+		{
+			__m128d totals = _mm_setzero_pd();
+			std::size_t i = 0;
+			for ( ; i + 2 <= size ; i += 2)
+			{
+				totals = _mm_add_pd(totals, _mm_loadu_pd(values + i));
+			}
+			double lanes[2];
+			_mm_storeu_pd(lanes, totals);
+			return lanes[0] + lanes[1] + scalar::sumFloats(values + i, size - i);
+		}
+
+		template <bool MAXIMUM>
+		SSE42 long long extremeInt(const long long *values, std::size_t size)
+		{
+			if (size < 2)
+			{
+				return values[0];
+			}
+			__m128i bests = _mm_loadu_si128(reinterpret_cast<const __m128i *>(values));
+			std::size_t i = 2;
+			for ( ; i + 2 <= size ; i += 2)
+			{
+				__m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(values + i));
+				__m128i better = MAXIMUM ? _mm_cmpgt_epi64(chunk, bests) : _mm_cmpgt_epi64(bests, chunk);
+				bests = _mm_blendv_epi8(bests, chunk, better);
+			}
+			long long lanes[2];
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(lanes), bests);
+			long long best = scalar::extreme<MAXIMUM>(lanes[0], lanes + 1, 1);
+			return scalar::extreme<MAXIMUM>(best, values + i, size - i);
+		}
+
+		template <bool MAXIMUM>
+		SSE42 double extremeFloat(const double *values, std::size_t size)
+		{
+			if (size < 2)
+			{
+				return values[0];
+			}
+			__m128d bests = _mm_loadu_pd(values);
+			std::size_t i = 2;
+			for ( ; i + 2 <= size ; i += 2)
+			{
+				__m128d chunk = _mm_loadu_pd(values + i);
+				bests = MAXIMUM ? _mm_max_pd(chunk, bests) : _mm_min_pd(chunk, bests);
+			}
+			double lanes[2];
+			_mm_storeu_pd(lanes, bests);
+			double best = scalar::extreme<MAXIMUM>(lanes[0], lanes + 1, 1);
+			return scalar::extreme<MAXIMUM>(best, values + i, size - i);
+		}
+
+		SSE42 bool addInts(const long long *left, const long long *right, long long *result, std::size_t size)
+		{
+			// Overflowed where the sum's sign differs from both operands'
+			__m128i overflows = _mm_setzero_si128();
+			std::size_t i = 0;
+			for ( ; i + 2 <= size ; i += 2)
+			{
+				__m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(left + i));
+				__m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i *>(right + i));
+				__m128i sum = _mm_add_epi64(x, y);
+				overflows = _mm_or_si128(overflows, _mm_and_si128(_mm_xor_si128(x, sum), _mm_xor_si128(y, sum)));
+				_mm_storeu_si128(reinterpret_cast<__m128i *>(result + i), sum);
+			}
+			if (_mm_movemask_pd(_mm_castsi128_pd(overflows)) != 0)
+			{
+				return false;
+			}
+			return scalar::addInts(left + i, right + i, result + i, size - i);
+		}
+
+		SSE42 void addFloats(const double *left, const double *right, double *result, std::size_t size)
+		{
+			std::size_t i = 0;
+			for ( ; i + 2 <= size ; i += 2)
+			{
+				_mm_storeu_pd(result + i, _mm_add_pd(_mm_loadu_pd(left + i), _mm_loadu_pd(right + i)));
+			}
+			scalar::addFloats(left + i, right + i, result + i, size - i);
+		}
+
+		SSE42 void scaleFloats(const double *values, double factor, double *result, std::size_t size)
+		{
+			const __m128d factors = _mm_set1_pd(factor);
+			std::size_t i = 0;
+			for ( ; i + 2 <= size ; i += 2)
+			{
+				_mm_storeu_pd(result + i, _mm_mul_pd(_mm_loadu_pd(values + i), factors));
+			}
+			scalar::scaleFloats(values + i, factor, result + i, size - i);
+		}
+
+		SSE42 double dotFloats(const double *left, const double *right, std::size_t size)
+		{
+			__m128d totals = _mm_setzero_pd();
+			std::size_t i = 0;
+			for ( ; i + 2 <= size ; i += 2)
+			{
+				totals = _mm_add_pd(totals, _mm_mul_pd(_mm_loadu_pd(left + i), _mm_loadu_pd(right + i)));
+			}
+			double lanes[2];
+			_mm_storeu_pd(lanes, totals);
+			return lanes[0] + lanes[1] + scalar::dotFloats(left + i, right + i, size - i);
+		}
+
+		SSE42 std::size_t indexOfInt(const long long *values, std::size_t size, long long value)
+		{
+			const __m128i targets = _mm_set1_epi64x(value);
+			std::size_t i = 0;
+			for ( ; i + 2 <= size ; i += 2)
+			{
+				__m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(values + i));
+				int found = _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpeq_epi64(chunk, targets)));
+				if (found != 0)
+				{
+					return i + __builtin_ctz(found);
+				}
+			}
+			return i + scalar::indexOf(values + i, size - i, value);
+		}
+
+		SSE42 std::size_t indexOfFloat(const double *values, std::size_t size, double value)
+		{
+			const __m128d targets = _mm_set1_pd(value);
+			std::size_t i = 0;
+			for ( ; i + 2 <= size ; i += 2)
+			{
+				int found = _mm_movemask_pd(_mm_cmpeq_pd(_mm_loadu_pd(values + i), targets));
+				if (found != 0)
+				{
+					return i + __builtin_ctz(found);
+				}
+			}
+			return i + scalar::indexOf(values + i, size - i, value);
+		}
+	}
+
+	namespace avx2
+	{
+		AVX2 bool sumInts(const long long *values, std::size_t size, long long &result)
+		{
+			const __m256i lowMask = _mm256_set1_epi64x(0xffffffffLL);
+			__int128 total = 0;
+			std::size_t i = 0;
+			std::size_t vectorEnd = size - size % 4;
+			while (i < vectorEnd)
+			{
+				std::size_t blockEnd = i + std::min(vectorEnd - i, SUM_BLOCK);
+				__m256i lows = _mm256_setzero_si256();
+				__m256i highs = _mm256_setzero_si256();
+				__m256i negatives = _mm256_setzero_si256();
+				for ( ; i < blockEnd ; i += 4)
+				{
+					__m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(values + i));
+					lows = _mm256_add_epi64(lows, _mm256_and_si256(chunk, lowMask));
+					highs = _mm256_add_epi64(highs, _mm256_srli_epi64(chunk, 32));
+					negatives = _mm256_add_epi64(negatives, _mm256_srli_epi64(chunk, 63));
+				}
+				unsigned long long lanes[3][4];
+				_mm256_storeu_si256(reinterpret_cast<__m256i *>(lanes[0]), lows);
+				_mm256_storeu_si256(reinterpret_cast<__m256i *>(lanes[1]), highs);
+				_mm256_storeu_si256(reinterpret_cast<__m256i *>(lanes[2]), negatives);
+				total += combineLanes(lanes[0], lanes[1], lanes[2], 4);
+			}
+			for ( ; i < size ; ++i)
+			{
+				total += values[i];
+			}
+			return narrow(total, result);
+		}
+
+		AVX2 double sumFloats(const double *values, std::size_t size)
+		{
+			__m256d totals = _mm256_setzero_pd();
+			std::size_t i = 0;
+			for ( ; i + 4 <= size ; i += 4)
+			{
+				totals = _mm256_add_pd(totals, _mm256_loadu_pd(values + i));
+			}
+			double lanes[4];
+			_mm256_storeu_pd(lanes, totals);
+			return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]) + scalar::sumFloats(values + i, size - i);
+		}
+
+		template <bool MAXIMUM>
+		AVX2 long long extremeInt(const long long *values, std::size_t size)
+		{
+			if (size < 4)
+			{
+				return scalar::extremeOf<MAXIMUM>(values, size);
+			}
+			__m256i bests = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(values));
+			std::size_t i = 4;
+			for ( ; i + 4 <= size ; i += 4)
+			{
+				__m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(values + i));
+				__m256i better = MAXIMUM ? _mm256_cmpgt_epi64(chunk, bests) : _mm256_cmpgt_epi64(bests, chunk);
+				bests = _mm256_blendv_epi8(bests, chunk, better);
+			}
+			long long lanes[4];
+			_mm256_storeu_si256(reinterpret_cast<__m256i *>(lanes), bests);
+			long long best = scalar::extreme<MAXIMUM>(lanes[0], lanes + 1, 3);
+			return scalar::extreme<MAXIMUM>(best, values + i, size - i);
+		}
+
+		template <bool MAXIMUM>
+		AVX2 double extremeFloat(const double *values, std::size_t size)
+		{
+			if (size < 4)
+			{
+				return scalar::extremeOf<MAXIMUM>(values, size);
+			}
+			__m256d bests = _mm256_loadu_pd(values);
+			std::size_t i = 4;
+			for ( ; i + 4 <= size ; i += 4)
+			{
+				__m256d chunk = _mm256_loadu_pd(values + i);
+				bests = MAXIMUM ? _mm256_max_pd(chunk, bests) : _mm256_min_pd(chunk, bests);
+			}
+			double lanes[4];
+			_mm256_storeu_pd(lanes, bests);
+			double best = scalar::extreme<MAXIMUM>(lanes[0], lanes + 1, 3);
+			return scalar::extreme<MAXIMUM>(best, values + i, size - i);
+		}
+
+		AVX2 bool addInts(const long long *left, const long long *right, long long *result, std::size_t size)
+		{
+			__m256i overflows = _mm256_setzero_si256();
+			std::size_t i = 0;
+			for ( ; i + 4 <= size ; i += 4)
+			{
+				__m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(left + i));
+				__m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(right + i));
+				__m256i sum = _mm256_add_epi64(x, y);
+				overflows = _mm256_or_si256(overflows, _mm256_and_si256(_mm256_xor_si256(x, sum), _mm256_xor_si256(y, sum)));
+				_mm256_storeu_si256(reinterpret_cast<__m256i *>(result + i), sum);
+			}
+			if (_mm256_movemask_pd(_mm256_castsi256_pd(overflows)) != 0)
+			{
+				return false;
+			}
+			return scalar::addInts(left + i, right + i, result + i, size - i);
+		}
+
+		AVX2 void addFloats(const double *left, const double *right, double *result, std::size_t size)
+		{
+			std::size_t i = 0;
+			for ( ; i + 4 <= size ; i += 4)
+			{
+				_mm256_storeu_pd(result + i, _mm256_add_pd(_mm256_loadu_pd(left + i), _mm256_loadu_pd(right + i)));
+			}
+			scalar::addFloats(left + i, right + i, result + i, size - i);
+		}
+
+		AVX2 void scaleFloats(const double *values, double factor, double *result, std::size_t size)
+		{
+			const __m256d factors = _mm256_set1_pd(factor);
+			std::size_t i = 0;
+			for ( ; i + 4 <= size ; i += 4)
+			{
+				_mm256_storeu_pd(result + i, _mm256_mul_pd(_mm256_loadu_pd(values + i), factors));
+			}
+			scalar::scaleFloats(values + i, factor, result + i, size - i);
+		}
+
+		AVX2 double dotFloats(const double *left, const double *right, std::size_t size)
+		{
+			// Multiplying and adding separately, rather than with FMA, rounds
+			// each product as the other levels do
+			__m256d totals = _mm256_setzero_pd();
+			std::size_t i = 0;
+			for ( ; i + 4 <= size ; i += 4)
+			{
+				totals = _mm256_add_pd(totals, _mm256_mul_pd(_mm256_loadu_pd(left + i), _mm256_loadu_pd(right + i)));
+			}
+			double lanes[4];
+			_mm256_storeu_pd(lanes, totals);
+			return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]) + scalar::dotFloats(left + i, right + i, size - i);
+		}
+
+		AVX2 std::size_t indexOfInt(const long long *values, std::size_t size, long long value)
+		{
+			const __m256i targets = _mm256_set1_epi64x(value);
+			std::size_t i = 0;
+			for ( ; i + 4 <= size ; i += 4)
+			{
+				__m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(values + i));
+				int found = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(chunk, targets)));
+				if (found != 0)
+				{
+					return i + __builtin_ctz(found);
+				}
+			}
+			return i + scalar::indexOf(values + i, size - i, value);
+		}
+
+		AVX2 std::size_t indexOfFloat(const double *values, std::size_t size, double value)
+		{
+			const __m256d targets = _mm256_set1_pd(value);
+			std::size_t i = 0;
+			for ( ; i + 4 <= size ; i += 4)
+			{
+				int found = _mm256_movemask_pd(_mm256_cmp_pd(_mm256_loadu_pd(values + i), targets, _CMP_EQ_OQ));
+				if (found != 0)
+				{
+					return i + __builtin_ctz(found);
+				}
+			}
+			return i + scalar::indexOf(values + i, size - i, value);
+		}
+	}
+#endif
+
+	SimdLevel detect()
+	{
+#ifdef __x86_64__
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2"))
+		{
+			return SIMD_AVX2;
+		}
+		if (__builtin_cpu_supports("sse4.2"))
+		{
+			return SIMD_SSE42;
+		}
+#endif
+		return SIMD_SCALAR;
+	}
+}
+
+const char *simdLevelName(SimdLevel level)
+{
+	switch (level)
+	{
+	case SIMD_SCALAR:
+		return "scalar";
+	case SIMD_SSE42:
+		return "sse4.2";
+	case SIMD_AVX2:
+		return "avx2";
+	}
+	return "?";
+}
+
+SimdLevel detectedSimdLevel()
+{
+	static const SimdLevel detected = detect();
+	return detected;
+}
+
+SimdLevel simdLevel()
+{
+	int level = selectedLevel.load(std::memory_order_relaxed);
+	if (level < 0)
+	{
+		level = detectedSimdLevel();
+		selectedLevel.store(level, std::memory_order_relaxed);
+	}
+	return static_cast<SimdLevel>(level);
+}
+
+SimdLevel setSimdLevel(SimdLevel level)
+{
+	SimdLevel lowered = std::min(level, detectedSimdLevel());
+	selectedLevel.store(lowered, std::memory_order_relaxed);
+	return lowered;
+}
+
+#ifdef __x86_64__
+#define DISPATCH(kernel, scalarKernel, ...) \
+	switch (simdLevel()) \
+	{ \
+	case SIMD_AVX2: \
+		return avx2::kernel(__VA_ARGS__); \
+	case SIMD_SSE42: \
+		return sse42::kernel(__VA_ARGS__); \
+	default: \
+		return scalar::scalarKernel(__VA_ARGS__); \
+	}
+#else
+#define DISPATCH(kernel, scalarKernel, ...) \
+	return scalar::scalarKernel(__VA_ARGS__);
+#endif
+
+bool sumInts(const long long *values, std::size_t size, long long &result)
+{
+	DISPATCH(sumInts, sumInts, values, size, result)
+}
+
+double sumFloats(const double *values, std::size_t size)
+{
+	DISPATCH(sumFloats, sumFloats, values, size)
+}
+
+long long minInt(const long long *values, std::size_t size)
+{
+	DISPATCH(extremeInt<false>, extremeOf<false>, values, size)
+}
+
+long long maxInt(const long long *values, std::size_t size)
+{
+	DISPATCH(extremeInt<true>, extremeOf<true>, values, size)
+}
+
+double minFloat(const double *values, std::size_t size)
+{
+	DISPATCH(extremeFloat<false>, extremeOf<false>, values, size)
+}
+
+double maxFloat(const double *values, std::size_t size)
+{
+	DISPATCH(extremeFloat<true>, extremeOf<true>, values, size)
+}
+
+bool addInts(const long long *left, const long long *right, long long *result, std::size_t size)
+{
+	DISPATCH(addInts, addInts, left, right, result, size)
+}
+
+void addFloats(const double *left, const double *right, double *result, std::size_t size)
+{
+	DISPATCH(addFloats, addFloats, left, right, result, size)
+}
+
+bool scaleInts(const long long *values, long long factor, long long *result, std::size_t size)
+{
+	for (std::size_t i = 0 ; i < size ; ++i)
+	{
+		if (__builtin_mul_overflow(values[i], factor, &result[i]))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+bool dotInts(const long long *left, const long long *right, std::size_t size, long long &result)
+{
+	// As sumInts, only the whole sum overflowing counts
+	long long total = 0;
+	long long wraps = 0;
+	for (std::size_t i = 0 ; i < size ; ++i)
+	{
+		long long product;
+		if (__builtin_mul_overflow(left[i], right[i], &product))
+		{
+			return false;
+		}
+		if (__builtin_add_overflow(total, product, &total))
+		{
+			wraps += (product > 0) ? 1 : -1;
+		}
+	}
+	result = total;
+	return wraps == 0;
+}
+
+void scaleFloats(const double *values, double factor, double *result, std::size_t size)
+{
+	DISPATCH(scaleFloats, scaleFloats, values, factor, result, size)
+}
+
+double dotFloats(const double *left, const double *right, std::size_t size)
+{
+	DISPATCH(dotFloats, dotFloats, left, right, size)
+}
+
+std::size_t indexOfInt(const long long *values, std::size_t size, long long value)
+{
+	DISPATCH(indexOfInt, indexOf, values, size, value)
+}
+
+std::size_t indexOfFloat(const double *values, std::size_t size, double value)
+{
+	DISPATCH(indexOfFloat, indexOf, values, size, value)
+}
@@ -0,0 +1,57 @@
+#ifndef ARRAY_KERNELS_H
+#define ARRAY_KERNELS_H
+
+#include <cstddef>
+
+// Loops over packed arrays, vectorised with AVX2 or SSE4.2, whichever the CPU
+// has, falling back to plain loops. The level is detected on first use.
+// Integer kernels report overflow rather than wrapping, as the interpreter's
+// arithmetic does.
+enum SimdLevel
+{
+	SIMD_SCALAR,
+	SIMD_SSE42,
+	SIMD_AVX2,
+};
+
+const char *simdLevelName(SimdLevel level);
+
+// The best the CPU supports
+SimdLevel detectedSimdLevel();
+
+// The level the kernels use
+SimdLevel simdLevel();
+
+// E.g. to check each level against the others. Lowered to at most what the
+// CPU supports, which is returned.
+SimdLevel setSimdLevel(SimdLevel level);
+
+// False on overflow
+bool sumInts(const long long *values, std::size_t size, long long &result);
+// Summed a lane at a time, so the last bits may differ from a left fold
+double sumFloats(const double *values, std::size_t size);
+
+// The size must be at least 1
+long long minInt(const long long *values, std::size_t size);
+long long maxInt(const long long *values, std::size_t size);
+double minFloat(const double *values, std::size_t size);
+double maxFloat(const double *values, std::size_t size);
+
+// Element by element into result, which may be either input. False on
+// overflow, leaving result partly written.
+bool addInts(const long long *left, const long long *right, long long *result, std::size_t size);
+void addFloats(const double *left, const double *right, double *result, std::size_t size);
+
+// Neither SSE nor AVX2 multiplies 64 bit integers, so these two are plain
+// overflow checked loops at every level
+bool scaleInts(const long long *values, long long factor, long long *result, std::size_t size);
+bool dotInts(const long long *left, const long long *right, std::size_t size, long long &result);
+
+void scaleFloats(const double *values, double factor, double *result, std::size_t size);
+double dotFloats(const double *left, const double *right, std::size_t size);
+
+// The first index holding value, or size if there is none
+std::size_t indexOfInt(const long long *values, std::size_t size, long long value);
+std::size_t indexOfFloat(const double *values, std::size_t size, double value);
+
+#endif
@@ -0,0 +1,143 @@
+#include "async_task.h"
+
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <memory>
+#include <exception>
+#include <condition_variable>
+
+#include "utils.h"
+#include "channel.h"
+#include "isolate.h"
+#include "settings.h"
+#include "interpreter.h"
+#include "work_stealing_pool.h"
+
+namespace
+{
+	struct AsyncTask
+	{
+		AsyncTask()
+		:
+			id(0),
+			done(false)
+		{
+		}
+
+		int id;
+		std::shared_ptr<const SharedGlobals> globals;
+		Value function;
+		Arguments arguments;
+
+		std::mutex mutex;
+		std::condition_variable finished;
+		std::atomic<bool> done;
+		Value result;
+		std::exception_ptr error;
+	};
+
+	std::mutex mutex;
+	std::map<int, std::shared_ptr<AsyncTask>> tasks;
+	int lastId = 0;
+
+	// The tasks this thread is running, innermost last: each but the last
+	// is waiting in helpUntil() for a task to finish
+	thread_local std::vector<const AsyncTask *> running;
+
+	void run(AsyncTask &task, const Settings &settings)
+	{
+		Value result;
+		std::exception_ptr error;
+		running.push_back(&task);
+		try
+		{
+			Interpreter interpreter(task.globals->isolate(), settings);
+			interpreter.isolatedFrom(task.globals);
+			// Copied out while this thread still owns the cells
+			Value returned = interpreter.call(task.function, task.arguments);
+			result = transferable(returned);
+		}
+		catch (...)
+		{
+			error = std::current_exception();
+		}
+		running.pop_back();
+		// Only the result is wanted now
+		task.globals.reset();
+		task.function = Value();
+		task.arguments.clear();
+
+		std::lock_guard<std::mutex> lock(task.mutex);
+		swap(task.result, result);
+		task.error = error;
+		task.done = true;
+		task.finished.notify_all();
+	}
+}
+
+int startAsyncTask(CallContext &callContext, const Value &function, const Arguments &arguments)
+{
+	Interpreter &interpreter = *callContext.interpreter();
+	const Settings &settings = interpreter.settings();
+
+	// Copied on this thread, which owns the originals
+	std::shared_ptr<AsyncTask> task = std::make_shared<AsyncTask>();
+	task->globals = interpreter.isolatedFrom();
+	if (!task->globals)
+	{
+		task->globals = std::make_shared<SharedGlobals>(*callContext.globals());
+	}
+	IsolatingCopier copier;
+	task->function = copier.copy(function);
+	for (const Value &argument : arguments)
+	{
+		task->arguments.push_back(copier.copy(argument));
+	}
+
+	int id;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		id = ++lastId;
+		task->id = id;
+		tasks[id] = task;
+	}
+	sharedWorkStealingPool(settings.workers).submit([task, settings]() {
+		run(*task, settings);
+	});
+	return id;
+}
+
+bool awaitAsyncTask(int id, Value &result, std::string &error)
+{
+	// Whether or not another thread is already awaiting it
+	for (const AsyncTask *suspended : running)
+	{
+		if (suspended->id == id)
+		{
+			error = "Task " + str(id) + " is running on this thread, beneath this await, which it would deadlock";
+			return false;
+		}
+	}
+	std::shared_ptr<AsyncTask> task;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		std::map<int, std::shared_ptr<AsyncTask>>::iterator it = tasks.find(id);
+		if (it == tasks.end())
+		{
+			error = "No task " + str(id) + ", or it was already awaited";
+			return false;
+		}
+		task = it->second;
+		tasks.erase(it);
+	}
+	// Created by startAsyncTask(), so the size is ignored
+	sharedWorkStealingPool(0).helpUntil(task->mutex, task->finished, [&task]() { return task->done.load(); });
+	if (task->error)
+	{
+		std::rethrow_exception(task->error);
+	}
+	swap(result, task->result);
+	return true;
+}
@@ -0,0 +1,26 @@
+#ifndef ASYNC_TASK_H
+#define ASYNC_TASK_H
+
+#include <string>
+
+#include "value.h"
+#include "call_context.h"
+
+// Queues function(arguments) on the shared work stealing pool, to run in a
+// new interpreter with isolated globals, as an isolate does. Returns an id
+// for awaitAsyncTask(), a future for its result. The globals are copied for
+// a task started outside of any task, and the tasks it starts in turn share
+// that copy (see SharedGlobals), so they do not see what their parent task
+// assigned.
+int startAsyncTask(CallContext &callContext, const Value &function, const Arguments &arguments);
+
+// Runs queued tasks on this thread until the task is done, returning false
+// with the reason if there is no such task. Rethrows whatever the task threw.
+//
+// The tasks run while waiting are suspended beneath it on this thread's
+// stack, so a task awaiting one of those could never finish: that returns
+// false too. Tasks awaiting each other in a cycle across threads still
+// deadlock, as with any futures.
+bool awaitAsyncTask(int id, Value &result, std::string &error);
+
+#endif
@@ -0,0 +1,516 @@
+#include "bench.h"
+
+#include <cmath>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <iostream>
+#include <unistd.h>
+#include <algorithm>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#include "lexer.h"
+#include "escape.h"
+#include "parser.h"
+#include "compiler.h"
+#include "settings.h"
+#include "exceptions.h"
+#include "mapped_file.h"
+#include "allocations.h"
+#include "interpreter.h"
+#include "standard_math.h"
+#include "standard_library.h"
+#include "work_stealing_pool.h"
+
+namespace
+{
+	struct Measurements
+	{
+		std::vector<double> milliseconds;
+		unsigned long long instructions;
+		unsigned long long allocations;
+	};
+
+	// Discards any other output, e.g. --trace, while the program is timed
+	class NullBuffer : public std::streambuf
+	{
+	protected:
+		int overflow(int c)
+		{
+			return traits_type::not_eof(c);
+		}
+	};
+
+	bool run(const std::string &filename, const Settings &settings, Measurements &measurements, bool timed)
+	{
+		Interpreter::Globals globals;
+		standardMath(globals);
+		standardLibrary(globals);
+		Interpreter interpreter(globals, settings);
+		loadStandardLibrary(interpreter, settings);
+
+		unsigned long long instructions = interpreter.instructionsExecuted();
+		unsigned long long allocations = allocationCount();
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		bool succeeded = execute(interpreter, filename, settings);
+		std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+
+		if (timed)
+		{
+			measurements.milliseconds.push_back(elapsed.count());
+			measurements.instructions = interpreter.instructionsExecuted() - instructions;
+			measurements.allocations = allocationCount() - allocations;
+		}
+		return succeeded;
+	}
+
+	// Nearest rank, of sorted samples
+	double percentile(const std::vector<double> &samples, unsigned percent)
+	{
+		std::size_t rank = (samples.size() * percent + 99) / 100;
+		return samples[rank == 0 ? 0 : rank - 1];
+	}
+
+	// Runs in a child process, so each benchmark's peak RSS is its own
+	void benchmark(const std::string &filename, const Settings &settings, int output)
+	{
+		std::streambuf *stdoutBuffer = std::cout.rdbuf();
+		NullBuffer discard;
+		std::cout.rdbuf(&discard);
+		Settings quiet = settings;
+		quiet.outputFd = OutputSink::DISCARD;
+
+		Measurements measurements;
+		bool succeeded = run(filename, quiet, measurements, false);
+		for (unsigned i = 0 ; succeeded && i < settings.benchRuns ; ++i)
+		{
+			succeeded = run(filename, quiet, measurements, true);
+		}
+		std::cout.rdbuf(stdoutBuffer);
+		if (!succeeded)
+		{
+			// The error has already been reported on stderr
+			return;
+		}
+
+		std::vector<double> &samples = measurements.milliseconds;
+		std::sort(samples.begin(), samples.end());
+		std::stringstream result;
+		result << std::fixed << std::setprecision(3);
+		result << "\"median_ms\": " << percentile(samples, 50);
+		result << ", \"p95_ms\": " << percentile(samples, 95);
+		result << ", \"instructions\": " << measurements.instructions;
+		result << ", \"allocations\": " << measurements.allocations;
+		std::string text = result.str();
+		if (write(output, text.data(), text.size()) != static_cast<ssize_t>(text.size()))
+		{
+			_exit(1);
+		}
+	}
+
+	std::string readAll(int input)
+	{
+		std::string result;
+		char buffer[256];
+		ssize_t count;
+		while ((count = read(input, buffer, sizeof(buffer))) > 0)
+		{
+			result.append(buffer, count);
+		}
+		return result;
+	}
+}
+
+int runBenchmarks(const std::vector<std::string> &filenames, const Settings &settings)
+{
+	int failures = 0;
+	std::cout << "{\n";
+	std::cout << "  \"runs\": " << settings.benchRuns << ",\n";
+	std::cout << "  \"benchmarks\": [";
+	for (std::size_t i = 0 ; i < filenames.size() ; ++i)
+	{
+		const std::string &filename = filenames[i];
+		std::cout << (i == 0 ? "\n" : ",\n") << "    {\"name\": " << jsonString(filename) << ", ";
+		std::cout.flush();
+
+		int pipeline[2];
+		if (pipe(pipeline) != 0)
+		{
+			std::perror("pipe");
+			return 1;
+		}
+
+		pid_t child = fork();
+		if (child == 0)
+		{
+			close(pipeline[0]);
+			benchmark(filename, settings, pipeline[1]);
+			std::cerr.flush();
+			_exit(0);
+		}
+		close(pipeline[1]);
+		std::string result = (child > 0) ? readAll(pipeline[0]) : "";
+		close(pipeline[0]);
+
+		int status = 0;
+		struct rusage usage;
+		if (child < 0 || wait4(child, &status, 0, &usage) != child || !WIFEXITED(status) || WEXITSTATUS(status) != 0 || result.empty())
+		{
+			std::cout << "\"error\": \"failed, see stderr\"}";
+			++failures;
+			continue;
+		}
+		// Kilobytes on Linux
+		std::cout << result << ", \"peak_rss_kb\": " << usage.ru_maxrss << "}";
+	}
+	std::cout << "\n  ]\n";
+	std::cout << "}\n";
+	return failures ? 1 : 0;
+}
+
+namespace
+{
+	// Candidate complexity classes, in increasing order of growth
+	struct Complexity
+	{
+		const char *name;
+		double (*cost)(double n);
+	};
+
+	double constant(double) { return 1; }
+	double logarithmic(double n) { return std::log(n); }
+	double linear(double n) { return n; }
+	double linearithmic(double n) { return n * std::log(n); }
+	double quadratic(double n) { return n * n; }
+	double cubic(double n) { return n * n * n; }
+
+	const Complexity COMPLEXITIES[] =
+	{
+		{ "O(1)", &constant },
+		{ "O(log n)", &logarithmic },
+		{ "O(n)", &linear },
+		{ "O(n log n)", &linearithmic },
+		{ "O(n^2)", &quadratic },
+		{ "O(n^3)", &cubic },
+	};
+	const int COMPLEXITY_COUNT = sizeof(COMPLEXITIES) / sizeof(COMPLEXITIES[0]);
+
+	// Sizes 10^2, 10^2.5, ... 10^6
+	const double MIN_EXPONENT = 2;
+	const double MAX_EXPONENT = 6;
+	const double EXPONENT_STEP = 0.5;
+	const unsigned RUNS_PER_SIZE = 3;
+	// Larger sizes are skipped once a run takes this long
+	const double BUDGET_MS = 1000;
+
+	struct Sample
+	{
+		long long n;
+		double milliseconds;
+	};
+
+	struct Workload
+	{
+		Workload() : expected(-1), max(1000000)
+		{
+		}
+
+		int expected;
+		long long max;
+		// The same work done serially, if the workload is parallel
+		std::string speedupOver;
+	};
+
+	int findComplexity(const std::string &name)
+	{
+		for (int i = 0 ; i < COMPLEXITY_COUNT ; ++i)
+		{
+			if (name == COMPLEXITIES[i].name)
+			{
+				return i;
+			}
+		}
+		return -1;
+	}
+
+	// Workloads describe themselves in leading comments:
+	// "// expect: O(n)" and optionally "// max: 10000" and
+	// "// speedup over: serial.rasp", relative to the workload's directory
+	bool readWorkload(const std::string &filename, Workload &workload)
+	{
+		std::ifstream file(filename.c_str());
+		std::string line;
+		while (std::getline(file, line) && line.compare(0, 2, "//") == 0)
+		{
+			std::string::size_type colon = line.find(':');
+			if (colon == std::string::npos)
+			{
+				continue;
+			}
+			std::string key = line.substr(2, colon - 2);
+			key.erase(0, key.find_first_not_of(' '));
+			std::string value = line.substr(colon + 1);
+			value.erase(0, value.find_first_not_of(' '));
+			value.erase(value.find_last_not_of(' ') + 1);
+			if (key == "expect")
+			{
+				workload.expected = findComplexity(value);
+			}
+			else if (key == "max" && is<long long>(value))
+			{
+				workload.max = to<long long>(value);
+			}
+			else if (key == "speedup over" && !value.empty())
+			{
+				std::string::size_type slash = filename.rfind('/');
+				workload.speedupOver = (slash == std::string::npos) ? value : filename.substr(0, slash + 1) + value;
+			}
+		}
+		return workload.expected >= 0;
+	}
+
+	Interpreter::Globals workloadGlobals(long long n)
+	{
+		Interpreter::Globals globals;
+		standardMath(globals);
+		standardLibrary(globals);
+		globals[Identifier("N")] = makeValue(Value::number(n));
+		return globals;
+	}
+
+	bool compileWorkload(const std::string &filename, const Settings &settings, InstructionList &instructions)
+	{
+		try
+		{
+			MappedFile contents(filename);
+			if (!contents.isOpen())
+			{
+				std::cerr << "Failed to load " << filename << '\n';
+				return false;
+			}
+			Token token = lex(filename, contents.begin(), contents.end());
+			Interpreter interpreter(workloadGlobals(0), settings);
+			Declarations declarations = interpreter.declarations();
+			instructions = parse(token, declarations, settings);
+		}
+		catch (const RaspError &e)
+		{
+			std::cerr << filename << ": " << e.what() << '\n';
+			return false;
+		}
+		return true;
+	}
+
+	double timeWorkload(const InstructionList &instructions, long long n, const Settings &settings)
+	{
+		std::vector<double> samples;
+		for (unsigned i = 0 ; i < RUNS_PER_SIZE ; ++i)
+		{
+			Interpreter interpreter(workloadGlobals(n), settings);
+			loadStandardLibrary(interpreter, settings);
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			interpreter.exec(instructions);
+			std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+			samples.push_back(elapsed.count());
+		}
+		std::sort(samples.begin(), samples.end());
+		return percentile(samples, 50);
+	}
+
+	// Least squares fit of time = c * cost(n). Residuals are relative to the
+	// measured time, so the small sizes count as much as the large ones.
+	double fitError(const std::vector<Sample> &samples, const Complexity &complexity)
+	{
+		double products = 0;
+		double squares = 0;
+		for (const Sample &sample : samples)
+		{
+			double ratio = complexity.cost(sample.n) / sample.milliseconds;
+			products += ratio;
+			squares += ratio * ratio;
+		}
+		double coefficient = products / squares;
+		double error = 0;
+		for (const Sample &sample : samples)
+		{
+			double residual = 1 - coefficient * complexity.cost(sample.n) / sample.milliseconds;
+			error += residual * residual;
+		}
+		return std::sqrt(error / samples.size());
+	}
+
+	// Slope of log(time) against log(n) between the two largest sizes, where
+	// the fixed costs of a run matter least
+	double growthExponent(const std::vector<Sample> &samples)
+	{
+		const Sample &a = samples[samples.size() - 2];
+		const Sample &b = samples.back();
+		return std::log(b.milliseconds / a.milliseconds) / std::log(static_cast<double>(b.n) / a.n);
+	}
+
+	// The slope the same two sizes would have if they grew as the complexity
+	double expectedExponent(const std::vector<Sample> &samples, const Complexity &complexity)
+	{
+		double a = samples[samples.size() - 2].n;
+		double b = samples.back().n;
+		return std::log(complexity.cost(b) / complexity.cost(a)) / std::log(b / a);
+	}
+
+	// Allows for timing noise, while half a power of n more is still caught
+	const double EXPONENT_TOLERANCE = 0.25;
+	const double MIN_SPEEDUP_PER_THREAD = 0.5;
+
+	bool scalingBenchmark(const std::string &filename, const Settings &settings, bool &regression)
+	{
+		Workload workload;
+		if (!readWorkload(filename, workload))
+		{
+			std::cerr << filename << ": expected a \"// expect: O(...)\" comment\n";
+			return false;
+		}
+
+		InstructionList instructions;
+		InstructionList serialInstructions;
+		if (!compileWorkload(filename, settings, instructions))
+		{
+			return false;
+		}
+		if (!workload.speedupOver.empty() && !compileWorkload(workload.speedupOver, settings, serialInstructions))
+		{
+			return false;
+		}
+
+		std::vector<Sample> samples;
+		double serialMilliseconds = 0;
+		std::streambuf *stdoutBuffer = std::cout.rdbuf();
+		NullBuffer discard;
+		std::cout.rdbuf(&discard);
+		Settings quiet = settings;
+		quiet.outputFd = OutputSink::DISCARD;
+		try
+		{
+			for (double exponent = MIN_EXPONENT ; exponent <= MAX_EXPONENT + 1e-9 ; exponent += EXPONENT_STEP)
+			{
+				long long n = std::llround(std::pow(10.0, exponent));
+				if (n > workload.max)
+				{
+					break;
+				}
+				Sample sample = { n, timeWorkload(instructions, n, quiet) };
+				samples.push_back(sample);
+				if (sample.milliseconds > BUDGET_MS)
+				{
+					break;
+				}
+				if (samples.size() >= 2)
+				{
+					// Assume the next step grows by as much as the last one did
+					double growth = sample.milliseconds / samples[samples.size() - 2].milliseconds;
+					if (sample.milliseconds * growth > 4 * BUDGET_MS)
+					{
+						break;
+					}
+				}
+			}
+			if (!serialInstructions.empty() && !samples.empty())
+			{
+				serialMilliseconds = timeWorkload(serialInstructions, samples.back().n, quiet);
+			}
+		}
+		catch (const RaspError &e)
+		{
+			std::cout.rdbuf(stdoutBuffer);
+			std::cerr << filename << ": " << e.what() << '\n';
+			printStackTrace(std::cerr, e);
+			return false;
+		}
+		std::cout.rdbuf(stdoutBuffer);
+
+		if (samples.size() < 2)
+		{
+			std::cerr << filename << ": too slow to measure at 2 sizes\n";
+			return false;
+		}
+
+		int best = 0;
+		double bestError = fitError(samples, COMPLEXITIES[0]);
+		for (int i = 1 ; i < COMPLEXITY_COUNT ; ++i)
+		{
+			double error = fitError(samples, COMPLEXITIES[i]);
+			if (error < bestError)
+			{
+				best = i;
+				bestError = error;
+			}
+		}
+		// Neighbouring classes such as O(n) and O(n log n) are hard to tell
+		// apart at these sizes, so the growth at the largest sizes decides
+		double exponent = growthExponent(samples);
+		regression = exponent > expectedExponent(samples, COMPLEXITIES[workload.expected]) + EXPONENT_TOLERANCE;
+
+		// At least half of each thread past the first, where the machine
+		// has the cores for them
+		double speedup = serialMilliseconds / samples.back().milliseconds;
+		unsigned threads = std::min(sharedWorkStealingPool(settings.workers).threads(), std::max(std::thread::hardware_concurrency(), 1u));
+		bool slow = !serialInstructions.empty() && threads >= 2 && speedup < 1 + MIN_SPEEDUP_PER_THREAD * (threads - 1);
+
+		std::cout << "\"expected\": " << jsonString(COMPLEXITIES[workload.expected].name);
+		std::cout << ", \"fitted\": " << jsonString(COMPLEXITIES[best].name);
+		std::cout << std::fixed << std::setprecision(2);
+		std::cout << ", \"exponent\": " << exponent;
+		if (!serialInstructions.empty())
+		{
+			std::cout << ", \"threads\": " << threads;
+			std::cout << ", \"speedup\": " << speedup;
+		}
+		std::cout << ", \"regression\": " << (regression || slow ? "true" : "false");
+		std::cout << std::setprecision(3);
+		std::cout << ", \"samples\": [";
+		for (std::size_t i = 0 ; i < samples.size() ; ++i)
+		{
+			std::cout << (i == 0 ? "" : ", ") << "{\"n\": " << samples[i].n << ", \"ms\": " << samples[i].milliseconds << "}";
+		}
+		std::cout << "]";
+		std::cout.unsetf(std::ios::floatfield);
+		regression = regression || slow;
+		return true;
+	}
+}
+
+int runScalingBenchmarks(const std::vector<std::string> &filenames, const Settings &settings)
+{
+	int failures = 0;
+	std::vector<std::string> regressions;
+	std::cout << "{\n";
+	std::cout << "  \"benchmarks\": [";
+	for (std::size_t i = 0 ; i < filenames.size() ; ++i)
+	{
+		const std::string &filename = filenames[i];
+		std::cout << (i == 0 ? "\n" : ",\n") << "    {\"name\": " << jsonString(filename) << ", ";
+		bool regression = false;
+		if (!scalingBenchmark(filename, settings, regression))
+		{
+			std::cout << "\"error\": \"failed, see stderr\"";
+			++failures;
+		}
+		std::cout << "}";
+		std::cout.flush();
+		if (regression)
+		{
+			regressions.push_back(filename);
+		}
+	}
+	std::cout << "\n  ]\n";
+	std::cout << "}\n";
+
+	for (const std::string &filename : regressions)
+	{
+		std::cerr << filename << ": grows faster than expected, or parallel work does not speed up\n";
+	}
+	return (failures || !regressions.empty()) ? 1 : 0;
+}
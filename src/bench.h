@@ -0,0 +1,20 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <string>
+#include <vector>
+
+class Settings;
+
+// Runs each file Settings::benchRuns times, after one untimed warm up run,
+// in a fresh interpreter each time. Program output is discarded, and the
+// results are printed to stdout as JSON.
+int runBenchmarks(const std::vector<std::string> &filenames, const Settings &settings);
+
+// Runs each file with the global N set to sizes from 10^2 up to 10^6, and
+// fits the complexity class of the run time. Files give the class they are
+// expected to have in a "// expect: O(n)" comment, and may limit the sizes
+// with "// max: 10000". Fails if any file grows faster than expected.
+int runScalingBenchmarks(const std::vector<std::string> &filenames, const Settings &settings);
+
+#endif
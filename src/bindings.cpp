@@ -1,8 +1,8 @@
 #include "bindings.h"
 
-#include <algorithm>
 #include "bug.h"
 #include "utils.h"
+#include "allocations.h"
 
 Bindings::Bindings(Mapping *globalsByName)
 :
@@ -32,12 +32,19 @@ const Value &Bindings::get(RefType refType, const Identifier &identifier) const
 void Bindings::set(RefType refType, const Identifier &identifier, const Value &value)
 {
 	Mapping &mapping = mappingFor(refType);
-	Bindings::const_iterator it = mapping.find(identifier);
+	Mapping::iterator it = mapping.find(identifier);
 	if (it == mapping.end())
 	{
 		throw CompilerBug("Cannot set an unbound " + str(refType) + " identifier: '" + identifier.name() + "'");
 	}
-	*mapping[identifier] = value;
+	if (refType == Global && it->second.use_count() > 1)
+	{
+		// A global cell is only shared read only, between isolates (see
+		// SharedGlobals) or with the mapping an interpreter was created from
+		it->second = makeValue(value);
+		return;
+	}
+	*it->second = value;
 }
 
 void Bindings::init(RefType refType, const Identifier &identifier, const Value &value)
@@ -119,6 +126,7 @@ const Bindings::Mapping &Bindings::mappingFor(RefType refType) const
 
 Bindings::ValuePtr makeValue(const Value &value)
 {
+	AllocationScope allocationScope(ALLOCATION_BINDING);
 	return Bindings::ValuePtr(new Value(value));
 }
     
@@ -138,46 +146,72 @@ std::ostream &operator<<(std::ostream &out, Bindings::RefType refType)
     }
 }
 
+Scope::Scope(const std::shared_ptr<const Scope> &outer)
+:
+	outer_(outer)
+{
+}
+
 void Scope::add(const Identifier &identifier)
 {
-	if(isDefined(identifier))
+	if(!declarations.insert(identifier.name()).second)
 	{
 		throw CompilerBug("Identifier is already defined " + identifier.name());
 	}
-	declarations.push_back(identifier);
 }
 
 bool Scope::isDefined(const Identifier &identifier) const
 {
-	return std::find(declarations.begin(), declarations.end(), identifier) != declarations.end();
+	return declarations.find(identifier.name()) != declarations.end();
+}
+
+const std::shared_ptr<const Scope> &Scope::outer() const
+{
+	return outer_;
 }
 
 Declarations::Declarations()
+:
+	innermost(std::make_shared<Scope>(nullptr))
 {
-	innerToOuterScopes.push_back(Scope());
 }
 
 Declarations::Declarations(const Bindings::Mapping &globalScope)
+:
+	innermost(std::make_shared<Scope>(nullptr))
 {
-	innerToOuterScopes.push_back(Scope());
-
 	for(Bindings::const_iterator it = globalScope.begin() ; it != globalScope.end() ; ++it)
 	{
-		innerToOuterScopes[0].add(it->first);
+		innermost->add(it->first);
 	}
 }
 
-Declarations Declarations::newScope()
+Declarations::Declarations(const Declarations &other)
+:
+	innermost(std::make_shared<Scope>(*other.innermost))
+{
+}
+
+Declarations &Declarations::operator=(Declarations other)
+{
+	innermost.swap(other.innermost);
+	return *this;
+}
+
+Declarations::Declarations(const std::shared_ptr<Scope> &innermost)
+:
+	innermost(innermost)
+{
+}
+
+Declarations Declarations::newScope() const
 {
-	Declarations result = *this;
-	result.innerToOuterScopes.insert(result.innerToOuterScopes.begin(), Scope());
-	return result;
+	return Declarations(std::make_shared<Scope>(innermost));
 }
 
 void Declarations::add(const Identifier &identifier)
 {
-	assert(!innerToOuterScopes.empty());
-	innerToOuterScopes.front().add(identifier);
+	innermost->add(identifier);
 }
 
 bool Declarations::isDefined(const Identifier &identifier) const
@@ -187,15 +221,15 @@ bool Declarations::isDefined(const Identifier &identifier) const
 
 IdentifierDefinition Declarations::checkIdentifier(const Identifier &identifier) const
 {
-	for(std::vector<Scope>::size_type i = 0 ; i < innerToOuterScopes.size() ; ++i)
+	for(const Scope *scope = innermost.get() ; scope ; scope = scope->outer().get())
 	{
-		if(innerToOuterScopes[i].isDefined(identifier))
+		if(scope->isDefined(identifier))
 		{
-			if (i == innerToOuterScopes.size() - 1)
+			if (!scope->outer())
 			{
 				return IDENTIFIER_DEFINITION_GLOBAL;
 			}
-			else if (i == 0)
+			else if (scope == innermost.get())
 			{
 				return IDENTIFIER_DEFINITION_LOCAL;
 			}
@@ -204,4 +238,3 @@ IdentifierDefinition Declarations::checkIdentifier(const Identifier &identifier)
 	}
 	return IDENTIFIER_DEFINITION_UNDEFINED;
 }
-
@@ -3,6 +3,7 @@
 
 #include <map>
 #include <memory>
+#include <unordered_set>
 
 #include "value.h"
 #include "identifier.h"
@@ -57,11 +58,17 @@ std::ostream &operator<<(std::ostream &out, Bindings::RefType refType);
 class Scope
 {
 public:
+	explicit Scope(const std::shared_ptr<const Scope> &outer);
+
 	void add(const Identifier &identifer);
 	bool isDefined(const Identifier &identifier) const;
 
+	// Null for the global scope
+	const std::shared_ptr<const Scope> &outer() const;
+
 private:
-	std::vector<Identifier> declarations;
+	std::unordered_set<std::string> declarations;
+	std::shared_ptr<const Scope> outer_;
 };
 
 enum IdentifierDefinition {
@@ -77,14 +84,22 @@ public:
 	Declarations();
 	Declarations(const Bindings::Mapping &globalScope);
 
-	Declarations newScope();
+	// Copies only the innermost scope, the outer ones are shared
+	Declarations(const Declarations &other);
+	Declarations(Declarations &&other) = default;
+	Declarations &operator=(Declarations other);
+
+	// The new scope refers to, rather than copies, the existing ones
+	Declarations newScope() const;
 
 	void add(const Identifier &identifer);
 	bool isDefined(const Identifier &identifier) const;
 	IdentifierDefinition checkIdentifier(const Identifier &identifier) const;
 
 private:
-	std::vector<Scope> innerToOuterScopes;
+	explicit Declarations(const std::shared_ptr<Scope> &innermost);
+
+	std::shared_ptr<Scope> innermost;
 };
 
 #endif
@@ -0,0 +1,6 @@
+#include "library_image.h"
+
+// Empty, the bootstrap interpreter loads standard-library.rasp from source
+const char LIBRARY_IMAGE[] = { 0 };
+
+const std::size_t LIBRARY_IMAGE_SIZE = 0;
@@ -0,0 +1,522 @@
+#include "bytecode.h"
+
+#include <cstring>
+
+#include "api.h"
+#include "utils.h"
+#include "closure.h"
+#include "function.h"
+#include "identifier.h"
+#include "allocations.h"
+#include "type_definition.h"
+#include "internal_function.h"
+
+namespace
+{
+	enum FunctionKind
+	{
+		FUNCTION_INTERNAL,
+		FUNCTION_CLOSURE,
+		FUNCTION_EXTERNAL,
+	};
+
+	bool hasIdentifierOperand(Instruction::Type type)
+	{
+		switch(type)
+		{
+		case Instruction::REF_LOCAL:
+		case Instruction::INIT_LOCAL:
+		case Instruction::ASSIGN_LOCAL:
+		case Instruction::REF_GLOBAL:
+		case Instruction::INIT_GLOBAL:
+		case Instruction::ASSIGN_GLOBAL:
+		case Instruction::REF_CLOSURE:
+		case Instruction::INIT_CLOSURE:
+		case Instruction::ASSIGN_CLOSURE:
+		case Instruction::MEMBER_ACCESS:
+			return true;
+		default:
+			return false;
+		}
+	}
+
+	Identifier readIdentifier(BytecodeReader &reader)
+	{
+		std::string name = reader.readString();
+		if (!Identifier::isValid(name))
+		{
+			throw BytecodeError("Invalid identifier '" + name + "'");
+		}
+		return Identifier(name);
+	}
+
+	std::vector<Identifier> readIdentifiers(BytecodeReader &reader)
+	{
+		std::vector<Identifier> result;
+		unsigned long long count = reader.readUnsigned();
+		for (unsigned long long i = 0 ; i < count ; ++i)
+		{
+			result.push_back(readIdentifier(reader));
+		}
+		return result;
+	}
+
+	void writeIdentifiers(BytecodeWriter &writer, const std::vector<Identifier> &identifiers)
+	{
+		writer.writeUnsigned(identifiers.size());
+		for (const Identifier &identifier : identifiers)
+		{
+			writer.writeString(identifier.name());
+		}
+	}
+
+	void writeFunction(BytecodeWriter &writer, const Function &function)
+	{
+		if (const InternalFunction *internalFunction = dynamic_cast<const InternalFunction *>(&function))
+		{
+			writer.writeByte(FUNCTION_INTERNAL);
+			writer.writeSourceLocation(internalFunction->sourceLocation());
+			writer.writeString(internalFunction->name());
+			writeIdentifiers(writer, internalFunction->parameters());
+			writer.writeInstructions(internalFunction->instructions());
+		}
+		else if (const Closure *closure = dynamic_cast<const Closure *>(&function))
+		{
+			writer.writeByte(FUNCTION_CLOSURE);
+			writeFunction(writer, closure->innerFunction());
+			writer.writeBindings(closure->closedValues());
+		}
+		else if (dynamic_cast<const ExternalFunction *>(&function) || dynamic_cast<const PureExternalFunction *>(&function))
+		{
+			writer.writeByte(FUNCTION_EXTERNAL);
+			writer.writeString(function.name());
+		}
+		else
+		{
+			throw BytecodeError("Cannot serialise function '" + function.name() + "'");
+		}
+	}
+
+	std::unique_ptr<Function> readFunction(BytecodeReader &reader, const Bindings::Mapping *builtins)
+	{
+		unsigned char kind = reader.readByte();
+		switch(kind)
+		{
+		case FUNCTION_INTERNAL:
+			{
+				SourceLocation sourceLocation = reader.readSourceLocation();
+				Identifier name = readIdentifier(reader);
+				std::vector<Identifier> parameters = readIdentifiers(reader);
+				InstructionList instructions = reader.readInstructions();
+				return std::unique_ptr<Function>(new InternalFunction(sourceLocation, name, parameters, instructions));
+			}
+		case FUNCTION_CLOSURE:
+			{
+				std::unique_ptr<Function> innerFunction = readFunction(reader, builtins);
+				Bindings::Mapping closedValues = reader.readBindings();
+				return std::unique_ptr<Function>(new Closure(*innerFunction, closedValues));
+			}
+		case FUNCTION_EXTERNAL:
+			{
+				Identifier name = readIdentifier(reader);
+				if (!builtins)
+				{
+					throw BytecodeError("Cannot resolve external function '" + name.name() + "'");
+				}
+				Bindings::const_iterator it = builtins->find(name);
+				if (it == builtins->end() || !it->second->isFunction())
+				{
+					throw BytecodeError("Unknown external function '" + name.name() + "'");
+				}
+				return std::unique_ptr<Function>(it->second->function().clone());
+			}
+		default:
+			throw BytecodeError("Unknown function kind " + str(static_cast<int>(kind)));
+		}
+	}
+}
+
+void BytecodeWriter::writeByte(unsigned char byte)
+{
+	buffer_.push_back(static_cast<char>(byte));
+}
+
+void BytecodeWriter::writeUnsigned(unsigned long long number)
+{
+	// LEB128: seven bits at a time, high bit set on all but the last byte
+	do
+	{
+		unsigned char byte = number & 0x7f;
+		number >>= 7;
+		if (number != 0)
+		{
+			byte |= 0x80;
+		}
+		writeByte(byte);
+	}
+	while (number != 0);
+}
+
+void BytecodeWriter::writeSigned(long long number)
+{
+	// Zig-zag encoding keeps small negative numbers short
+	unsigned long long bits = static_cast<unsigned long long>(number);
+	writeUnsigned((bits << 1) ^ (number < 0 ? ~0ull : 0ull));
+}
+
+void BytecodeWriter::writeFloat(double number)
+{
+	unsigned long long bits;
+	std::memcpy(&bits, &number, sizeof(bits));
+	writeUnsigned(bits);
+}
+
+void BytecodeWriter::writeString(const std::string &text)
+{
+	// Zero introduces a new string, otherwise it is an index + 1 into the strings seen so far
+	std::map<std::string, unsigned long long>::const_iterator it = strings_.find(text);
+	if (it != strings_.end())
+	{
+		writeUnsigned(it->second + 1);
+		return;
+	}
+	unsigned long long index = strings_.size();
+	strings_.insert(std::make_pair(text, index));
+	writeUnsigned(0);
+	writeUnsigned(text.size());
+	buffer_.append(text);
+}
+
+void BytecodeWriter::writeSourceLocation(const SourceLocation &sourceLocation)
+{
+	writeString(sourceLocation.filename());
+	writeUnsigned(sourceLocation.line());
+}
+
+void BytecodeWriter::writeValue(const Value &value)
+{
+	writeByte(value.type());
+	switch(value.type())
+	{
+	case Value::TNil:
+		break;
+	case Value::TArray:
+		{
+			const Value::Array &array = value.array();
+			writeUnsigned(array.size());
+			for (const Value &element : array)
+			{
+				writeValue(element);
+			}
+		}
+		break;
+	case Value::TString:
+		writeString(value.string());
+		break;
+	case Value::TNumber:
+		writeSigned(value.number());
+		break;
+	case Value::TFloat:
+		writeFloat(value.floating());
+		break;
+	case Value::TIntArray:
+		{
+			const Value::IntArray &array = value.intArray();
+			writeUnsigned(array.size());
+			for (long long element : array)
+			{
+				writeSigned(element);
+			}
+		}
+		break;
+	case Value::TFloatArray:
+		{
+			const Value::FloatArray &array = value.floatArray();
+			writeUnsigned(array.size());
+			for (double element : array)
+			{
+				writeFloat(element);
+			}
+		}
+		break;
+	case Value::TObject:
+		{
+			const Value::Object &object = value.object();
+			writeUnsigned(object.size());
+			for (Value::Object::const_iterator it = object.begin() ; it != object.end() ; ++it)
+			{
+				writeString(it->first);
+				writeValue(it->second);
+			}
+		}
+		break;
+	case Value::TBoolean:
+		writeByte(value.boolean() ? 1 : 0);
+		break;
+	case Value::TFunction:
+		writeFunction(*this, value.function());
+		break;
+	case Value::TTypeDefinition:
+		{
+			const TypeDefinition &typeDefinition = value.typeDefinition();
+			writeString(typeDefinition.name());
+			writeIdentifiers(*this, typeDefinition.memberNames());
+		}
+		break;
+	default:
+		throw BytecodeError("Cannot serialise value of type " + str(value.type()));
+	}
+}
+
+void BytecodeWriter::writeInstructions(const InstructionList &instructions)
+{
+	writeUnsigned(instructions.size());
+	for (const Instruction &instruction : instructions)
+	{
+		writeByte(instruction.type());
+		writeSourceLocation(instruction.sourceLocation());
+		writeValue(instruction.value());
+	}
+}
+
+void BytecodeWriter::writeBinding(const Bindings::ValuePtr &binding)
+{
+	// Zero introduces a new binding, otherwise it is an index + 1 into the bindings seen so far
+	std::map<const Value *, unsigned long long>::const_iterator it = bindings_.find(binding.get());
+	if (it != bindings_.end())
+	{
+		writeUnsigned(it->second + 1);
+		return;
+	}
+	// Registered before writing the value, which may refer back to this binding
+	unsigned long long index = bindings_.size();
+	bindings_.insert(std::make_pair(binding.get(), index));
+	writeUnsigned(0);
+	writeValue(*binding);
+}
+
+void BytecodeWriter::writeBindings(const Bindings::Mapping &mapping)
+{
+	writeUnsigned(mapping.size());
+	for (Bindings::const_iterator it = mapping.begin() ; it != mapping.end() ; ++it)
+	{
+		writeString(it->first.name());
+		writeBinding(it->second);
+	}
+}
+
+const std::string &BytecodeWriter::buffer() const
+{
+	return buffer_;
+}
+
+BytecodeReader::BytecodeReader(const char *begin, const char *end)
+:
+	current_(begin),
+	end_(end),
+	builtins_(nullptr)
+{
+}
+
+void BytecodeReader::resolveExternalFunctionsFrom(const Bindings::Mapping *builtins)
+{
+	builtins_ = builtins;
+}
+
+unsigned char BytecodeReader::readByte()
+{
+	if (current_ == end_)
+	{
+		throw BytecodeError("Unexpected end of bytecode");
+	}
+	return static_cast<unsigned char>(*current_++);
+}
+
+unsigned long long BytecodeReader::readUnsigned()
+{
+	unsigned long long result = 0;
+	unsigned shift = 0;
+	unsigned char byte;
+	do
+	{
+		if (shift >= 64)
+		{
+			throw BytecodeError("Malformed variable length integer");
+		}
+		byte = readByte();
+		result |= static_cast<unsigned long long>(byte & 0x7f) << shift;
+		shift += 7;
+	}
+	while (byte & 0x80);
+	return result;
+}
+
+long long BytecodeReader::readSigned()
+{
+	unsigned long long bits = readUnsigned();
+	return static_cast<long long>((bits >> 1) ^ (~(bits & 1) + 1));
+}
+
+double BytecodeReader::readFloat()
+{
+	unsigned long long bits = readUnsigned();
+	double number;
+	std::memcpy(&number, &bits, sizeof(number));
+	return number;
+}
+
+std::string BytecodeReader::readString()
+{
+	unsigned long long reference = readUnsigned();
+	if (reference != 0)
+	{
+		if (reference > strings_.size())
+		{
+			throw BytecodeError("Invalid string reference " + str(reference));
+		}
+		return strings_[reference - 1];
+	}
+	unsigned long long length = readUnsigned();
+	if (length > static_cast<unsigned long long>(end_ - current_))
+	{
+		throw BytecodeError("String length " + str(length) + " exceeds remaining bytecode");
+	}
+	strings_.push_back(std::string(current_, current_ + length));
+	current_ += length;
+	return strings_.back();
+}
+
+SourceLocation BytecodeReader::readSourceLocation()
+{
+	std::string filename = readString();
+	unsigned long long line = readUnsigned();
+	return SourceLocation(filename, line);
+}
+
+Value BytecodeReader::readValue()
+{
+	unsigned char type = readByte();
+	switch(type)
+	{
+	case Value::TNil:
+		return Value::nil();
+	case Value::TArray:
+		{
+			Value::Array array;
+			unsigned long long size = readUnsigned();
+			for (unsigned long long i = 0 ; i < size ; ++i)
+			{
+				array.push_back(readValue());
+			}
+			return Value::array(array);
+		}
+	case Value::TString:
+		return Value::string(readString());
+	case Value::TNumber:
+		return Value::number(readSigned());
+	case Value::TFloat:
+		return Value::floating(readFloat());
+	case Value::TIntArray:
+		{
+			Value::IntArray array;
+			unsigned long long size = readUnsigned();
+			for (unsigned long long i = 0 ; i < size ; ++i)
+			{
+				array.push_back(readSigned());
+			}
+			return Value::intArray(array);
+		}
+	case Value::TFloatArray:
+		{
+			Value::FloatArray array;
+			unsigned long long size = readUnsigned();
+			for (unsigned long long i = 0 ; i < size ; ++i)
+			{
+				array.push_back(readFloat());
+			}
+			return Value::floatArray(array);
+		}
+	case Value::TObject:
+		{
+			Value::Object object;
+			unsigned long long size = readUnsigned();
+			for (unsigned long long i = 0 ; i < size ; ++i)
+			{
+				std::string key = readString();
+				object[key] = readValue();
+			}
+			return Value::object(object);
+		}
+	case Value::TBoolean:
+		return Value::boolean(readByte() != 0);
+	case Value::TFunction:
+		return Value::function(*readFunction(*this, builtins_));
+	case Value::TTypeDefinition:
+		{
+			Identifier name = readIdentifier(*this);
+			std::vector<Identifier> memberNames = readIdentifiers(*this);
+			return Value::typeDefinition(std::make_shared<TypeDefinition>(name, memberNames));
+		}
+	default:
+		throw BytecodeError("Unknown value type " + str(static_cast<int>(type)));
+	}
+}
+
+InstructionList BytecodeReader::readInstructions()
+{
+	AllocationScope allocationScope(ALLOCATION_INSTRUCTIONS);
+	InstructionList result;
+	unsigned long long size = readUnsigned();
+	for (unsigned long long i = 0 ; i < size ; ++i)
+	{
+		unsigned char rawType = readByte();
+		if (rawType >= Instruction::TYPE_COUNT)
+		{
+			throw BytecodeError("Unknown instruction type " + str(static_cast<int>(rawType)));
+		}
+		Instruction::Type type = static_cast<Instruction::Type>(rawType);
+		SourceLocation sourceLocation = readSourceLocation();
+		Value value = readValue();
+		// The interpreter trusts the parser, so check operands are what it would generate
+		if (hasIdentifierOperand(type) ? !(value.isString() && Identifier::isValid(value.string())) : (type != Instruction::PUSH && !value.isNumber()))
+		{
+			throw BytecodeError("Invalid operand " + str(value) + " for instruction type " + str(type));
+		}
+		result.push_back(Instruction(sourceLocation, type, value));
+	}
+	return result;
+}
+
+Bindings::ValuePtr BytecodeReader::readBinding()
+{
+	unsigned long long reference = readUnsigned();
+	if (reference != 0)
+	{
+		if (reference > bindings_.size())
+		{
+			throw BytecodeError("Invalid binding reference " + str(reference));
+		}
+		return bindings_[reference - 1];
+	}
+	Bindings::ValuePtr binding = makeValue(Value::nil());
+	bindings_.push_back(binding);
+	*binding = readValue();
+	return binding;
+}
+
+Bindings::Mapping BytecodeReader::readBindings()
+{
+	Bindings::Mapping result;
+	unsigned long long size = readUnsigned();
+	for (unsigned long long i = 0 ; i < size ; ++i)
+	{
+		Identifier name = readIdentifier(*this);
+		result[name] = readBinding();
+	}
+	return result;
+}
+
+bool BytecodeReader::atEnd() const
+{
+	return current_ == end_;
+}
@@ -0,0 +1,98 @@
+#ifndef BYTECODE_H
+#define BYTECODE_H
+
+#include <map>
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+#include "value.h"
+#include "bindings.h"
+#include "instruction.h"
+#include "source_location.h"
+
+// Bumped whenever the encoding below changes, older files are then rejected
+const unsigned BYTECODE_VERSION = 3;
+
+class BytecodeError : public std::runtime_error
+{
+public:
+	BytecodeError(const std::string &message) : std::runtime_error(message)
+	{
+	}
+};
+
+// Compact binary encoding of values and instruction lists.
+// Integers are variable length, and each distinct string (identifiers,
+// filenames, literals) is written once and referenced by index afterwards.
+class BytecodeWriter
+{
+public:
+	void writeByte(unsigned char byte);
+
+	void writeUnsigned(unsigned long long number);
+
+	void writeSigned(long long number);
+
+	void writeFloat(double number);
+
+	void writeString(const std::string &text);
+
+	void writeSourceLocation(const SourceLocation &sourceLocation);
+
+	void writeValue(const Value &value);
+
+	void writeInstructions(const InstructionList &instructions);
+
+	// Bindings shared between closures are written once, preserving sharing
+	void writeBinding(const Bindings::ValuePtr &binding);
+
+	void writeBindings(const Bindings::Mapping &mapping);
+
+	const std::string &buffer() const;
+
+private:
+	std::string buffer_;
+	std::map<std::string, unsigned long long> strings_;
+	std::map<const Value *, unsigned long long> bindings_;
+};
+
+class BytecodeReader
+{
+public:
+	BytecodeReader(const char *begin, const char *end);
+
+	// External functions are written by name, and looked up here when read
+	void resolveExternalFunctionsFrom(const Bindings::Mapping *builtins);
+
+	unsigned char readByte();
+
+	unsigned long long readUnsigned();
+
+	long long readSigned();
+
+	double readFloat();
+
+	std::string readString();
+
+	SourceLocation readSourceLocation();
+
+	Value readValue();
+
+	InstructionList readInstructions();
+
+	Bindings::ValuePtr readBinding();
+
+	Bindings::Mapping readBindings();
+
+	bool atEnd() const;
+
+private:
+	const char *current_;
+	const char *end_;
+	const Bindings::Mapping *builtins_;
+	std::vector<std::string> strings_;
+	std::vector<Bindings::ValuePtr> bindings_;
+};
+
+#endif
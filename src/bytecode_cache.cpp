@@ -0,0 +1,222 @@
+#include "bytecode_cache.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <climits>
+#include <thread>
+#include <fstream>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "utils.h"
+#include "bytecode.h"
+#include "settings.h"
+#include "mapped_file.h"
+
+namespace
+{
+	const std::string MAGIC = "RASPC";
+	const std::string SOURCE_EXTENSION = ".rasp";
+
+	struct SourceStamp
+	{
+		unsigned long long size;
+		long long modifiedSeconds;
+		long long modifiedNanoseconds;
+	};
+
+	bool readStamp(const std::string &filename, SourceStamp &stamp)
+	{
+		struct stat status;
+		if (stat(filename.c_str(), &status) != 0)
+		{
+			return false;
+		}
+		stamp.size = status.st_size;
+		stamp.modifiedSeconds = status.st_mtim.tv_sec;
+		stamp.modifiedNanoseconds = status.st_mtim.tv_nsec;
+		return true;
+	}
+
+	// FNV-1a
+	unsigned long long hashContents(const char *begin, const char *end)
+	{
+		unsigned long long hash = 14695981039346656037ull;
+		for (const char *c = begin ; c != end ; ++c)
+		{
+			hash ^= static_cast<unsigned char>(*c);
+			hash *= 1099511628211ull;
+		}
+		return hash;
+	}
+
+	std::string toHex(unsigned long long number)
+	{
+		std::stringstream stream;
+		stream << std::hex << number;
+		return stream.str();
+	}
+
+	std::string cacheFilenameFor(const std::string &sourceFilename, const Settings &settings)
+	{
+		if (settings.cacheDirectory.empty())
+		{
+			bool hasExtension = sourceFilename.size() >= SOURCE_EXTENSION.size()
+				&& sourceFilename.compare(sourceFilename.size() - SOURCE_EXTENSION.size(), SOURCE_EXTENSION.size(), SOURCE_EXTENSION) == 0;
+			return sourceFilename + (hasExtension ? "c" : ".raspc");
+		}
+
+		// Avoid collisions between identically named files in different directories
+		std::string path = sourceFilename;
+		char resolved[PATH_MAX];
+		if (realpath(sourceFilename.c_str(), resolved))
+		{
+			path = resolved;
+		}
+		std::string::size_type slash = path.find_last_of('/');
+		std::string basename = (slash == std::string::npos) ? path : path.substr(slash + 1);
+		return settings.cacheDirectory + "/" + toHex(hashContents(path.data(), path.data() + path.size())) + "-" + basename + "c";
+	}
+}
+
+BytecodeCache::BytecodeCache(const std::string &sourceFilename, const Settings &settings)
+:
+	// Printing the syntax tree or instructions requires the front end to run
+	enabled_(settings.bytecodeCache && !settings.printSyntaxTree && !settings.printInstructions),
+	sourceFilename_(sourceFilename),
+	cacheFilename_(cacheFilenameFor(sourceFilename, settings))
+{
+}
+
+bool BytecodeCache::enabled() const
+{
+	return enabled_;
+}
+
+bool BytecodeCache::load(InstructionList &instructions, GlobalNames &names)
+{
+	return load(nullptr, instructions, names);
+}
+
+bool BytecodeCache::load(const MappedFile &source, InstructionList &instructions, GlobalNames &names)
+{
+	if (!load(&source, instructions, names))
+	{
+		return false;
+	}
+	// Only the modification time was out of date, refresh it for next time
+	store(source, instructions);
+	return true;
+}
+
+bool BytecodeCache::load(const MappedFile *source, InstructionList &instructions, GlobalNames &names)
+{
+	if (!enabled_)
+	{
+		return false;
+	}
+
+	MappedFile file(cacheFilename_);
+	if (!file.isOpen() || file.size() < MAGIC.size() || MAGIC.compare(0, MAGIC.size(), file.begin(), MAGIC.size()) != 0)
+	{
+		return false;
+	}
+
+	try
+	{
+		BytecodeReader reader(file.begin() + MAGIC.size(), file.end());
+		if (reader.readUnsigned() != BYTECODE_VERSION)
+		{
+			return false;
+		}
+
+		SourceStamp cached;
+		cached.size = reader.readUnsigned();
+		cached.modifiedSeconds = reader.readSigned();
+		cached.modifiedNanoseconds = reader.readSigned();
+		unsigned long long cachedHash = reader.readUnsigned();
+
+		if (source)
+		{
+			if (cached.size != source->size() || cachedHash != hashContents(source->begin(), source->end()))
+			{
+				return false;
+			}
+		}
+		else
+		{
+			SourceStamp current;
+			if (!readStamp(sourceFilename_, current))
+			{
+				return false;
+			}
+			if (current.size != cached.size || current.modifiedSeconds != cached.modifiedSeconds || current.modifiedNanoseconds != cached.modifiedNanoseconds)
+			{
+				return false;
+			}
+		}
+
+		GlobalNames cachedNames;
+		cachedNames.read(reader);
+		InstructionList result = reader.readInstructions();
+		if (!reader.atEnd())
+		{
+			return false;
+		}
+		instructions.swap(result);
+		names = cachedNames;
+		return true;
+	}
+	catch (const BytecodeError &)
+	{
+		// Corrupt or truncated, will be overwritten after compiling
+		return false;
+	}
+}
+
+void BytecodeCache::store(const MappedFile &source, const InstructionList &instructions)
+{
+	SourceStamp stamp;
+	if (!enabled_ || !readStamp(sourceFilename_, stamp))
+	{
+		return;
+	}
+
+	BytecodeWriter writer;
+	try
+	{
+		writer.writeUnsigned(BYTECODE_VERSION);
+		writer.writeUnsigned(source.size());
+		writer.writeSigned(stamp.modifiedSeconds);
+		writer.writeSigned(stamp.modifiedNanoseconds);
+		writer.writeUnsigned(hashContents(source.begin(), source.end()));
+		GlobalNames(instructions).write(writer);
+		writer.writeInstructions(instructions);
+	}
+	catch (const BytecodeError &)
+	{
+		return;
+	}
+
+	// Write then rename, so concurrent runs never see a partial file.
+	// Each process and thread writes its own temporary file.
+	std::string temporaryFilename = cacheFilename_ + "." + str(getpid()) + "." + str(std::this_thread::get_id()) + ".tmp";
+	{
+		std::ofstream file(temporaryFilename.c_str(), std::ios::binary | std::ios::trunc);
+		file << MAGIC << writer.buffer();
+		if (!file.flush())
+		{
+			std::remove(temporaryFilename.c_str());
+			return;
+		}
+	}
+	if (std::rename(temporaryFilename.c_str(), cacheFilename_.c_str()) != 0)
+	{
+		std::remove(temporaryFilename.c_str());
+	}
+}
+
+const std::string &BytecodeCache::filename() const
+{
+	return cacheFilename_;
+}
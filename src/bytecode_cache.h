@@ -0,0 +1,43 @@
+#ifndef BYTECODE_CACHE_H
+#define BYTECODE_CACHE_H
+
+#include <string>
+
+#include "instruction.h"
+#include "global_names.h"
+
+class Settings;
+class MappedFile;
+
+// Compiled instructions for a source file, stored in a ".raspc" file next to
+// the source (or in Settings::cacheDirectory).
+// A cache file is only used if it was written for the same source contents.
+// The caller must also check the returned GlobalNames are consistent with
+// the interpreter, i.e. the globals are in the state the parser saw.
+class BytecodeCache
+{
+public:
+	BytecodeCache(const std::string &sourceFilename, const Settings &settings);
+
+	bool enabled() const;
+
+	// Cheap check, trusts the file size and modification time of the source
+	bool load(InstructionList &instructions, GlobalNames &names);
+
+	// Falls back to comparing a hash of the source contents
+	bool load(const MappedFile &source, InstructionList &instructions, GlobalNames &names);
+
+	// Failure to write the cache is not an error
+	void store(const MappedFile &source, const InstructionList &instructions);
+
+	const std::string &filename() const;
+
+private:
+	bool load(const MappedFile *source, InstructionList &instructions, GlobalNames &names);
+
+	bool enabled_;
+	std::string sourceFilename_;
+	std::string cacheFilename_;
+};
+
+#endif
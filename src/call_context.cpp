@@ -29,6 +29,11 @@ const Arguments &CallContext::arguments() const
 	return arguments_;
 }
 
+Arguments &CallContext::arguments()
+{
+	return arguments_;
+}
+
 Bindings::Mapping *CallContext::globals()
 {
 	return globals_;
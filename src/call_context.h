@@ -18,6 +18,9 @@ public:
 
 	const Arguments &arguments() const;
 
+	// The arguments are the call's own copies, which may be taken
+	Arguments &arguments();
+
 	Bindings::Mapping *globals();
 
 	const Bindings::Mapping &closedValues() const;
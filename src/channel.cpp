@@ -0,0 +1,140 @@
+#include "channel.h"
+
+#include "closure.h"
+#include "isolate.h"
+#include "execution_error.h"
+
+Channel::Channel(std::size_t capacity)
+:
+	queue_(capacity),
+	closed_(false),
+	waiting_(0)
+{
+}
+
+bool Channel::send(Value &value)
+{
+	if (closed_)
+	{
+		return false;
+	}
+	if (!queue_.tryPush(value))
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		++waiting_;
+		// Checked again under the lock, which wakeWaiting() takes, so a
+		// receiver making room now still wakes this thread
+		bool sent;
+		while (!(sent = !closed_ && queue_.tryPush(value)) && !closed_)
+		{
+			changed_.wait(lock);
+		}
+		--waiting_;
+		if (!sent)
+		{
+			return false;
+		}
+	}
+	wakeWaiting();
+	return true;
+}
+
+bool Channel::receive(Value &value)
+{
+	if (!queue_.tryPop(value))
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		++waiting_;
+		bool received;
+		while (!(received = queue_.tryPop(value)) && !closed_)
+		{
+			changed_.wait(lock);
+		}
+		// Sent before closing
+		received = received || queue_.tryPop(value);
+		--waiting_;
+		if (!received)
+		{
+			return false;
+		}
+	}
+	wakeWaiting();
+	return true;
+}
+
+void Channel::close()
+{
+	closed_ = true;
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+	}
+	changed_.notify_all();
+}
+
+void Channel::wakeWaiting()
+{
+	// Orders the push or pop before reading waiting_, as the waiters
+	// order incrementing it before trying again
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (waiting_ > 0)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+		}
+		changed_.notify_all();
+	}
+}
+
+Value transferable(Value &value)
+{
+	// One object returned, as Value has no move constructor
+	Value result;
+	if (needsIsolatingCopy(value))
+	{
+		result = IsolatingCopier().copy(value);
+	}
+	else
+	{
+		swap(result, value);
+	}
+	return result;
+}
+
+ChannelHandle::ChannelHandle(std::size_t capacity)
+:
+	channel_(std::make_shared<Channel>(capacity))
+{
+}
+
+ChannelHandle::ChannelHandle(const std::shared_ptr<Channel> &channel)
+:
+	channel_(channel)
+{
+}
+
+ChannelHandle *ChannelHandle::clone() const
+{
+	return new ChannelHandle(channel_);
+}
+
+Value ChannelHandle::call(CallContext &) const
+{
+	throw ExecutionError(sourceLocation(), "A channel is passed to chan_send, chan_recv and chan_close, not called");
+}
+
+const std::string &ChannelHandle::name() const
+{
+	static const std::string name = "channel";
+	return name;
+}
+
+const SourceLocation &ChannelHandle::sourceLocation() const
+{
+	static const SourceLocation location = CURRENT_SOURCE_LOCATION;
+	return location;
+}
+
+const std::shared_ptr<Channel> &ChannelHandle::channel() const
+{
+	return channel_;
+}
@@ -0,0 +1,72 @@
+#ifndef CHANNEL_H
+#define CHANNEL_H
+
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <condition_variable>
+
+#include "value.h"
+#include "function.h"
+#include "mpmc_queue.h"
+
+// A bounded queue of values between isolates. Sending and receiving take
+// no lock unless the channel is full or empty, when the thread sleeps until
+// another makes progress or closes the channel.
+class Channel
+{
+public:
+	explicit Channel(std::size_t capacity);
+
+	// Takes the value, leaving nil, blocking while the channel is full.
+	// False if the channel is closed.
+	bool send(Value &value);
+
+	// Blocks while the channel is empty. False once it is closed and empty.
+	bool receive(Value &value);
+
+	void close();
+
+private:
+	// Deliberately private & unimplemented
+	Channel(const Channel &);
+	Channel &operator=(const Channel &);
+
+	void wakeWaiting();
+
+	MpmcQueue<Value> queue_;
+	std::atomic<bool> closed_;
+	std::atomic<int> waiting_;
+	std::mutex mutex_;
+	std::condition_variable changed_;
+};
+
+// The value to send in place of the given one, which another isolate can
+// own. Arrays, objects and strings are handed over as they are, without
+// copying. Closures, whose closed values would otherwise be shared between
+// the isolates, are copied with new ones, and generators are detached (see
+// IsolatingCopier), as their frames cannot move between threads.
+Value transferable(Value &value);
+
+// A channel as a value, as chan_new returns. Copies, in whichever isolate,
+// share the channel, which is freed with the last of them. Passed to the
+// channel builtins rather than called.
+class ChannelHandle : public Function
+{
+public:
+	explicit ChannelHandle(std::size_t capacity);
+
+	virtual ChannelHandle *clone() const;
+	virtual Value call(CallContext &) const;
+	virtual	const std::string &name() const;
+	virtual	const SourceLocation &sourceLocation() const;
+
+	const std::shared_ptr<Channel> &channel() const;
+
+private:
+	explicit ChannelHandle(const std::shared_ptr<Channel> &channel);
+
+	std::shared_ptr<Channel> channel_;
+};
+
+#endif
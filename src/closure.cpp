@@ -14,7 +14,8 @@ Closure *Closure::clone() const
 
 Value Closure::call(CallContext &callContext) const
 {
-	CallContext nestedContext(callContext.globals(), closedValuesByName_, callContext.arguments(), callContext.interpreter());
+	CallContext nestedContext(callContext.globals(), closedValuesByName_, Arguments(), callContext.interpreter());
+	swap(nestedContext.arguments(), callContext.arguments());
 	return innerFunction_->call(nestedContext);
 }
 
@@ -28,3 +29,12 @@ const SourceLocation &Closure::sourceLocation() const
 	return innerFunction_->sourceLocation();
 }
 
+const Function &Closure::innerFunction() const
+{
+	return *innerFunction_;
+}
+
+const Bindings::Mapping &Closure::closedValues() const
+{
+	return closedValuesByName_;
+}
@@ -12,6 +12,10 @@ public:
 	virtual Value call(CallContext &) const;
 	virtual	const std::string &name() const;
 	virtual	const SourceLocation &sourceLocation() const;
+
+	const Function &innerFunction() const;
+	const Bindings::Mapping &closedValues() const;
+
 private:
 	std::unique_ptr<Function> innerFunction_;
 	Bindings::Mapping closedValuesByName_;
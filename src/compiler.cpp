@@ -1,31 +1,91 @@
 #include "compiler.h"
 
+#include <memory>
+#include <future>
 #include <fstream>
 #include <iostream>
-#include <iterator>
 
+#include "bug.h"
+#include "utils.h"
 #include "lexer.h"
 #include "parser.h"
+#include "keyword.h"
 #include "settings.h"
+#include "bytecode.h"
 #include "exceptions.h"
 #include "interpreter.h"
+#include "mapped_file.h"
 #include "execution_error.h"
+#include "thread_pool.h"
+#include "trace_events.h"
+#include "library_image.h"
+#include "bytecode_cache.h"
 
-void execute(Interpreter &interpreter, const std::string &filename, const Settings &settings)
+namespace
 {
-	std::fstream file(filename.c_str());
-	if (file)
+	Token lexFile(const std::string &filename, const MappedFile &contents)
 	{
-		std::string contents(
-			// Extra parens for "most vexing parse"
-			(std::istreambuf_iterator<char>(file)), 
-			std::istreambuf_iterator<char>());
-		try
+		TraceSpan span("compile", "lex", filename);
+		return lex(filename, contents.begin(), contents.end());
+	}
+
+	bool compile(Interpreter &interpreter, const std::string &filename, const Settings &settings, InstructionList &instructions)
+	{
+		BytecodeCache cache(filename, settings);
+		GlobalNames names;
+		{
+			TraceSpan span("compile", "read cache", filename);
+			if (cache.load(instructions, names) && names.consistentWith(interpreter))
+			{
+				return true;
+			}
+		}
+
+		std::unique_ptr<MappedFile> contents;
+		{
+			TraceSpan span("compile", "read", filename);
+			contents.reset(new MappedFile(filename));
+		}
+		if (!contents->isOpen())
+		{
+			std::cerr << "Failed to load " << filename << '\n';
+			return false;
+		}
+
 		{
-			Token token = lex(filename, contents);
+			TraceSpan span("compile", "read cache", filename);
+			if (cache.load(*contents, instructions, names) && names.consistentWith(interpreter))
+			{
+				return true;
+			}
+		}
+
+		Token token = lexFile(filename, *contents);
+		{
+			TraceSpan span("compile", "parse", filename);
 			Declarations declarations = interpreter.declarations();
-			InstructionList instructions = parse(token, declarations, settings);
-			interpreter.exec(instructions);
+			instructions = parse(token, declarations, settings);
+		}
+		TraceSpan span("compile", "write cache", filename);
+		cache.store(*contents, instructions);
+		return true;
+	}
+
+	template<typename Compile>
+	bool compileAndExecute(Interpreter &interpreter, const std::string &filename, Compile compile)
+	{
+		try
+		{
+			InstructionList instructions;
+			if (compile(instructions))
+			{
+				TraceSpan span("exec", "exec", filename);
+				interpreter.exec(instructions);
+				// Then whatever I/O the file started
+				interpreter.runEventLoop();
+				interpreter.output().flush();
+				return true;
+			}
 		}
 		catch(const LexError &e)
 		{
@@ -51,9 +111,296 @@ void execute(Interpreter &interpreter, const std::string &filename, const Settin
 		{
 			std::cerr << "Internal Error in " << filename << ": " << error.what() << std::endl;
 		}
+		return false;
+	}
+}
+
+bool execute(Interpreter &interpreter, const std::string &filename, const Settings &settings)
+{
+	return compileAndExecute(interpreter, filename, [&](InstructionList &instructions) {
+		return compile(interpreter, filename, settings, instructions);
+	});
+}
+
+namespace
+{
+	// A file compiled on a worker thread, ahead of the files before it running
+	struct SpeculativeCompile
+	{
+		SpeculativeCompile()
+		:
+			compiled(false),
+			cached(false)
+		{
+		}
+
+		std::string filename;
+		std::unique_ptr<MappedFile> contents;
+		// Null if loaded from the cache, or if lexing failed
+		std::unique_ptr<Token> tree;
+		InstructionList instructions;
+		GlobalNames names;
+		bool compiled;
+		bool cached;
+	};
+
+	void loadOrLex(SpeculativeCompile &unit, const Settings &settings)
+	{
+		BytecodeCache cache(unit.filename, settings);
+		{
+			TraceSpan span("compile", "read cache", unit.filename);
+			if (cache.load(unit.instructions, unit.names))
+			{
+				unit.compiled = unit.cached = true;
+				return;
+			}
+		}
+
+		{
+			TraceSpan span("compile", "read", unit.filename);
+			unit.contents.reset(new MappedFile(unit.filename));
+		}
+		if (!unit.contents->isOpen())
+		{
+			return;
+		}
+
+		{
+			TraceSpan span("compile", "read cache", unit.filename);
+			if (cache.load(*unit.contents, unit.instructions, unit.names))
+			{
+				unit.compiled = unit.cached = true;
+				return;
+			}
+		}
+
+		try
+		{
+			unit.tree.reset(new Token(lexFile(unit.filename, *unit.contents)));
+		}
+		catch (const std::exception &)
+		{
+			// Reported when the file is compiled again in order
+		}
+	}
+
+	void parseSpeculatively(SpeculativeCompile &unit, Declarations &declarations, const Settings &settings)
+	{
+		try
+		{
+			TraceSpan span("compile", "parse", unit.filename);
+			unit.instructions = parse(*unit.tree, declarations, settings);
+			unit.names = GlobalNames(unit.instructions);
+			unit.compiled = true;
+		}
+		catch (const std::exception &)
+		{
+			// As above, the declarations may just have been guessed wrongly
+		}
+	}
+
+	void declare(Declarations &declarations, const std::string &name)
+	{
+		if (Identifier::isValid(name))
+		{
+			Identifier identifier(name);
+			if (!declarations.isDefined(identifier))
+			{
+				declarations.add(identifier);
+			}
+		}
+	}
+
+	// Later files are parsed assuming the globals this file appears to define
+	void declareGlobals(const SpeculativeCompile &unit, Declarations &declarations)
+	{
+		if (unit.compiled)
+		{
+			for (const Instruction &instruction : unit.instructions)
+			{
+				if (instruction.type() == Instruction::INIT_GLOBAL)
+				{
+					declare(declarations, instruction.value().string());
+				}
+			}
+		}
+		else if (unit.tree)
+		{
+			for (const Token &definition : unit.tree->children())
+			{
+				const Token::Children &children = definition.children();
+				if (definition.type() != Token::LIST || children.size() < 2 || children[0].type() != Token::KEYWORD)
+				{
+					continue;
+				}
+				const std::string &keyword = children[0].string();
+				if (keyword != KEYWORD_VAR && keyword != KEYWORD_DEFUN && keyword != KEYWORD_TYPE)
+				{
+					continue;
+				}
+				const Token &name = children[1];
+				if (name.type() == Token::IDENTIFIER)
+				{
+					declare(declarations, name.string());
+				}
+				else if (name.type() == Token::DECLARATION)
+				{
+					declare(declarations, name.children()[0].string());
+				}
+			}
+		}
+	}
+}
+
+void execute(Interpreter &interpreter, const std::vector<std::string> &filenames, const Settings &settings)
+{
+	// The front end prints as it goes when asked to
+	if (settings.jobs < 2 || filenames.size() < 2 || settings.printSyntaxTree || settings.printInstructions)
+	{
+		for (const std::string &filename : filenames)
+		{
+			execute(interpreter, filename, settings);
+		}
+		return;
+	}
+
+	std::vector<SpeculativeCompile> units(filenames.size());
+	std::vector<std::future<void>> lexed;
+	std::vector<std::future<void>> parsed(units.size());
+	ThreadPool pool(settings.jobs);
+
+	for (std::size_t i = 0 ; i < units.size() ; ++i)
+	{
+		SpeculativeCompile &unit = units[i];
+		unit.filename = filenames[i];
+		lexed.push_back(pool.submit([&unit, &settings]() {
+			loadOrLex(unit, settings);
+		}));
+	}
+
+	Declarations declarations = interpreter.declarations();
+	for (std::size_t i = 0 ; i < units.size() ; ++i)
+	{
+		SpeculativeCompile &unit = units[i];
+		lexed[i].wait();
+		if (unit.tree)
+		{
+			std::shared_ptr<Declarations> scope = std::make_shared<Declarations>(declarations);
+			parsed[i] = pool.submit([&unit, scope, &settings]() {
+				parseSpeculatively(unit, *scope, settings);
+			});
+		}
+		declareGlobals(unit, declarations);
+	}
+
+	for (std::size_t i = 0 ; i < units.size() ; ++i)
+	{
+		SpeculativeCompile &unit = units[i];
+		if (parsed[i].valid())
+		{
+			parsed[i].wait();
+		}
+
+		if (unit.compiled && unit.names.consistentWith(interpreter))
+		{
+			if (!unit.cached)
+			{
+				TraceSpan span("compile", "write cache", unit.filename);
+				BytecodeCache(unit.filename, settings).store(*unit.contents, unit.instructions);
+			}
+			compileAndExecute(interpreter, unit.filename, [&unit](InstructionList &instructions) {
+				instructions.swap(unit.instructions);
+				return true;
+			});
+		}
+		else
+		{
+			// Compiling in order gives the same diagnostics as without threads
+			execute(interpreter, unit.filename, settings);
+		}
+	}
+}
+
+void executeImage(Interpreter &interpreter, const std::string &name, const char *image, std::size_t size)
+{
+	compileAndExecute(interpreter, name, [&](InstructionList &instructions) {
+		try
+		{
+			TraceSpan span("compile", "read image", name);
+			BytecodeReader reader(image, image + size);
+			unsigned long long version = reader.readUnsigned();
+			if (version != BYTECODE_VERSION)
+			{
+				throw CompilerBug("Image " + name + " has bytecode version " + str(version) + ", expected " + str(BYTECODE_VERSION));
+			}
+			instructions = reader.readInstructions();
+		}
+		catch (const BytecodeError &e)
+		{
+			throw CompilerBug("Image " + name + " is corrupt: " + e.what());
+		}
+		return true;
+	});
+}
+
+void loadStandardLibrary(Interpreter &interpreter, const Settings &settings)
+{
+	const char *selfHostedStandardLibrary = "standard-library.rasp";
+	TraceSpan span("startup", "load", selfHostedStandardLibrary);
+	if (LIBRARY_IMAGE_SIZE > 0)
+	{
+		executeImage(interpreter, selfHostedStandardLibrary, LIBRARY_IMAGE, LIBRARY_IMAGE_SIZE);
+	}
+	else if (std::ifstream(selfHostedStandardLibrary).good())
+	{
+	  execute(interpreter, selfHostedStandardLibrary, settings);
 	}
 	else
+	{
+	  std::cerr << "WARN: failed to load " << selfHostedStandardLibrary << std::endl;
+	}
+}
+
+bool writeLibraryImage(Interpreter &interpreter, const std::string &filename, std::ostream &out, const Settings &settings)
+{
+	MappedFile contents(filename);
+	if (!contents.isOpen())
 	{
 		std::cerr << "Failed to load " << filename << '\n';
+		return false;
+	}
+
+	BytecodeWriter writer;
+	try
+	{
+		Token token = lex(filename, contents.begin(), contents.end());
+		Declarations declarations = interpreter.declarations();
+		InstructionList instructions = parse(token, declarations, settings);
+		writer.writeUnsigned(BYTECODE_VERSION);
+		writer.writeInstructions(instructions);
+	}
+	catch(const LexError &e)
+	{
+		std::cerr << "Lex error at " << e.sourceLocation() << " " << e.what() << '\n';
+		return false;
+	}
+	catch(const ParseError &e)
+	{
+		std::cerr << "Parse error at " << e.sourceLocation() << " " << e.what() << '\n';
+		return false;
+	}
+
+	const std::string &buffer = writer.buffer();
+	out << "// Generated from " << filename << " by --write-library-image, do not edit\n";
+	out << "#include \"library_image.h\"\n";
+	out << "\n";
+	out << "const char LIBRARY_IMAGE[] = {";
+	for (std::size_t i = 0 ; i < buffer.size() ; ++i)
+	{
+		out << (i % 16 == 0 ? "\n\t" : " ") << static_cast<int>(static_cast<signed char>(buffer[i])) << ',';
 	}
+	out << "\n};\n";
+	out << "\n";
+	out << "const std::size_t LIBRARY_IMAGE_SIZE = " << buffer.size() << ";\n";
+	return static_cast<bool>(out);
 }
@@ -1,12 +1,31 @@
 #ifndef COMPILER_H
 #define COMPILER_H
 
+#include <iosfwd>
 #include <string>
+#include <vector>
+#include <cstddef>
 
 class Settings;
 class Interpreter;
 
-void execute(Interpreter &, const std::string &filename, const Settings &);
+// False if the file could not be loaded, or failed to compile or run
+bool execute(Interpreter &, const std::string &filename, const Settings &);
+
+// With Settings::jobs > 1 the files are lexed and parsed concurrently,
+// each assuming the files before it define the globals they appear to.
+// Execution, and any diagnostics, still happen in order; a file whose
+// assumptions turn out wrong is compiled again when its turn comes.
+void execute(Interpreter &, const std::vector<std::string> &filenames, const Settings &);
+
+// Runs bytecode written by writeLibraryImage(), skipping the lexer and parser
+void executeImage(Interpreter &, const std::string &name, const char *image, std::size_t size);
+
+// Uses the image linked into the interpreter, or the source when bootstrapping
+void loadStandardLibrary(Interpreter &, const Settings &);
+
+// Compiles a source file and writes the bytecode out as C++ source, for linking into the interpreter
+bool writeLibraryImage(Interpreter &, const std::string &filename, std::ostream &out, const Settings &);
 
 #endif
 
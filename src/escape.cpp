@@ -1,5 +1,7 @@
 #include "escape.h"
 
+#include <iomanip>
+#include <sstream>
 #include <stdexcept>
 
 namespace {
@@ -90,3 +92,25 @@ std::string addEscapes(const std::string &text)
 	return result;
 }
 
+std::string jsonString(const std::string &text)
+{
+	std::stringstream result;
+	result << '"';
+	for (char c : text)
+	{
+		if (c == '"' || c == '\\')
+		{
+			result << '\\' << c;
+		}
+		else if (static_cast<unsigned char>(c) < 0x20)
+		{
+			result << "\\u" << std::hex << std::setw(4) << std::setfill('0') << static_cast<int>(c) << std::dec;
+		}
+		else
+		{
+			result << c;
+		}
+	}
+	result << '"';
+	return result.str();
+}
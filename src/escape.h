@@ -11,5 +11,8 @@ char reescape(char c);
 
 std::string addEscapes(const std::string &text);
 
+// Quoted, for writing JSON
+std::string jsonString(const std::string &text);
+
 #endif
 
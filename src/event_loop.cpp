@@ -0,0 +1,308 @@
+#include "event_loop.h"
+
+#include <cerrno>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+#include "utils.h"
+#include "interpreter.h"
+#include "standard_library_error.h"
+
+namespace
+{
+	const std::size_t CHUNK_SIZE = 64 * 1024;
+	const int MAX_EVENTS = 64;
+
+	bool wouldBlock()
+	{
+		return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+	}
+}
+
+struct EventLoop::Operation
+{
+	enum Kind
+	{
+		READ_FILE,
+		WRITE_FILE,
+		READ_PIPE,
+		TIMER,
+	};
+
+	Operation(Kind kind, const std::string &path, const Value &callback)
+	:
+		kind(kind),
+		path(path),
+		fd(-1),
+		polled(false),
+		callback(callback),
+		written(0)
+	{
+	}
+
+	~Operation()
+	{
+		if (fd >= 0)
+		{
+			::close(fd);
+		}
+	}
+
+	// The builtin that started it, for errors
+	const char *builtin() const
+	{
+		switch (kind)
+		{
+		case READ_FILE:
+			return "file_read";
+		case WRITE_FILE:
+			return "file_write";
+		case READ_PIPE:
+			return "pipe_read";
+		case TIMER:
+			return "timer";
+		}
+		return "?";
+	}
+
+	ExternalFunctionError error(const std::string &action) const
+	{
+		return ExternalFunctionError(builtin(), CURRENT_SOURCE_LOCATION, "Cannot " + action + " '" + path + "': " + std::strerror(errno));
+	}
+
+	Kind kind;
+	std::string path;
+	int fd;
+	bool polled;
+	Value callback;
+	// Read so far, or still to write
+	std::string data;
+	std::size_t written;
+};
+
+EventLoop::EventLoop(Interpreter &interpreter)
+:
+	interpreter_(interpreter),
+	epoll_(::epoll_create1(EPOLL_CLOEXEC)),
+	buffer_(CHUNK_SIZE)
+{
+	if (epoll_ < 0)
+	{
+		throw ExternalFunctionError("epoll_create1", CURRENT_SOURCE_LOCATION, std::string("Cannot start the event loop: ") + std::strerror(errno));
+	}
+}
+
+EventLoop::~EventLoop()
+{
+	// Closing the pending operations' files first
+	operations_.clear();
+	::close(epoll_);
+}
+
+void EventLoop::readFile(const std::string &path, const Value &callback)
+{
+	std::unique_ptr<Operation> operation(new Operation(Operation::READ_FILE, path, callback));
+	operation->fd = ::open(path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+	if (operation->fd < 0)
+	{
+		throw operation->error("open");
+	}
+	add(std::move(operation));
+}
+
+void EventLoop::writeFile(const std::string &path, const std::string &contents, const Value &callback)
+{
+	std::unique_ptr<Operation> operation(new Operation(Operation::WRITE_FILE, path, callback));
+	operation->fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_NONBLOCK | O_CLOEXEC, 0666);
+	if (operation->fd < 0)
+	{
+		throw operation->error("open");
+	}
+	operation->data = contents;
+	add(std::move(operation));
+}
+
+void EventLoop::readPipe(const std::string &path, const Value &callback)
+{
+	std::unique_ptr<Operation> operation(new Operation(Operation::READ_PIPE, path, callback));
+	operation->fd = ::open(path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+	if (operation->fd < 0)
+	{
+		throw operation->error("open");
+	}
+	add(std::move(operation));
+}
+
+void EventLoop::startTimer(int milliseconds, const Value &callback)
+{
+	std::unique_ptr<Operation> operation(new Operation(Operation::TIMER, str(milliseconds) + "ms", callback));
+	operation->fd = ::timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (operation->fd < 0)
+	{
+		throw operation->error("create timer");
+	}
+	itimerspec expiry = {};
+	expiry.it_value.tv_sec = milliseconds / 1000;
+	expiry.it_value.tv_nsec = (milliseconds % 1000) * 1000000L;
+	if (milliseconds == 0)
+	{
+		// A zero expiry would disarm it instead
+		expiry.it_value.tv_nsec = 1;
+	}
+	if (::timerfd_settime(operation->fd, 0, &expiry, nullptr) < 0)
+	{
+		throw operation->error("set timer");
+	}
+	add(std::move(operation));
+}
+
+void EventLoop::add(std::unique_ptr<Operation> operation)
+{
+	epoll_event event = {};
+	event.events = (operation->kind == Operation::WRITE_FILE) ? EPOLLOUT : EPOLLIN;
+	event.data.fd = operation->fd;
+	if (::epoll_ctl(epoll_, EPOLL_CTL_ADD, operation->fd, &event) == 0)
+	{
+		operation->polled = true;
+	}
+	else if (errno != EPERM)
+	{
+		throw operation->error("wait for");
+	}
+	int fd = operation->fd;
+	operations_[fd] = std::move(operation);
+}
+
+EventLoop::Progress EventLoop::step(Operation &operation, std::vector<Value> &arguments)
+{
+	switch (operation.kind)
+	{
+	case Operation::READ_FILE:
+	case Operation::READ_PIPE:
+		{
+			ssize_t count = ::read(operation.fd, buffer_.data(), buffer_.size());
+			if (count < 0)
+			{
+				if (wouldBlock())
+				{
+					return PENDING;
+				}
+				throw operation.error("read");
+			}
+			if (operation.kind == Operation::READ_PIPE)
+			{
+				arguments.push_back(count == 0 ? Value::nil() : Value::string(std::string(buffer_.data(), count)));
+				return count == 0 ? FINISHED : PROGRESSED;
+			}
+			if (count > 0)
+			{
+				operation.data.append(buffer_.data(), count);
+				return PENDING;
+			}
+			arguments.push_back(Value::string(operation.data));
+			return FINISHED;
+		}
+	case Operation::WRITE_FILE:
+		{
+			std::size_t remaining = std::min(operation.data.size() - operation.written, CHUNK_SIZE);
+			ssize_t count = ::write(operation.fd, operation.data.data() + operation.written, remaining);
+			if (count < 0)
+			{
+				if (wouldBlock())
+				{
+					return PENDING;
+				}
+				throw operation.error("write");
+			}
+			operation.written += count;
+			if (operation.written < operation.data.size())
+			{
+				return PENDING;
+			}
+			arguments.push_back(Value::number(operation.written));
+			return FINISHED;
+		}
+	case Operation::TIMER:
+		{
+			std::uint64_t expirations;
+			if (::read(operation.fd, &expirations, sizeof(expirations)) < 0)
+			{
+				if (wouldBlock())
+				{
+					return PENDING;
+				}
+				throw operation.error("read timer");
+			}
+			return FINISHED;
+		}
+	}
+	return PENDING;
+}
+
+std::size_t EventLoop::run()
+{
+	std::size_t callbacks = 0;
+	std::vector<int> ready;
+	epoll_event events[MAX_EVENTS];
+	while (!operations_.empty())
+	{
+		ready.clear();
+		for (const auto &entry : operations_)
+		{
+			if (!entry.second->polled)
+			{
+				ready.push_back(entry.first);
+			}
+		}
+		// Only sleeping when no regular file can make progress
+		int count = ::epoll_wait(epoll_, events, MAX_EVENTS, ready.empty() ? -1 : 0);
+		if (count < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			throw ExternalFunctionError("epoll_wait", CURRENT_SOURCE_LOCATION, std::string("Cannot wait for events: ") + std::strerror(errno));
+		}
+		for (int i = 0 ; i < count ; ++i)
+		{
+			ready.push_back(events[i].data.fd);
+		}
+
+		for (int fd : ready)
+		{
+			// A callback may have finished it, or reused its descriptor, which
+			// is harmless as nothing blocks
+			std::map<int, std::unique_ptr<Operation>>::iterator it = operations_.find(fd);
+			if (it == operations_.end())
+			{
+				continue;
+			}
+			Arguments arguments;
+			Progress progress = step(*it->second, arguments);
+			if (progress == PENDING)
+			{
+				continue;
+			}
+			Value callback;
+			if (progress == FINISHED)
+			{
+				swap(callback, it->second->callback);
+				operations_.erase(it);
+			}
+			else
+			{
+				callback = it->second->callback;
+			}
+			interpreter_.call(callback, arguments);
+			++callbacks;
+		}
+	}
+	return callbacks;
+}
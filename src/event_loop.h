@@ -0,0 +1,64 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "value.h"
+
+class Interpreter;
+
+// Non-blocking I/O for one interpreter, completing into callbacks that run on
+// its thread while run() waits. Pipes and timers are waited for with epoll.
+// Regular files are always ready, which epoll refuses, so they are read and
+// written a chunk at a time between waits, interleaved with everything else.
+class EventLoop
+{
+public:
+	explicit EventLoop(Interpreter &interpreter);
+	~EventLoop();
+
+	// Calls callback with the file's contents
+	void readFile(const std::string &path, const Value &callback);
+
+	// Replaces the file's contents, calling callback with the bytes written
+	void writeFile(const std::string &path, const std::string &contents, const Value &callback);
+
+	// Calls callback with each chunk read from a pipe, FIFO or device, then
+	// with nil once its writers have closed it
+	void readPipe(const std::string &path, const Value &callback);
+
+	// Calls callback, without arguments, once the time has passed
+	void startTimer(int milliseconds, const Value &callback);
+
+	// Until nothing is pending, including anything the callbacks start.
+	// Returns the number of callbacks run.
+	std::size_t run();
+
+private:
+	// Deliberately private & unimplemented
+	EventLoop(const EventLoop &);
+	EventLoop &operator=(const EventLoop &);
+
+	struct Operation;
+
+	enum Progress
+	{
+		PENDING,
+		PROGRESSED,
+		FINISHED,
+	};
+
+	void add(std::unique_ptr<Operation> operation);
+	// Fills in the callback's arguments unless still pending
+	Progress step(Operation &operation, std::vector<Value> &arguments);
+
+	Interpreter &interpreter_;
+	int epoll_;
+	std::map<int, std::unique_ptr<Operation>> operations_;
+	std::vector<char> buffer_;
+};
+
+#endif
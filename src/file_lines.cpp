@@ -0,0 +1,107 @@
+#include "file_lines.h"
+
+#include <map>
+#include <mutex>
+#include <cstring>
+
+namespace
+{
+	std::mutex mutex;
+	std::map<int, std::shared_ptr<const MappedFile>> files;
+	int lastId = 0;
+}
+
+int openMappedFile(const std::string &path)
+{
+	std::shared_ptr<MappedFile> file = std::make_shared<MappedFile>(path);
+	if (!file->isOpen())
+	{
+		return 0;
+	}
+	file->adviseSequential();
+	std::lock_guard<std::mutex> lock(mutex);
+	int id = ++lastId;
+	files[id] = file;
+	return id;
+}
+
+std::shared_ptr<const MappedFile> findMappedFile(int id)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	std::map<int, std::shared_ptr<const MappedFile>>::const_iterator it = files.find(id);
+	return it == files.end() ? std::shared_ptr<const MappedFile>() : it->second;
+}
+
+bool closeMappedFile(int id)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return files.erase(id) > 0;
+}
+
+LineIterator::State::State(const std::shared_ptr<const MappedFile> &file)
+:
+	file(file),
+	position(0)
+{
+}
+
+LineIterator::LineIterator(const std::string &path, const std::shared_ptr<const MappedFile> &file)
+:
+	name_("lines of " + path),
+	sourceLocation_(path, 1),
+	state_(std::make_shared<State>(file))
+{
+}
+
+LineIterator::LineIterator(const std::string &name, const SourceLocation &sourceLocation, const std::shared_ptr<State> &state)
+:
+	name_(name),
+	sourceLocation_(sourceLocation),
+	state_(state)
+{
+}
+
+LineIterator *LineIterator::clone() const
+{
+	return new LineIterator(name_, sourceLocation_, state_);
+}
+
+Value LineIterator::next(Interpreter &) const
+{
+	const char *begin = state_->file->begin();
+	std::size_t size = state_->file->size();
+	std::size_t position = state_->position.load(std::memory_order_relaxed);
+	while (position < size)
+	{
+		const char *start = begin + position;
+		const char *newline = static_cast<const char *>(std::memchr(start, '\n', size - position));
+		std::size_t end = newline ? newline - begin : size;
+		std::size_t following = newline ? end + 1 : size;
+		// The mapping is read only, so claiming the line is all that must be atomic
+		if (state_->position.compare_exchange_weak(position, following, std::memory_order_relaxed))
+		{
+			return Value::string(start, end - position);
+		}
+	}
+	return Value::nil();
+}
+
+bool LineIterator::threadSafe() const
+{
+	return true;
+}
+
+Value LineIterator::detached() const
+{
+	return Value::function(*this);
+}
+
+const std::string &LineIterator::name() const
+{
+	return name_;
+}
+
+const SourceLocation &LineIterator::sourceLocation() const
+{
+	return sourceLocation_;
+}
@@ -0,0 +1,56 @@
+#ifndef FILE_LINES_H
+#define FILE_LINES_H
+
+#include <atomic>
+#include <memory>
+#include <string>
+
+#include "iterator.h"
+#include "mapped_file.h"
+
+// Maps the file for reading, returning an id which is the same in every
+// isolate. 0 if the file cannot be mapped.
+int openMappedFile(const std::string &path);
+
+// Null if there is no such file, or it has been closed
+std::shared_ptr<const MappedFile> findMappedFile(int id);
+
+// False if there is no such file. Lines already being read keep the mapping
+// until they are finished with.
+bool closeMappedFile(int id);
+
+// The lines of a mapped file for next, without their newlines. Each line is
+// found with memchr and copied straight from the mapping. Copies share the
+// position, in whichever isolate, so each line is handed out once.
+class LineIterator : public Iterator
+{
+public:
+	LineIterator(const std::string &path, const std::shared_ptr<const MappedFile> &file);
+
+	virtual LineIterator *clone() const;
+	virtual Value next(Interpreter &) const;
+	// Claiming a line is atomic
+	virtual bool threadSafe() const;
+	// A copy, as this is thread safe
+	virtual Value detached() const;
+	virtual	const std::string &name() const;
+	virtual	const SourceLocation &sourceLocation() const;
+
+private:
+	struct State
+	{
+		explicit State(const std::shared_ptr<const MappedFile> &file);
+
+		std::shared_ptr<const MappedFile> file;
+		std::atomic<std::size_t> position;
+	};
+
+	LineIterator(const std::string &name, const SourceLocation &sourceLocation, const std::shared_ptr<State> &state);
+
+	std::string name_;
+	// The file itself
+	SourceLocation sourceLocation_;
+	std::shared_ptr<State> state_;
+};
+
+#endif
@@ -0,0 +1,60 @@
+#include "generator.h"
+
+#include "internal_function.h"
+#include "execution_error.h"
+
+GeneratorFrame::GeneratorFrame(const InternalFunction &function, Bindings::Mapping *globals, const Bindings::Mapping &closedValues)
+:
+	function(function.clone()),
+	state(SUSPENDED),
+	next(0),
+	closedValues(closedValues),
+	bindings(globals, &this->closedValues)
+{
+}
+
+Generator::Generator(const std::shared_ptr<GeneratorFrame> &frame)
+:
+	name_(frame->function->name()),
+	sourceLocation_(frame->function->sourceLocation()),
+	frame_(frame)
+{
+}
+
+Generator::Generator(const std::string &name, const SourceLocation &sourceLocation)
+:
+	name_(name),
+	sourceLocation_(sourceLocation)
+{
+}
+
+Generator *Generator::clone() const
+{
+	Generator *result = new Generator(name_, sourceLocation_);
+	result->frame_ = frame_;
+	return result;
+}
+
+Value Generator::next(Interpreter &interpreter) const
+{
+	if (!frame_)
+	{
+		throw ExecutionError(sourceLocation_, "Generator '" + name_ + "' belongs to another isolate");
+	}
+	return interpreter.resume(*frame_);
+}
+
+const std::string &Generator::name() const
+{
+	return name_;
+}
+
+const SourceLocation &Generator::sourceLocation() const
+{
+	return sourceLocation_;
+}
+
+Value Generator::detached() const
+{
+	return Value::function(Generator(name_, sourceLocation_));
+}
@@ -0,0 +1,65 @@
+#ifndef GENERATOR_H
+#define GENERATOR_H
+
+#include <memory>
+
+#include "bindings.h"
+#include "iterator.h"
+#include "interpreter.h"
+
+class InternalFunction;
+
+// A call to a function that yields, suspended on the heap rather than on
+// the interpreter's stack, between one yield and the next
+struct GeneratorFrame
+{
+	enum State
+	{
+		SUSPENDED,
+		RUNNING,
+		FINISHED,
+	};
+
+	GeneratorFrame(const InternalFunction &function, Bindings::Mapping *globals, const Bindings::Mapping &closedValues);
+
+	// Kept for its instructions
+	std::unique_ptr<Function> function;
+	State state;
+	std::size_t next;
+	Interpreter::Stack stack;
+	Interpreter::ClosureValues closureValues;
+	Interpreter::Loops loops;
+	Bindings::Mapping closedValues;
+	Bindings bindings;
+
+private:
+	// Deliberately private & unimplemented
+	GeneratorFrame(const GeneratorFrame &);
+	GeneratorFrame &operator=(const GeneratorFrame &);
+};
+
+// The value of calling a function that yields, resumed by next. Copies share
+// the frame, so advance together.
+class Generator : public Iterator
+{
+public:
+	explicit Generator(const std::shared_ptr<GeneratorFrame> &frame);
+
+	virtual Generator *clone() const;
+	virtual Value next(Interpreter &interpreter) const;
+	virtual	const std::string &name() const;
+	virtual	const SourceLocation &sourceLocation() const;
+
+	// The frame is run by one interpreter, on one thread
+	virtual Value detached() const;
+
+private:
+	Generator(const std::string &name, const SourceLocation &sourceLocation);
+
+	std::string name_;
+	SourceLocation sourceLocation_;
+	// Null once detached
+	std::shared_ptr<GeneratorFrame> frame_;
+};
+
+#endif
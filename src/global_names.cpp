@@ -0,0 +1,113 @@
+#include "global_names.h"
+
+#include "bytecode.h"
+#include "identifier.h"
+#include "interpreter.h"
+#include "internal_function.h"
+
+namespace
+{
+	typedef std::set<std::string> Names;
+
+	void collect(const InstructionList &instructions, Names &referenced, Names &declared)
+	{
+		for (const Instruction &instruction : instructions)
+		{
+			switch(instruction.type())
+			{
+			case Instruction::REF_GLOBAL:
+			case Instruction::ASSIGN_GLOBAL:
+				referenced.insert(instruction.value().string());
+				break;
+			case Instruction::INIT_LOCAL:
+			case Instruction::INIT_GLOBAL:
+				declared.insert(instruction.value().string());
+				break;
+			case Instruction::PUSH:
+				if (instruction.value().isFunction())
+				{
+					const InternalFunction *function = dynamic_cast<const InternalFunction *>(&instruction.value().function());
+					if (function)
+					{
+						collect(function->instructions(), referenced, declared);
+					}
+				}
+				break;
+			default:
+				break;
+			}
+		}
+	}
+
+	void writeNames(BytecodeWriter &writer, const Names &names)
+	{
+		writer.writeUnsigned(names.size());
+		for (const std::string &name : names)
+		{
+			writer.writeString(name);
+		}
+	}
+
+	Names readNames(BytecodeReader &reader)
+	{
+		Names result;
+		unsigned long long count = reader.readUnsigned();
+		for (unsigned long long i = 0 ; i < count ; ++i)
+		{
+			std::string name = reader.readString();
+			if (!Identifier::isValid(name))
+			{
+				throw BytecodeError("Invalid identifier '" + name + "'");
+			}
+			result.insert(name);
+		}
+		return result;
+	}
+
+	bool allDefined(const Names &names, const Interpreter &interpreter, bool expectDefined)
+	{
+		for (const std::string &name : names)
+		{
+			bool defined = interpreter.global(Identifier(name)) != nullptr;
+			if (defined != expectDefined)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+}
+
+GlobalNames::GlobalNames()
+{
+}
+
+GlobalNames::GlobalNames(const InstructionList &instructions)
+{
+	collect(instructions, referenced_, declared_);
+	for (const std::string &name : declared_)
+	{
+		referenced_.erase(name);
+	}
+}
+
+bool GlobalNames::consistentWith(const Interpreter &interpreter) const
+{
+	// The parser would have rejected the source if any required global was
+	// missing, or if any declared name was already taken by a global
+	return allDefined(referenced_, interpreter, true) && allDefined(declared_, interpreter, false);
+}
+
+void GlobalNames::write(BytecodeWriter &writer) const
+{
+	writeNames(writer, referenced_);
+	writeNames(writer, declared_);
+}
+
+void GlobalNames::read(BytecodeReader &reader)
+{
+	Names referenced = readNames(reader);
+	Names declared = readNames(reader);
+	referenced_.swap(referenced);
+	declared_.swap(declared);
+}
@@ -0,0 +1,37 @@
+#ifndef GLOBAL_NAMES_H
+#define GLOBAL_NAMES_H
+
+#include <set>
+#include <string>
+
+#include "instruction.h"
+
+class Interpreter;
+class BytecodeReader;
+class BytecodeWriter;
+
+// The names compiled instructions resolved against the global scope, and
+// the names they declared. Parsing the same source again gives the same
+// instructions as long as every referenced name is still defined and no
+// declared name has been defined since.
+class GlobalNames
+{
+public:
+	GlobalNames();
+
+	explicit GlobalNames(const InstructionList &instructions);
+
+	bool consistentWith(const Interpreter &interpreter) const;
+
+	void write(BytecodeWriter &writer) const;
+
+	void read(BytecodeReader &reader);
+
+private:
+	typedef std::set<std::string> Names;
+
+	Names referenced_;
+	Names declared_;
+};
+
+#endif
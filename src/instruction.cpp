@@ -87,6 +87,12 @@ Instruction Instruction::memberAccess(const SourceLocation &sourceLocation, cons
 	return Instruction(sourceLocation, MEMBER_ACCESS, Value::string(identifier.name()));
 }
 
+Instruction Instruction::yield(const SourceLocation &sourceLocation)
+{
+	// The operand is unused
+	return Instruction(sourceLocation, YIELD, Value::number(0));
+}
+
 Instruction::Type Instruction::type() const
 {
 	return type_;
@@ -102,6 +108,31 @@ const SourceLocation &Instruction::sourceLocation() const
 	return sourceLocation_;
 }
 
+const char *Instruction::typeName(Type type)
+{
+	switch(type)
+	{
+	case PUSH: return "push";
+	case CALL: return "call";
+	case JUMP: return "jump";
+	case LOOP: return "loop";
+	case CLOSE: return "close";
+	case COND_JUMP: return "cond_jump";
+	case REF_LOCAL: return "ref_local";
+	case INIT_LOCAL: return "init_local";
+	case ASSIGN_LOCAL: return "assign_local";
+	case REF_GLOBAL: return "ref_global";
+	case INIT_GLOBAL: return "init_global";
+	case ASSIGN_GLOBAL: return "assign_global";
+	case REF_CLOSURE: return "ref_closure";
+	case INIT_CLOSURE: return "init_closure";
+	case ASSIGN_CLOSURE: return "assign_closure";
+	case MEMBER_ACCESS: return "member";
+	case YIELD: return "yield";
+	}
+	throw CompilerBug("unhandled instruction type: " + str(static_cast<int>(type)));
+}
+
 std::ostream &operator<<(std::ostream &out, const Instruction &instruction)
 {
 	switch(instruction.type_)
@@ -138,6 +169,8 @@ std::ostream &operator<<(std::ostream &out, const Instruction &instruction)
 		return out << "assign_closure(" << instruction.value_.string() << ")";
 	case Instruction::MEMBER_ACCESS:
 		return out << "member(" << instruction.value_.string() << ")";
+	case Instruction::YIELD:
+		return out << "yield";
 	default:
 		throw CompilerBug("unhandled instruction type: " + str(instruction.type_));
 	}
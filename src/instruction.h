@@ -31,8 +31,15 @@ public:
 		INIT_CLOSURE,
 		ASSIGN_CLOSURE,
 		MEMBER_ACCESS,
+		YIELD,
 	};
 
+	// One more than the last Type, for tables indexed by type
+	static const int TYPE_COUNT = YIELD + 1;
+
+	// As printed in instruction listings, e.g. "ref_local"
+	static const char *typeName(Type type);
+
 	static Instruction push(const SourceLocation &sourceLocation, const Value &value);
 
 	static Instruction call(const SourceLocation &sourceLocation, int argc);
@@ -65,6 +72,8 @@ public:
 
 	static Instruction memberAccess(const SourceLocation &sourceLocation, const Identifier &identifier);
 
+	static Instruction yield(const SourceLocation &sourceLocation);
+
 	Type type() const;
 
 	const Value &value() const;
@@ -74,6 +83,8 @@ public:
 	friend std::ostream &operator<<(std::ostream &out, const Instruction &);
 
 private:
+	friend class BytecodeReader;
+
 	Instruction(const SourceLocation &sourceLocation, Type type, const Value &value);
 
 	Type type_;
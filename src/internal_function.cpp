@@ -1,9 +1,25 @@
 #include "internal_function.h"
 #include "interpreter.h"
+#include "generator.h"
 #include "utils.h"
 #include "exceptions.h"
 #include "execution_error.h"
 
+namespace
+{
+	bool yields(const InstructionList &instructions)
+	{
+		for (const Instruction &instruction : instructions)
+		{
+			if (instruction.type() == Instruction::YIELD)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+}
+
 InternalFunction::InternalFunction(
 	const SourceLocation &sourceLocation,
 	const Identifier &name,
@@ -13,7 +29,22 @@ InternalFunction::InternalFunction(
 	sourceLocation_(sourceLocation),
 	name_(name),
 	parameters_(parameters),
-	instructionList_(instructionList)
+	instructionList_(std::make_shared<const InstructionList>(instructionList)),
+	generator_(yields(instructionList))
+{
+}
+
+InternalFunction::InternalFunction(
+	const SourceLocation &sourceLocation,
+	const Identifier &name,
+	const std::vector<Identifier> &parameters,
+	const std::shared_ptr<const InstructionList> &instructionList)
+:
+	sourceLocation_(sourceLocation),
+	name_(name),
+	parameters_(parameters),
+	instructionList_(instructionList),
+	generator_(yields(*instructionList))
 {
 }
 
@@ -29,6 +60,10 @@ Value InternalFunction::call(CallContext &callContext) const
 	{
 		throw ExecutionError(sourceLocation_, "Function '" + name_.name() + "' passed " + str(arguments.size()) + " arguments but expected " + str(parameters_.size()));
 	}
+	if (generator_)
+	{
+		return startGenerator(callContext);
+	}
 	Bindings::Mapping closedValues = callContext.closedValues();
 	// TODO: guarantee lifecycle of "closedValues"?
 	Bindings localBindings(callContext.globals(), &closedValues);
@@ -36,7 +71,18 @@ Value InternalFunction::call(CallContext &callContext) const
 	{
 		localBindings.initLocal(parameters_[i], arguments[i]);
 	}
-	return callContext.interpreter()->exec(instructionList_, localBindings);
+	return callContext.interpreter()->exec(*instructionList_, localBindings);
+}
+
+Value InternalFunction::startGenerator(CallContext &callContext) const
+{
+	const Arguments &arguments = callContext.arguments();
+	std::shared_ptr<GeneratorFrame> frame = std::make_shared<GeneratorFrame>(*this, callContext.globals(), callContext.closedValues());
+	for (unsigned i = 0 ; i < parameters_.size() ; ++i)
+	{
+		frame->bindings.initLocal(parameters_[i], arguments[i]);
+	}
+	return Value::function(Generator(frame));
 }
 
 const std::string &InternalFunction::name() const
@@ -49,3 +95,18 @@ const SourceLocation &InternalFunction::sourceLocation() const
 	return sourceLocation_;
 }
 
+
+const std::vector<Identifier> &InternalFunction::parameters() const
+{
+	return parameters_;
+}
+
+const InstructionList &InternalFunction::instructions() const
+{
+	return *instructionList_;
+}
+
+bool InternalFunction::isGenerator() const
+{
+	return generator_;
+}
@@ -1,6 +1,8 @@
 #ifndef INTERNAL_FUNCTION
 #define INTERNAL_FUNCTION
 
+#include <memory>
+
 #include "function.h"
 #include "instruction.h"
 
@@ -18,11 +20,28 @@ public:
 	virtual	const std::string &name() const;
 	virtual	const SourceLocation &sourceLocation() const;
 
+	const std::vector<Identifier> &parameters() const;
+	const InstructionList &instructions() const;
+
+	// Whether it yields, so a call returns a generator rather than running it
+	bool isGenerator() const;
+
 private:
+	InternalFunction(
+		const SourceLocation &sourceLocation,
+		const Identifier &name,
+		const std::vector<Identifier> &parameters,
+		const std::shared_ptr<const InstructionList> &instructionList);
+
+	// Kept out of call(), whose frame is on the stack of every call
+	Value startGenerator(CallContext &callContext) const;
+
 	SourceLocation sourceLocation_;
 	Identifier name_;
 	std::vector<Identifier> parameters_;
-	InstructionList instructionList_;
+	// Immutable, so shared by the clones, including those in other isolates
+	std::shared_ptr<const InstructionList> instructionList_;
+	bool generator_;
 };
 
 #endif
@@ -6,6 +6,14 @@
 #include "bug.h"
 #include "execution_error.h"
 #include "closure.h"
+#include "generator.h"
+#include "event_loop.h"
+#include "profiler.h"
+#include "sampling_profiler.h"
+#include "allocation_profiler.h"
+#include "trace_buffer.h"
+#include "trace_events.h"
+#include "internal_function.h"
 
 namespace
 {
@@ -70,8 +78,8 @@ namespace
 		return argc;
 	}
 
-	typedef std::pair<Identifier, Bindings::ValuePtr> ClosedNameAndValue;
-	typedef std::vector<ClosedNameAndValue> ClosureValues;
+	typedef Interpreter::ClosedNameAndValue ClosedNameAndValue;
+	typedef Interpreter::ClosureValues ClosureValues;
 
 	Value handleClose(const Value &value, Stack &stack, ClosureValues &closureValues, Bindings &bindings)
 	{
@@ -99,6 +107,78 @@ namespace
 		return Value::function(closure);
 	}
 
+	// Counts the calls in progress, for telling calls from the top level apart
+	class CallDepth
+	{
+	public:
+		explicit CallDepth(unsigned &depth)
+		:
+			depth_(depth)
+		{
+			++depth_;
+		}
+
+		~CallDepth()
+		{
+			--depth_;
+		}
+
+	private:
+		// Deliberately private & unimplemented
+		CallDepth(const CallDepth &);
+		CallDepth &operator=(const CallDepth &);
+
+		unsigned &depth_;
+	};
+
+	bool isDefun(const Function &function)
+	{
+		return dynamic_cast<const InternalFunction *>(&function) || dynamic_cast<const Closure *>(&function);
+	}
+
+	// A while loop's conditional jump lands on its loop back, which returns
+	// to before the jump. Only the last iteration's values are kept, so the
+	// loop's value is unchanged but the stack does not grow with each one.
+	void handleWhileCondition(const InstructionList &instructions, std::size_t index, int instructionsToSkip, bool jump, Stack &stack, Interpreter::Loops &loops)
+	{
+		const Instruction &landing = instructions[index + instructionsToSkip];
+		if(landing.type() != Instruction::LOOP || landing.value().number() <= instructionsToSkip)
+		{
+			return;
+		}
+		bool entered = !loops.empty() && loops.back().first == index;
+		if(jump)
+		{
+			if(entered)
+			{
+				loops.pop_back();
+			}
+		}
+		else if(entered)
+		{
+			stack.resize(loops.back().second);
+		}
+		else
+		{
+			loops.push_back(std::make_pair(index, stack.size()));
+		}
+	}
+
+	// Suspends the generator, to resume at next
+	Value handleYield(std::size_t next, Stack &stack, GeneratorFrame *generator)
+	{
+		if(!generator)
+		{
+			throw CompilerBug("yield outside of a generator");
+		}
+		Value yielded = pop(stack);
+		// What the yield evaluates to, once resumed
+		stack.push_back(Value::nil());
+		generator->next = next;
+		generator->state = GeneratorFrame::SUSPENDED;
+		return yielded;
+	}
+
 	int getInstructionsToSkip(Instruction::Type type, const Value &value)
 	{
 		int instructionCount = value.number();
@@ -113,23 +193,98 @@ namespace
 Interpreter::Interpreter(const Globals &globals, const Settings &settings)
 :
 	globals_(globals),
-	settings_(settings)
+	settings_(settings),
+	instructionsExecuted_(0),
+	profiler_(nullptr),
+	sampler_(nullptr),
+	allocationProfiler_(nullptr),
+	traceBuffer_(nullptr),
+	callDepth_(0),
+	random_(1),
+	output_(settings.outputFd)
+{
+}
+
+Interpreter::~Interpreter()
 {
 }
 
 Value Interpreter::exec(const InstructionList &instructions)
 {
 	Bindings bindings(&globals_);
-	return exec(instructions, bindings);
+	try
+	{
+		return exec(instructions, bindings);
+	}
+	catch (...)
+	{
+		// Before the error is reported
+		output_.flush();
+		if (traceBuffer_)
+		{
+			traceBuffer_->dump();
+		}
+		throw;
+	}
 }
 
-Value Interpreter::exec(const InstructionList &instructions, Bindings &bindings)
+
+Value Interpreter::resume(GeneratorFrame &frame)
 {
-	Stack stack;
-	ClosureValues closureValues;
+	const Function &function = *frame.function;
+	if(frame.state == GeneratorFrame::FINISHED)
+	{
+		return Value::nil();
+	}
+	if(frame.state == GeneratorFrame::RUNNING)
+	{
+		throw ExecutionError(function.sourceLocation(), "Generator '" + function.name() + "' resumed while it is running");
+	}
+	frame.state = GeneratorFrame::RUNNING;
+	try
+	{
+		const InstructionList &instructions = static_cast<const InternalFunction &>(function).instructions();
+		Value result = exec(instructions, frame.bindings, &frame);
+		if(frame.state == GeneratorFrame::SUSPENDED)
+		{
+			return result;
+		}
+	}
+	catch (RaspError &error)
+	{
+		frame.state = GeneratorFrame::FINISHED;
+		error.buildStackTrace(" at generator: " + function.name(), function.sourceLocation());
+		throw;
+	}
+	// Its return value is not yielded
+	frame.state = GeneratorFrame::FINISHED;
+	frame.stack.clear();
+	frame.closureValues.clear();
+	frame.loops.clear();
+	return Value::nil();
+}
 
-	for(InstructionList::const_iterator it = instructions.begin() ; it != instructions.end() ; ++it)
+Value Interpreter::exec(const InstructionList &instructions, Bindings &bindings, GeneratorFrame *generator)
+{
+	// Not a separate function, as this frame is on the stack of every call
+	Stack localStack;
+	ClosureValues localClosureValues;
+	Loops localLoops;
+	Stack &stack = generator ? generator->stack : localStack;
+	ClosureValues &closureValues = generator ? generator->closureValues : localClosureValues;
+	Loops &loops = generator ? generator->loops : localLoops;
+
+	for(InstructionList::const_iterator it = instructions.begin() + (generator ? generator->next : 0) ; it != instructions.end() ; ++it)
 	{
+		++instructionsExecuted_;
+		if(profiler_)
+		{
+			profiler_->enter(*it);
+		}
+		if(traceBuffer_)
+		{
+			traceBuffer_->record(*it, it - instructions.begin(), stack.size());
+		}
 		Instruction::Type type = it->type();
 		const Value &value = it->value();
 		switch(type)
@@ -137,7 +292,7 @@ Value Interpreter::exec(const InstructionList &instructions, Bindings &bindings)
 		case Instruction::PUSH:
 			if(settings_.trace)
 			{				
-				std::cout << "DEBUG: " << it->sourceLocation() << " push " << value << '\n';
+				output_.stream() << "DEBUG: " << it->sourceLocation() << " push " << value << '\n';
 			}
 			stack.push_back(value);
 			break;
@@ -145,13 +300,13 @@ Value Interpreter::exec(const InstructionList &instructions, Bindings &bindings)
 			{
 				if(settings_.trace)
 				{
-					std::cout << "DEBUG: " << it->sourceLocation() << " call " << value << '\n';
+					output_.stream() << "DEBUG: " << it->sourceLocation() << " call " << value << '\n';
 				}
 				Value result = handleFunction(it->sourceLocation(), value, stack, bindings);
 				stack.push_back(result);
 				if(settings_.trace)
 				{
-					std::cout << "DEBUG: " << it->sourceLocation() << " return value " << result << '\n';
+					output_.stream() << "DEBUG: " << it->sourceLocation() << " return value " << result << '\n';
 				}
 			}
 			break;
@@ -166,7 +321,7 @@ Value Interpreter::exec(const InstructionList &instructions, Bindings &bindings)
 
 				if(settings_.trace)
 				{
-					std::cout << "DEBUG: " << it->sourceLocation() << " jumping back " << instructionsToSkip << '\n';
+					output_.stream() << "DEBUG: " << it->sourceLocation() << " jumping back " << instructionsToSkip << '\n';
 				}
 				it += instructionsToSkip;
 			}
@@ -182,7 +337,7 @@ Value Interpreter::exec(const InstructionList &instructions, Bindings &bindings)
 
 				if(settings_.trace)
 				{				
-					std::cout << "DEBUG: " << it->sourceLocation() << " looping back " << instructionsToSkip << " instructions\n";
+					output_.stream() << "DEBUG: " << it->sourceLocation() << " looping back " << instructionsToSkip << " instructions\n";
 				}
 				it -= instructionsToSkip;
 			}
@@ -191,7 +346,7 @@ Value Interpreter::exec(const InstructionList &instructions, Bindings &bindings)
 			{
 				if(settings_.trace)
 				{
-					std::cout << "DEBUG: " << it->sourceLocation() << " close " << value << '\n';
+					output_.stream() << "DEBUG: " << it->sourceLocation() << " close " << value << '\n';
 				}
 				Value result = handleClose(value, stack, closureValues, bindings);
 				stack.push_back(result);
@@ -213,10 +368,12 @@ Value Interpreter::exec(const InstructionList &instructions, Bindings &bindings)
 				Value top = pop(stack);
 				if(settings_.trace)
 				{				
-					std::cout << "DEBUG: " << it->sourceLocation() << " jumping back " << instructionsToSkip << " if " << top << '\n';
+					output_.stream() << "DEBUG: " << it->sourceLocation() << " jumping back " << instructionsToSkip << " if " << top << '\n';
 				}
 
-				if(top.isFalsey())
+				bool jump = top.isFalsey();
+				handleWhileCondition(instructions, it - instructions.begin(), instructionsToSkip, jump, stack, loops);
+				if(jump)
 				{
 					it += instructionsToSkip;
 				}
@@ -226,7 +383,7 @@ Value Interpreter::exec(const InstructionList &instructions, Bindings &bindings)
 			handleRef(Bindings::Local, value, stack, bindings);
 			if(settings_.trace)
 			{
-				std::cout << "DEBUG: " << it->sourceLocation() << " local ref '" << value.string() << "' is " << stack.back() << '\n';
+				output_.stream() << "DEBUG: " << it->sourceLocation() << " local ref '" << value.string() << "' is " << stack.back() << '\n';
 			}
 			break;
 		case Instruction::INIT_LOCAL:
@@ -234,7 +391,7 @@ Value Interpreter::exec(const InstructionList &instructions, Bindings &bindings)
 				const Value &intialisedValue = handleInit(Bindings::Local, value, stack, bindings);
 				if(settings_.trace)
 				{
-					std::cout << "DEBUG: " << it->sourceLocation() << " local init '" << value.string() << "' to " << intialisedValue << '\n';
+					output_.stream() << "DEBUG: " << it->sourceLocation() << " local init '" << value.string() << "' to " << intialisedValue << '\n';
 				}
 			}
 			break;
@@ -243,7 +400,7 @@ Value Interpreter::exec(const InstructionList &instructions, Bindings &bindings)
 				const Value &assignedValue = handleAssign(Bindings::Local, value, stack, bindings);
 				if(settings_.trace)
 				{
-					std::cout << "DEBUG: " << it->sourceLocation() << " local assign '" << value.string() << "' to " << assignedValue << '\n';
+					output_.stream() << "DEBUG: " << it->sourceLocation() << " local assign '" << value.string() << "' to " << assignedValue << '\n';
 				}
 			}
 			break;
@@ -251,7 +408,7 @@ Value Interpreter::exec(const InstructionList &instructions, Bindings &bindings)
 			handleRef(Bindings::Global, value, stack, bindings);
 			if(settings_.trace)
 			{
-				std::cout << "DEBUG: " << it->sourceLocation() << " global ref '" << value.string() << "' is " << stack.back() << '\n';
+				output_.stream() << "DEBUG: " << it->sourceLocation() << " global ref '" << value.string() << "' is " << stack.back() << '\n';
 			}
 			break;
 		case Instruction::INIT_GLOBAL:
@@ -259,7 +416,7 @@ Value Interpreter::exec(const InstructionList &instructions, Bindings &bindings)
 				const Value &intialisedValue = handleInit(Bindings::Global, value, stack, bindings);
 				if(settings_.trace)
 				{
-					std::cout << "DEBUG: " << it->sourceLocation() << " global init '" << value.string() << "' to " << intialisedValue << '\n';
+					output_.stream() << "DEBUG: " << it->sourceLocation() << " global init '" << value.string() << "' to " << intialisedValue << '\n';
 				}
 			}
 			break;
@@ -268,7 +425,7 @@ Value Interpreter::exec(const InstructionList &instructions, Bindings &bindings)
 				const Value &assignedValue = handleAssign(Bindings::Global, value, stack, bindings);
 				if(settings_.trace)
 				{
-					std::cout << "DEBUG: " << it->sourceLocation() << " global assign '" << value.string() << "' to " << assignedValue << '\n';
+					output_.stream() << "DEBUG: " << it->sourceLocation() << " global assign '" << value.string() << "' to " << assignedValue << '\n';
 				}
 			}
 			break;
@@ -276,7 +433,7 @@ Value Interpreter::exec(const InstructionList &instructions, Bindings &bindings)
 			handleRef(Bindings::Closure, value, stack, bindings);
 			if(settings_.trace)
 			{
-				std::cout << "DEBUG: " << it->sourceLocation() << " closure ref '" << value.string() << "' is " << stack.back() << '\n';
+				output_.stream() << "DEBUG: " << it->sourceLocation() << " closure ref '" << value.string() << "' is " << stack.back() << '\n';
 			}
 			break;
 		case Instruction::INIT_CLOSURE:
@@ -286,7 +443,7 @@ Value Interpreter::exec(const InstructionList &instructions, Bindings &bindings)
 				closureValues.push_back(ClosedNameAndValue(identifier, binding));
 				if(settings_.trace)
 				{
-					std::cout << "DEBUG: " << it->sourceLocation() << " closure init '" << value.string() << "' is " << *binding << '\n';
+					output_.stream() << "DEBUG: " << it->sourceLocation() << " closure init '" << value.string() << "' is " << *binding << '\n';
 				}
 			}
 			break;
@@ -295,7 +452,7 @@ Value Interpreter::exec(const InstructionList &instructions, Bindings &bindings)
 				const Value &assignedValue = handleAssign(Bindings::Closure, value, stack, bindings);
 				if(settings_.trace)
 				{
-					std::cout << "DEBUG: " << it->sourceLocation() << " closure assign '" << value.string() << "' to " << assignedValue << '\n';
+					output_.stream() << "DEBUG: " << it->sourceLocation() << " closure assign '" << value.string() << "' to " << assignedValue << '\n';
 				}
 			}
 			break;
@@ -303,7 +460,7 @@ Value Interpreter::exec(const InstructionList &instructions, Bindings &bindings)
 			{
 				if(settings_.trace)
 				{
-					std::cout << "DEBUG: " << it->sourceLocation() << " member access " << value << '\n';
+					output_.stream() << "DEBUG: " << it->sourceLocation() << " member access " << value << '\n';
 				}
 				assert(value.isString());
 				const std::string &memberName = value.string();
@@ -321,11 +478,17 @@ Value Interpreter::exec(const InstructionList &instructions, Bindings &bindings)
 				}
 				if(settings_.trace)
 				{
-					std::cout << "DEBUG: " << it->sourceLocation() << " member access " << value.string() << "." << memberName << " was " << memberIterator->second << '\n';
+					output_.stream() << "DEBUG: " << it->sourceLocation() << " member access " << value.string() << "." << memberName << " was " << memberIterator->second << '\n';
 				}
 				stack.push_back(memberIterator->second);
 			}
 			break;
+		case Instruction::YIELD:
+			if(settings_.trace)
+			{
+				output_.stream() << "DEBUG: " << it->sourceLocation() << " yield " << stack.back() << '\n';
+			}
+			return handleYield(it + 1 - instructions.begin(), stack, generator);
 		default:
 			throw CompilerBug("unhandled instruction type: " + str(type));
 		}
@@ -334,31 +497,31 @@ Value Interpreter::exec(const InstructionList &instructions, Bindings &bindings)
 		{
 			if (stack.empty())
 			{
-				std::cout << "Stack is empty\n";
+				output_.stream() << "Stack is empty\n";
 			}
 			else
 			{
-				std::cout << "Stack contains " << stack.size() << " entries:\n";
+				output_.stream() << "Stack contains " << stack.size() << " entries:\n";
 				int index = 0;
 				for(Stack::const_iterator it = stack.begin() ; it != stack.end() ; ++it)
 				{
 					++index;
-					std::cout << index << ":  " << *it << '\n';
+					output_.stream() << index << ":  " << *it << '\n';
 				}
 			}
 
 			if (closureValues.empty())
 			{
-				std::cout << "closureValues is empty\n";
+				output_.stream() << "closureValues is empty\n";
 			}
 			else
 			{
-				std::cout << "closureValues contains " << closureValues.size() << " entries:\n";
+				output_.stream() << "closureValues contains " << closureValues.size() << " entries:\n";
 				int index = 0;
 				for(const ClosedNameAndValue &closedValue: closureValues)
 				{
 					++index;
-					std::cout << index << ":  " << closedValue.first << " -> " << *closedValue.second << " @ " << closedValue.second << '\n';
+					output_.stream() << index << ":  " << closedValue.first << " -> " << *closedValue.second << " @ " << closedValue.second << '\n';
 				}
 			}
 		}
@@ -367,6 +530,16 @@ Value Interpreter::exec(const InstructionList &instructions, Bindings &bindings)
 	return stack.empty() ? Value::nil() : pop(stack);
 }
 
+Value Interpreter::call(const Value &function, const Arguments &arguments)
+{
+	// Laid out as the instructions of a call leave it, the function on top
+	Stack stack(arguments.rbegin(), arguments.rend());
+	stack.push_back(function);
+	Bindings bindings(&globals_);
+	const SourceLocation &sourceLocation = function.isFunction() ? function.function().sourceLocation() : CURRENT_SOURCE_LOCATION;
+	return handleFunction(sourceLocation, Value::number(arguments.size()), stack, bindings);
+}
+
 Value Interpreter::handleFunction(const SourceLocation &sourceLocation, const Value &value, Stack &stack, Bindings &bindings)
 {
 	unsigned argc = getArgumentCount(value);
@@ -381,16 +554,24 @@ Value Interpreter::handleFunction(const SourceLocation &sourceLocation, const Va
 		throw ExecutionError(sourceLocation, "Call instruction expects top of the stack to be functional value, but got: " + str(top));
 	}
 
-	Arguments arguments;
-	while(argc --> 0)
+	// Handed over from the stack, rather than copied
+	CallContext callContext(&globals_, Arguments(argc), this);
+	Arguments &arguments = callContext.arguments();
+	for(unsigned i = 0 ; i < argc ; ++i)
 	{
-		arguments.push_back(pop(stack));
+		swap(arguments[i], stack.back());
+		stack.pop_back();
 	}
 
 	const Function &function = top.function();
+	SampledCall sampledCall(sampler_, function);
+	AllocationProfiledCall allocationProfiledCall(allocationProfiler_, function);
+	TracedCall tracedCall(traceBuffer_, function);
+	CallDepth callDepth(callDepth_);
+	bool topLevelDefun = callDepth_ == 1 && traceEventsEnabled() && isDefun(function);
+	TraceSpan span(topLevelDefun ? "exec" : nullptr, "call", function.name());
 	try
 	{
-		CallContext callContext(&globals_, arguments, this);
 		return function.call(callContext);
 	}
 	catch (RaspError &error)
@@ -416,3 +597,78 @@ const Value *Interpreter::global(const Identifier &name) const
 	return (i == globals_.end() ? nullptr : i->second.get());
 }
 
+const Interpreter::Globals &Interpreter::globals() const
+{
+	return globals_;
+}
+
+unsigned long long Interpreter::instructionsExecuted() const
+{
+	return instructionsExecuted_;
+}
+
+std::mt19937 &Interpreter::random()
+{
+	return random_;
+}
+
+EventLoop &Interpreter::eventLoop()
+{
+	if (!eventLoop_)
+	{
+		eventLoop_.reset(new EventLoop(*this));
+	}
+	return *eventLoop_;
+}
+
+std::size_t Interpreter::runEventLoop()
+{
+	if (!eventLoop_)
+	{
+		return 0;
+	}
+	try
+	{
+		return eventLoop_->run();
+	}
+	catch (...)
+	{
+		output_.flush();
+		throw;
+	}
+}
+
+OutputSink &Interpreter::output()
+{
+	return output_;
+}
+
+void Interpreter::isolatedFrom(const std::shared_ptr<const SharedGlobals> &globals)
+{
+	isolatedFrom_ = globals;
+}
+
+const std::shared_ptr<const SharedGlobals> &Interpreter::isolatedFrom() const
+{
+	return isolatedFrom_;
+}
+
+void Interpreter::profile(Profiler *profiler)
+{
+	profiler_ = profiler;
+}
+
+void Interpreter::sample(SamplingProfiler *profiler)
+{
+	sampler_ = profiler;
+}
+
+void Interpreter::profileAllocations(AllocationProfiler *profiler)
+{
+	allocationProfiler_ = profiler;
+}
+
+void Interpreter::traceBuffer(TraceBuffer *buffer)
+{
+	traceBuffer_ = buffer;
+}
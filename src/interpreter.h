@@ -1,34 +1,105 @@
 #ifndef INTERPRETER_H
 #define INTERPRETER_H
 
+#include <memory>
+#include <random>
+
 #include "settings.h"
 #include "function.h"
 #include "bindings.h"
 #include "instruction.h"
+#include "output_sink.h"
+
+class Profiler;
+class SamplingProfiler;
+class AllocationProfiler;
+class TraceBuffer;
+class EventLoop;
+class SharedGlobals;
+struct GeneratorFrame;
 
 class Interpreter
 {
 public:
 	typedef Bindings::Mapping Globals;
 	typedef std::vector<Value> Stack;
+	typedef std::pair<Identifier, Bindings::ValuePtr> ClosedNameAndValue;
+	typedef std::vector<ClosedNameAndValue> ClosureValues;
+	// The while loops being run, by the index of their conditional jump,
+	// with the stack's depth on entering their body
+	typedef std::vector<std::pair<std::size_t, std::size_t>> Loops;
 
 	Interpreter(const Globals &globals, const Settings &settings);
+	~Interpreter();
 
 	Value exec(const InstructionList &instructions);
 
-	Value exec(const InstructionList &instructions, Bindings &bindings);
+	// From where the generator left off, rather than the start, if given
+	Value exec(const InstructionList &instructions, Bindings &bindings, GeneratorFrame *generator = nullptr);
+
+	// Calls the function from outside of any instructions, e.g. to start an isolate
+	Value call(const Value &function, const Arguments &arguments);
+
+	// Runs the generator until it yields, returning the value yielded, or
+	// nil once it has finished
+	Value resume(GeneratorFrame &frame);
 
 	const Value *global(const Identifier &name) const;
 
+	const Globals &globals() const;
+
 	Declarations declarations() const;
 
 	const Settings &settings() const;
 
+	unsigned long long instructionsExecuted() const;
+
+	// For rand, one per interpreter so that isolates do not share one
+	std::mt19937 &random();
+
+	// For print and friends, flushed when an error escapes a top level exec()
+	OutputSink &output();
+
+	// For the I/O builtins, created on first use
+	EventLoop &eventLoop();
+
+	// Runs the callbacks of any I/O started until none is pending, e.g. once
+	// a file has run. Returns the number of callbacks run.
+	std::size_t runEventLoop();
+
+	// The globals an async task's interpreter was isolated from, shared by
+	// the tasks it starts. Null outside of tasks.
+	void isolatedFrom(const std::shared_ptr<const SharedGlobals> &globals);
+	const std::shared_ptr<const SharedGlobals> &isolatedFrom() const;
+
+	// Null to stop profiling, the profiler must outlive its use here
+	void profile(Profiler *profiler);
+
+	// Null to stop maintaining the profiler's shadow stack of calls
+	void sample(SamplingProfiler *profiler);
+
+	// Null to stop attributing allocations to the functions making them
+	void profileAllocations(AllocationProfiler *profiler);
+
+	// Null to stop recording instructions, the buffer is dumped whenever an
+	// error escapes a top level exec()
+	void traceBuffer(TraceBuffer *buffer);
+
 private:
 	Value handleFunction(const SourceLocation &sourceLocation, const Value &value, Stack &stack, Bindings &bindings);
 
 	Globals globals_;
 	Settings settings_;
+	unsigned long long instructionsExecuted_;
+	Profiler *profiler_;
+	SamplingProfiler *sampler_;
+	AllocationProfiler *allocationProfiler_;
+	TraceBuffer *traceBuffer_;
+	unsigned callDepth_;
+	std::mt19937 random_;
+	std::unique_ptr<EventLoop> eventLoop_;
+	OutputSink output_;
+	std::shared_ptr<const SharedGlobals> isolatedFrom_;
 };
 
 #endif
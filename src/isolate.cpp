@@ -0,0 +1,277 @@
+#include "isolate.h"
+
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <sstream>
+#include <iostream>
+
+#include "utils.h"
+#include "closure.h"
+#include "iterator.h"
+#include "compiler.h"
+#include "settings.h"
+#include "exceptions.h"
+#include "interpreter.h"
+#include "thread_pool.h"
+
+bool needsIsolatingCopy(const Value &value)
+{
+	switch (value.type())
+	{
+	case Value::TArray:
+		for (const Value &element : value.array())
+		{
+			if (needsIsolatingCopy(element))
+			{
+				return true;
+			}
+		}
+		return false;
+	case Value::TObject:
+		for (const auto &member : value.object())
+		{
+			if (needsIsolatingCopy(member.second))
+			{
+				return true;
+			}
+		}
+		return false;
+	case Value::TFunction:
+		{
+			const Function &function = value.function();
+			const Iterator *iterator = dynamic_cast<const Iterator *>(&function);
+			return dynamic_cast<const Closure *>(&function) != nullptr || (iterator && !iterator->threadSafe());
+		}
+	default:
+		return false;
+	}
+}
+
+Value IsolatingCopier::copy(const Value &value)
+{
+	switch (value.type())
+	{
+	case Value::TArray:
+		{
+			Value::Array array;
+			for (const Value &element : value.array())
+			{
+				array.push_back(copy(element));
+			}
+			return Value::array(array);
+		}
+	case Value::TObject:
+		{
+			Value::Object object;
+			for (const auto &member : value.object())
+			{
+				object[member.first] = copy(member.second);
+			}
+			return Value::object(object);
+		}
+	case Value::TFunction:
+		if (const Closure *closure = dynamic_cast<const Closure *>(&value.function()))
+		{
+			return Value::function(Closure(closure->innerFunction(), copy(closure->closedValues())));
+		}
+		if (const Iterator *iterator = dynamic_cast<const Iterator *>(&value.function()))
+		{
+			return iterator->threadSafe() ? value : iterator->detached();
+		}
+		return value;
+	default:
+		return value;
+	}
+}
+
+Bindings::Mapping IsolatingCopier::copy(const Bindings::Mapping &mapping)
+{
+	Bindings::Mapping result;
+	for (Bindings::const_iterator it = mapping.begin() ; it != mapping.end() ; ++it)
+	{
+		result[it->first] = copyCell(it->second);
+	}
+	return result;
+}
+
+Bindings::ValuePtr IsolatingCopier::copyCell(const Bindings::ValuePtr &cell)
+{
+	std::map<const Value *, Bindings::ValuePtr>::const_iterator it = cells_.find(cell.get());
+	if (it != cells_.end())
+	{
+		return it->second;
+	}
+	// Registered before copying the value, which may refer back to this cell
+	Bindings::ValuePtr result = makeValue(Value::nil());
+	cells_[cell.get()] = result;
+	*result = copy(*cell);
+	return result;
+}
+
+SharedGlobals::SharedGlobals(const Bindings::Mapping &globals)
+{
+	// One copier, so closures share cells in the copies as in the originals
+	Bindings::Mapping copies = IsolatingCopier().copy(globals);
+	for (Bindings::const_iterator it = copies.begin() ; it != copies.end() ; ++it)
+	{
+		Bindings::Mapping &mapping = needsIsolatingCopy(*it->second) ? copied_ : shared_;
+		mapping.insert(*it);
+	}
+}
+
+Bindings::Mapping SharedGlobals::isolate() const
+{
+	Bindings::Mapping result = shared_;
+	if (!copied_.empty())
+	{
+		Bindings::Mapping copies = IsolatingCopier().copy(copied_);
+		result.insert(copies.begin(), copies.end());
+	}
+	return result;
+}
+
+namespace
+{
+	struct Isolate
+	{
+		Isolate() : failed(false)
+		{
+		}
+
+		std::thread thread;
+		Value result;
+		bool failed;
+		std::string error;
+	};
+
+	std::mutex mutex;
+	std::map<int, std::unique_ptr<Isolate>> isolates;
+	int lastId = 0;
+
+	void run(Isolate *isolate, const Bindings::Mapping &globals, const Settings &settings, const Value &function, const Arguments &arguments)
+	{
+		try
+		{
+			Interpreter interpreter(globals, settings);
+			Value returned = interpreter.call(function, arguments);
+			interpreter.runEventLoop();
+			// Copied out while this thread still owns the cells
+			isolate->result = IsolatingCopier().copy(returned);
+		}
+		catch (const RaspError &e)
+		{
+			std::stringstream error;
+			error << e.what() << '\n';
+			printStackTrace(error, e);
+			isolate->failed = true;
+			isolate->error = error.str();
+			isolate->error.erase(isolate->error.find_last_not_of('\n') + 1);
+		}
+		catch (const std::exception &e)
+		{
+			isolate->failed = true;
+			isolate->error = std::string("Internal error: ") + e.what();
+		}
+	}
+
+	std::unique_ptr<Isolate> take(int id)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		std::map<int, std::unique_ptr<Isolate>>::iterator it = isolates.find(id);
+		if (it == isolates.end())
+		{
+			return std::unique_ptr<Isolate>();
+		}
+		std::unique_ptr<Isolate> isolate = std::move(it->second);
+		isolates.erase(it);
+		return isolate;
+	}
+}
+
+int spawnIsolate(const Bindings::Mapping &globals, const Settings &settings, const Value &function, const Arguments &arguments)
+{
+	// Copied on this thread, which owns the originals
+	IsolatingCopier copier;
+	Bindings::Mapping isolatedGlobals = copier.copy(globals);
+	Value isolatedFunction = copier.copy(function);
+	Arguments isolatedArguments;
+	for (const Value &argument : arguments)
+	{
+		isolatedArguments.push_back(copier.copy(argument));
+	}
+
+	std::unique_ptr<Isolate> isolate(new Isolate());
+	Isolate *started = isolate.get();
+	// Started before it can be joined
+	isolate->thread = std::thread([started, isolatedGlobals, settings, isolatedFunction, isolatedArguments]() {
+		run(started, isolatedGlobals, settings, isolatedFunction, isolatedArguments);
+	});
+	std::lock_guard<std::mutex> lock(mutex);
+	int id = ++lastId;
+	isolates[id] = std::move(isolate);
+	return id;
+}
+
+bool joinIsolate(int id, Value &result, std::string &error)
+{
+	std::unique_ptr<Isolate> isolate = take(id);
+	if (!isolate)
+	{
+		error = "No isolate " + str(id) + ", or it was already joined";
+		return false;
+	}
+	isolate->thread.join();
+	if (isolate->failed)
+	{
+		error = "Isolate " + str(id) + " failed: " + isolate->error;
+		return false;
+	}
+	result = isolate->result;
+	return true;
+}
+
+void joinAllIsolates()
+{
+	// Those still running may spawn more
+	for (;;)
+	{
+		int id;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (isolates.empty())
+			{
+				return;
+			}
+			id = isolates.begin()->first;
+		}
+		Value result;
+		std::string error;
+		if (!joinIsolate(id, result, error))
+		{
+			std::cerr << error << '\n';
+		}
+	}
+}
+
+bool executeInIsolates(const Interpreter &interpreter, const std::vector<std::string> &filenames, const Settings &settings)
+{
+	std::atomic<int> failures(0);
+	{
+		ThreadPool pool(settings.threads);
+		for (const std::string &filename : filenames)
+		{
+			std::shared_ptr<Bindings::Mapping> globals = std::make_shared<Bindings::Mapping>(IsolatingCopier().copy(interpreter.globals()));
+			pool.submit([globals, filename, &settings, &failures]() {
+				Interpreter isolate(*globals, settings);
+				if (!execute(isolate, filename, settings))
+				{
+					++failures;
+				}
+			});
+		}
+		// Which waits for them
+	}
+	return failures == 0;
+}
@@ -0,0 +1,75 @@
+#ifndef ISOLATE_H
+#define ISOLATE_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "value.h"
+#include "bindings.h"
+#include "call_context.h"
+
+class Settings;
+class Interpreter;
+
+// An isolate is an interpreter, and the values it can reach, used by only
+// one thread. Values are deep copies, except closures, whose closed values
+// are cells shared between the copies. This copies values into or out of
+// an isolate with new cells, shared between the closures copied by the same
+// copier as they were between the originals. Function code is immutable, so
+// is still shared. A suspended generator cannot be moved, so its copies, as
+// those of any iterator that is not thread safe, fail when advanced.
+class IsolatingCopier
+{
+public:
+	Value copy(const Value &value);
+	Bindings::Mapping copy(const Bindings::Mapping &mapping);
+
+private:
+	Bindings::ValuePtr copyCell(const Bindings::ValuePtr &cell);
+
+	std::map<const Value *, Bindings::ValuePtr> cells_;
+};
+
+// Whether the value holds closures, whose closed values change in place, or
+// iterators such as generators that one thread must advance alone
+bool needsIsolatingCopy(const Value &value);
+
+// The globals for isolates running at the same time, such as the chunks of
+// a parallel_map, copied once for all of them rather than once each. Values
+// without closures do not change in place, so the isolates share their
+// cells, read only: assigning one gives that isolate a cell of its own (see
+// Bindings::set). Globals needing an isolating copy are copied again for each
+// isolate.
+class SharedGlobals
+{
+public:
+	// On the thread owning the globals
+	explicit SharedGlobals(const Bindings::Mapping &globals);
+
+	// The globals for one more isolate, on any thread
+	Bindings::Mapping isolate() const;
+
+private:
+	Bindings::Mapping shared_;
+	// Never run, so only read as each isolate copies them
+	Bindings::Mapping copied_;
+};
+
+// Runs function(arguments) on a new thread, in a new interpreter with an
+// isolated copy of the globals. Returns an id for joinIsolate().
+int spawnIsolate(const Bindings::Mapping &globals, const Settings &settings, const Value &function, const Arguments &arguments);
+
+// Waits for the isolate to finish, returning false with the reason if it
+// failed or there is no such isolate.
+bool joinIsolate(int id, Value &result, std::string &error);
+
+// Waits for the isolates no one joined, reporting any that failed
+void joinAllIsolates();
+
+// Runs each file in its own isolate, settings.threads at a time. The
+// interpreter's globals are copied into each, and not changed, so the files
+// do not see each other's definitions. False if any file failed.
+bool executeInIsolates(const Interpreter &interpreter, const std::vector<std::string> &filenames, const Settings &settings);
+
+#endif
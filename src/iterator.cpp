@@ -0,0 +1,13 @@
+#include "iterator.h"
+
+#include "execution_error.h"
+
+bool Iterator::threadSafe() const
+{
+	return false;
+}
+
+Value Iterator::call(CallContext &) const
+{
+	throw ExecutionError(sourceLocation(), "'" + name() + "' is advanced by next, not called");
+}
@@ -0,0 +1,28 @@
+#ifndef ITERATOR_H
+#define ITERATOR_H
+
+#include "function.h"
+
+class Interpreter;
+
+// A function value that next advances, rather than one that is called, e.g.
+// a generator or the lines of a file
+class Iterator : public Function
+{
+public:
+	virtual Iterator *clone() const = 0;
+	virtual Value call(CallContext &) const;
+
+	// The next value, or nil once there are none
+	virtual Value next(Interpreter &interpreter) const = 0;
+
+	// Whether copies can be advanced by several threads at once, and so
+	// can be handed to another isolate as they are. Not unless overridden.
+	virtual bool threadSafe() const;
+
+	// A copy for another isolate, when this is not thread safe. It cannot
+	// share what the original advances, so fails if advanced.
+	virtual Value detached() const = 0;
+};
+
+#endif
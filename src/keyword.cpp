@@ -13,6 +13,7 @@ const std::string KEYWORD_TRUE = "true";
 const std::string KEYWORD_FALSE = "false";
 const std::string KEYWORD_DEFUN = "defun";
 const std::string KEYWORD_WHILE = "while";
+const std::string KEYWORD_YIELD = "yield";
 
 namespace
 {
@@ -28,7 +29,8 @@ namespace
 		KEYWORD_TRUE,
 		KEYWORD_FALSE,
 		KEYWORD_DEFUN,
-		KEYWORD_WHILE
+		KEYWORD_WHILE,
+		KEYWORD_YIELD
 	};
 }
 
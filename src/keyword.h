@@ -14,6 +14,7 @@ extern const std::string KEYWORD_TRUE;
 extern const std::string KEYWORD_FALSE;
 extern const std::string KEYWORD_DEFUN;
 extern const std::string KEYWORD_WHILE;
+extern const std::string KEYWORD_YIELD;
 
 bool isKeyword(const std::string &string);
 
@@ -9,16 +9,17 @@
 #include "escape.h"
 #include "keyword.h"
 #include "exceptions.h"
+#include "allocations.h"
 
 namespace
 {
 	class Iterator : public std::iterator<std::forward_iterator_tag, char>
 	{
 	public:
-		Iterator(const std::string &filename, std::string::const_iterator it)
+		Iterator(const SourceLocation &file, const char *it)
 		:
 			line_(1),
-			filename_(filename),
+			file_(file),
 			it(it)
 		{
 		}
@@ -30,7 +31,13 @@ namespace
 
 		SourceLocation sourceLocation() const
 		{
-			return SourceLocation(filename_, line_);
+			return file_.atLine(line_);
+		}
+
+		// Points into the source, valid as long as it is
+		const char *position() const
+		{
+			return it;
 		}
 
 		Iterator &operator++()
@@ -62,8 +69,8 @@ namespace
 
 	private:
 		unsigned line_;
-		std::string filename_;
-		std::string::const_iterator it;
+		SourceLocation file_;
+		const char *it;
 	};
 
 
@@ -104,7 +111,7 @@ namespace
 
 		bool operator()(char c)
 		{
-			bool space = std::isspace(c);
+			bool space = std::isspace(static_cast<unsigned char>(c));
 			return negate != space;
 		}
 	private:
@@ -191,7 +198,7 @@ namespace
 		return Identifier(string);
 	}
 
-	Token declarationOrIdentifierOrMemberAccess(const SourceLocation &sourceLocation, const std::string string)
+	Token declarationOrIdentifierOrMemberAccess(const SourceLocation &sourceLocation, const std::string &string)
 	{
 		const std::string::const_iterator end = string.end();
 		std::string::const_iterator current = string.begin();
@@ -222,19 +229,85 @@ namespace
 		return identifier;
 	}
 
+	enum NumericLiteral
+	{
+		NOT_NUMERIC,
+		INTEGER_LITERAL,
+		FLOAT_LITERAL,
+	};
+
+	// From position, false if there are none
+	bool consumeDigits(const std::string &string, std::string::size_type &position)
+	{
+		std::string::size_type start = position;
+		while (position < string.size() && std::isdigit(static_cast<unsigned char>(string[position])))
+		{
+			++position;
+		}
+		return position > start;
+	}
+
+	// Cheap test before is<long long> or is<double>, which also reject out of
+	// range numbers. Floats have a fraction, an exponent or both, e.g. 1.5e3.
+	NumericLiteral looksNumeric(const std::string &string)
+	{
+		std::string::size_type position = (!string.empty() && (string[0] == '-' || string[0] == '+')) ? 1 : 0;
+		if (!consumeDigits(string, position))
+		{
+			return NOT_NUMERIC;
+		}
+		NumericLiteral result = INTEGER_LITERAL;
+		if (position < string.size() && string[position] == '.')
+		{
+			++position;
+			if (!consumeDigits(string, position))
+			{
+				return NOT_NUMERIC;
+			}
+			result = FLOAT_LITERAL;
+		}
+		if (position < string.size() && (string[position] == 'e' || string[position] == 'E'))
+		{
+			++position;
+			if (position < string.size() && (string[position] == '-' || string[position] == '+'))
+			{
+				++position;
+			}
+			if (!consumeDigits(string, position))
+			{
+				return NOT_NUMERIC;
+			}
+			result = FLOAT_LITERAL;
+		}
+		return position == string.size() ? result : NOT_NUMERIC;
+	}
+
+	bool isNumber(NumericLiteral numeric, const std::string &string)
+	{
+		switch (numeric)
+		{
+		case INTEGER_LITERAL:
+			return is<long long>(string);
+		case FLOAT_LITERAL:
+			return is<double>(string);
+		default:
+			return false;
+		}
+	}
+
 	Token literal(Iterator &current, const Iterator end)
 	{
 		current = consumeWhitespace(current, end);
 		const Iterator literalEnd = std::find_if(current, end, IsSpace());
 		
-		std::string string(current, literalEnd);
+		std::string string(current.position(), literalEnd.position());
 		current = literalEnd;
 
 		if(isKeyword(string))
 		{
 			return Token::keyword(current.sourceLocation(), string);
 		}
-		else if(is<int>(string))
+		else if(isNumber(looksNumeric(string), string))
 		{
 			return Token::number(current.sourceLocation(), string);
 		}
@@ -258,8 +331,7 @@ namespace
 		Token result = Token::list(current.sourceLocation());
 		while(current != endOfList)
 		{
-			Token token = next(current, endOfList);
-			result.addChild(token);
+			result.addChild(next(current, endOfList));
 			consumeCommentsAndWhitespace(current, endOfList);
 		}
 
@@ -346,14 +418,20 @@ namespace
 
 Token lex(const std::string &filename, const std::string &source)
 {
-	Token root = Token::list(SourceLocation(filename, 0));
-	
-	Iterator it = Iterator(filename, source.begin());
-	const Iterator end = Iterator(filename, source.end());
+	return lex(filename, source.data(), source.data() + source.size());
+}
+
+Token lex(const std::string &filename, const char *sourceBegin, const char *sourceEnd)
+{
+	AllocationScope allocationScope(ALLOCATION_TOKENS);
+	const SourceLocation file(filename, 0);
+	Token root = Token::list(file);
+
+	Iterator it = Iterator(file, sourceBegin);
+	const Iterator end = Iterator(file, sourceEnd);
 	while(it != end)
 	{
-		Token token = next(it, end);
-		root.addChild(token);
+		root.addChild(next(it, end));
 		consumeCommentsAndWhitespace(it, end);
 	}
 
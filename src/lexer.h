@@ -25,4 +25,7 @@ private:
 
 Token lex(const std::string &filename, const std::string &source);
 
+// The source need not be NUL terminated, e.g. a memory mapped file
+Token lex(const std::string &filename, const char *sourceBegin, const char *sourceEnd);
+
 #endif
@@ -315,6 +315,24 @@ namespace
 			assertEquals(e.what(), "Illegal identifier '='");
 		}
 	}
+
+	void testLexerStopsAtEndOfRange()
+	{
+		// As with a memory mapped file, nothing guarantees a terminator
+		std::string source = "(-12 abc)abc";
+		Token token = (::lex)("range", source.data(), source.data() + source.size() - 3);
+		assertEquals(token.type(), Token::LIST);
+
+		const Token::Children &rootChildren = token.children();
+		assertEquals(rootChildren.size(), 1u);
+		const Token::Children &list = rootChildren.front().children();
+		assertEquals(list.size(), 2u);
+		assertEquals(list[0].type(), Token::NUMBER);
+		assertEquals(list[0].string(), "-12");
+		assertEquals(list[1].type(), Token::IDENTIFIER);
+		assertEquals(list[1].string(), "abc");
+		assertEquals(&list[1].sourceLocation().filename(), &token.sourceLocation().filename());
+	}
 }
 
 namespace
@@ -368,6 +386,7 @@ int runLexerUnitTests()
 	+ RUN_BASIC_TEST(testLexerWithFunction)
 	+ RUN_BASIC_TEST(testLexerWithExplicitlyTypedFunction)
 	+ RUN_BASIC_TEST(testIllegalIdentifierResultsInLexError)
+	+ RUN_BASIC_TEST(testLexerStopsAtEndOfRange)
 	;
 }
 
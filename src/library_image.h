@@ -0,0 +1,11 @@
+#ifndef LIBRARY_IMAGE_H
+#define LIBRARY_IMAGE_H
+
+#include <cstddef>
+
+// standard-library.rasp, compiled at build time by --write-library-image.
+// The bootstrap interpreter that generates it links an empty image instead.
+extern const char LIBRARY_IMAGE[];
+extern const std::size_t LIBRARY_IMAGE_SIZE;
+
+#endif
@@ -1,11 +1,26 @@
 #include <string>
 #include <vector>
+#include <memory>
+#include <thread>
+#include <cstring>
 #include <fstream>
 #include <iostream>
+#include <algorithm>
+#include <fcntl.h>
 
 #include "repl.h"
+#include "bench.h"
+#include "utils.h"
 #include "settings.h"
 #include "compiler.h"
+#include "snapshot.h"
+#include "isolate.h"
+#include "profiler.h"
+#include "sampling_profiler.h"
+#include "allocations.h"
+#include "allocation_profiler.h"
+#include "trace_buffer.h"
+#include "trace_events.h"
 #include "interpreter.h"
 
 #include "standard_math.h"
@@ -16,6 +31,99 @@
 
 typedef std::vector<std::string> ArgumentList;
 
+const char FOLDED_STACKS[] = "rasp-profile.folded";
+const char PPROF_PROFILE[] = "rasp-profile.pb";
+
+// The profilers asked for in the settings, which report when the program ends
+class Profiling
+{
+public:
+	Profiling(Interpreter &interpreter, const Settings &settings)
+	:
+		interpreter_(interpreter),
+		settings_(settings)
+	{
+		if (settings.profile)
+		{
+			interpreter.profile(&profiler_);
+		}
+		if (settings.profileSampleHertz > 0)
+		{
+			sampler_.reset(new SamplingProfiler(settings.profileSampleHertz));
+			if (!sampler_->start())
+			{
+				std::cerr << "Failed to start the sampling profiler\n";
+				std::exit(1);
+			}
+			interpreter.sample(sampler_.get());
+		}
+		if (settings.memStats)
+		{
+			trackPeakBytes();
+			interpreter.profileAllocations(&allocationProfiler_);
+		}
+		if (!settings.traceBuffer.empty())
+		{
+			traceBuffer_.reset(new TraceBuffer(settings.traceBuffer));
+			if (!traceBuffer_->dumpOnFatalSignal())
+			{
+				std::cerr << "Failed to install the handlers writing " << settings.traceBuffer << " on a crash\n";
+			}
+			interpreter.traceBuffer(traceBuffer_.get());
+		}
+	}
+
+	void report()
+	{
+		if (settings_.profile)
+		{
+			interpreter_.profile(nullptr);
+			profiler_.report(std::cerr);
+		}
+		if (sampler_)
+		{
+			sampler_->stop();
+			interpreter_.sample(nullptr);
+			std::ofstream folded(FOLDED_STACKS);
+			sampler_->writeFoldedStacks(folded);
+			std::ofstream pprof(PPROF_PROFILE, std::ios::binary);
+			sampler_->writePprof(pprof);
+			if (!folded || !pprof)
+			{
+				std::cerr << "Failed to write " << FOLDED_STACKS << " and " << PPROF_PROFILE << '\n';
+			}
+			sampler_->report(std::cerr);
+			sampler_.reset();
+		}
+		if (settings_.memStats)
+		{
+			interpreter_.profileAllocations(nullptr);
+			allocationProfiler_.report(std::cerr);
+		}
+		if (traceBuffer_)
+		{
+			interpreter_.traceBuffer(nullptr);
+			if (!traceBuffer_->dump())
+			{
+				std::cerr << "Failed to write " << settings_.traceBuffer << '\n';
+			}
+			traceBuffer_.reset();
+		}
+		if (!settings_.traceEvents.empty() && !writeTraceEvents(settings_.traceEvents))
+		{
+			std::cerr << "Failed to write " << settings_.traceEvents << '\n';
+		}
+	}
+
+private:
+	Interpreter &interpreter_;
+	const Settings &settings_;
+	Profiler profiler_;
+	std::unique_ptr<SamplingProfiler> sampler_;
+	AllocationProfiler allocationProfiler_;
+	std::unique_ptr<TraceBuffer> traceBuffer_;
+};
+
 void printUsage()
 {
 	std::cout << "Usage: <file names to run...>\n";
@@ -23,12 +131,34 @@ void printUsage()
 	std::cout << "Options:\n";
 	std::cout << " --repl: Run REPL (read, eval, print, loop)\n";
 	std::cout << " --trace: Trace program execution\n";
+	std::cout << " --profile: Time each opcode and source line, printing the hottest to stderr on exit\n";
+	std::cout << " --profile-sample=<hz>: Sample the functions being called, writing " << FOLDED_STACKS << " (for flamegraph.pl) and " << PPROF_PROFILE << "\n";
+	std::cout << " --mem-stats: Print the heap allocations by value type and by function to stderr on exit\n";
+	std::cout << " --trace-buffer=<file>: Record the last " << TraceBuffer::DEFAULT_CAPACITY << " instructions executed, writing them to file on error or exit\n";
+	std::cout << " --decode-trace=<file>: Print a file written by --trace-buffer\n";
+	std::cout << " --trace-events=<file>: Write the time spent reading, lexing, parsing and running each file as a Chrome trace, for chrome://tracing or Perfetto\n";
 	std::cout << " --unit-tests: Run unit test suite\n";
 	std::cout << " --print-ast: Print Abstract Syntax Tree\n";
 	std::cout << " --print-instructions: Print Generated Instructions\n";
+	std::cout << " --no-cache: Do not read or write compiled .raspc files\n";
+	std::cout << " --cache-dir=<directory>: Store compiled .raspc files in directory, instead of beside the source\n";
+	std::cout << " --bench[=<runs>]: Time each file over 10 (or runs) runs, printing the results as JSON\n";
+	std::cout << " --bench-scaling: Fit how each file's run time grows with the global N, printing JSON\n";
+	std::cout << " --jobs=<n>: Lex and parse the files on n threads, still running them in order\n";
+	std::cout << " --threads[=<n>]: Run each file in its own isolate, n (or one per core) at a time. The files do not share globals, so one cannot use what another defines\n";
+	std::cout << " --workers=<n>: Run parallel_map, parallel_filter, parallel_reduce and async tasks on n threads, instead of one per core\n";
+	std::cout << " --output-fd=<fd>: Write the output of print, println and debug to an inherited file descriptor, instead of stdout\n";
+	std::cout << " --snapshot <file>: Save the globals to file after running, instead of starting the REPL\n";
+	std::cout << " --from-snapshot <file>: Start with the globals saved by --snapshot, instead of the standard library\n";
+	std::cout << " --write-library-image=<file>: Compile file, printing it as C++ source for linking into the interpreter\n";
 	std::cout << " --help: Print this help message\n";
 }
 
+bool startsWith(const std::string &argument, const std::string &prefix)
+{
+	return argument.compare(0, prefix.size(), prefix) == 0;
+}
+
 ArgumentList gatherArguments(int argc, const char **argv, Settings &settings)
 {
 	ArgumentList args;
@@ -48,6 +178,36 @@ ArgumentList gatherArguments(int argc, const char **argv, Settings &settings)
 		{
 			settings.trace = true;
 		}
+		else if (argument == "--profile")
+		{
+			settings.profile = true;
+		}
+		else if (startsWith(argument, "--profile-sample="))
+		{
+			std::string hertz = argument.substr(std::strlen("--profile-sample="));
+			if (!is<int>(hertz) || to<int>(hertz) < 1 || to<int>(hertz) > 100000)
+			{
+				std::cerr << "--profile-sample requires a rate between 1 and 100000 Hz\n";
+				std::exit(1);
+			}
+			settings.profileSampleHertz = to<int>(hertz);
+		}
+		else if (argument == "--mem-stats")
+		{
+			settings.memStats = true;
+		}
+		else if (startsWith(argument, "--trace-buffer="))
+		{
+			settings.traceBuffer = argument.substr(std::strlen("--trace-buffer="));
+		}
+		else if (startsWith(argument, "--decode-trace="))
+		{
+			settings.decodeTrace = argument.substr(std::strlen("--decode-trace="));
+		}
+		else if (startsWith(argument, "--trace-events="))
+		{
+			settings.traceEvents = argument.substr(std::strlen("--trace-events="));
+		}
 		else if (argument == "--unit-tests")
 		{
 			settings.unitTests = true;
@@ -60,6 +220,90 @@ ArgumentList gatherArguments(int argc, const char **argv, Settings &settings)
 		{
 			settings.printInstructions = true;
 		}
+		else if (argument == "--no-cache")
+		{
+			settings.bytecodeCache = false;
+		}
+		else if (argument == "--bench")
+		{
+			settings.benchRuns = 10;
+		}
+		else if (argument == "--bench-scaling")
+		{
+			settings.benchScaling = true;
+		}
+		else if (startsWith(argument, "--bench="))
+		{
+			std::string runs = argument.substr(std::strlen("--bench="));
+			if (!is<int>(runs) || to<int>(runs) < 1)
+			{
+				std::cerr << "--bench requires a positive number of runs\n";
+				std::exit(1);
+			}
+			settings.benchRuns = to<int>(runs);
+		}
+		else if (startsWith(argument, "--jobs="))
+		{
+			std::string jobs = argument.substr(std::strlen("--jobs="));
+			if (!is<int>(jobs) || to<int>(jobs) < 1)
+			{
+				std::cerr << "--jobs requires a positive number\n";
+				std::exit(1);
+			}
+			settings.jobs = to<int>(jobs);
+		}
+		else if (argument == "--threads")
+		{
+			settings.threads = std::max(1u, std::thread::hardware_concurrency());
+		}
+		else if (startsWith(argument, "--threads="))
+		{
+			std::string threads = argument.substr(std::strlen("--threads="));
+			if (!is<int>(threads) || to<int>(threads) < 1)
+			{
+				std::cerr << "--threads requires a positive number\n";
+				std::exit(1);
+			}
+			settings.threads = to<int>(threads);
+		}
+		else if (startsWith(argument, "--workers="))
+		{
+			std::string workers = argument.substr(std::strlen("--workers="));
+			if (!is<int>(workers) || to<int>(workers) < 1)
+			{
+				std::cerr << "--workers requires a positive number\n";
+				std::exit(1);
+			}
+			settings.workers = to<int>(workers);
+		}
+		else if (startsWith(argument, "--output-fd="))
+		{
+			std::string fd = argument.substr(std::strlen("--output-fd="));
+			if (!is<int>(fd) || to<int>(fd) < 0 || ::fcntl(to<int>(fd), F_GETFD) < 0)
+			{
+				std::cerr << "--output-fd requires an open file descriptor\n";
+				std::exit(1);
+			}
+			settings.outputFd = to<int>(fd);
+		}
+		else if (startsWith(argument, "--cache-dir="))
+		{
+			settings.cacheDirectory = argument.substr(std::strlen("--cache-dir="));
+		}
+		else if (argument == "--snapshot" || argument == "--from-snapshot")
+		{
+			if (i + 1 == argc)
+			{
+				std::cerr << argument << " requires a file name\n";
+				std::exit(1);
+			}
+			std::string &filename = (argument == "--snapshot") ? settings.snapshot : settings.fromSnapshot;
+			filename = argv[++i];
+		}
+		else if (startsWith(argument, "--write-library-image="))
+		{
+			settings.libraryImageSource = argument.substr(std::strlen("--write-library-image="));
+		}
 		else
 		{
 			args.push_back(argument);
@@ -73,29 +317,78 @@ int main(int argc, const char **argv)
 	Settings settings;
 	ArgumentList args = gatherArguments(argc, argv, settings);
 
+	if (!settings.decodeTrace.empty())
+	{
+		return TraceBuffer::decode(settings.decodeTrace, std::cout) ? 0 : 1;
+	}
+
 	if (settings.unitTests)
 	{
 		return runLexerUnitTests() + runUnitTests(settings);
 	}
 
+	if (settings.benchRuns > 0)
+	{
+		return runBenchmarks(args, settings);
+	}
+
+	if (settings.benchScaling)
+	{
+		return runScalingBenchmarks(args, settings);
+	}
+
+	if (!settings.traceEvents.empty())
+	{
+		startTraceEvents();
+	}
+
 	Interpreter::Globals globals;
 	standardMath(globals);
 	standardLibrary(globals);
+
+	if (!settings.fromSnapshot.empty())
+	{
+		Interpreter::Globals builtins = globals;
+		if (!readSnapshot(settings.fromSnapshot, builtins, globals))
+		{
+			return 1;
+		}
+	}
+
 	Interpreter interpreter(globals, settings);
 
-	const char *selfHostedStandardLibrary = "standard-library.rasp";
-	if (std::ifstream(selfHostedStandardLibrary).good())
+	if (!settings.libraryImageSource.empty())
+	{
+		return writeLibraryImage(interpreter, settings.libraryImageSource, std::cout, settings) ? 0 : 1;
+	}
+
+	if (settings.fromSnapshot.empty())
 	{
-	  execute(interpreter, selfHostedStandardLibrary, settings);
+		// Otherwise already part of the snapshot
+		loadStandardLibrary(interpreter, settings);
+	}
+
+	// Only the user's code, not the standard library's initialisation
+	Profiling profiling(interpreter, settings);
+
+	int status = 0;
+	if (settings.threads > 0)
+	{
+		if (!executeInIsolates(interpreter, args, settings))
+		{
+			status = 1;
+		}
 	}
 	else
 	{
-	  std::cerr << "WARN: failed to load " << selfHostedStandardLibrary << std::endl;
+		execute(interpreter, args, settings);
 	}
+	joinAllIsolates();
 
-	for (ArgumentList::const_iterator it = args.begin() ; it != args.end() ; ++it)
+	if (!settings.snapshot.empty())
 	{
-		execute(interpreter, *it, settings);
+		profiling.report();
+		return writeSnapshot(interpreter.globals(), settings.snapshot) ? status : 1;
 	}
 
 	if (settings.repl)
@@ -106,5 +399,8 @@ int main(int argc, const char **argv)
 	{
 		printUsage();
 	}
+
+	profiling.report();
+	return status;
 }
 
@@ -0,0 +1,78 @@
+#include "mapped_file.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+MappedFile::MappedFile(const std::string &filename)
+:
+	open_(false),
+	data_(nullptr),
+	size_(0)
+{
+	int fd = ::open(filename.c_str(), O_RDONLY);
+	if (fd < 0)
+	{
+		return;
+	}
+
+	struct stat status;
+	if (fstat(fd, &status) == 0 && S_ISREG(status.st_mode))
+	{
+		std::size_t size = status.st_size;
+		if (size == 0)
+		{
+			// mmap rejects empty mappings
+			open_ = true;
+		}
+		else
+		{
+			void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (data != MAP_FAILED)
+			{
+				data_ = data;
+				size_ = size;
+				open_ = true;
+			}
+		}
+	}
+	// The mapping remains valid after the descriptor is closed
+	::close(fd);
+}
+
+MappedFile::~MappedFile()
+{
+	if (data_)
+	{
+		munmap(data_, size_);
+	}
+}
+
+bool MappedFile::isOpen() const
+{
+	return open_;
+}
+
+const char *MappedFile::begin() const
+{
+	return static_cast<const char *>(data_);
+}
+
+const char *MappedFile::end() const
+{
+	return begin() + size_;
+}
+
+std::size_t MappedFile::size() const
+{
+	return size_;
+}
+
+void MappedFile::adviseSequential() const
+{
+	if (data_)
+	{
+		::madvise(data_, size_, MADV_SEQUENTIAL);
+	}
+}
@@ -0,0 +1,33 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <string>
+#include <cstddef>
+
+// Read only view of a whole file, via mmap
+class MappedFile
+{
+public:
+	explicit MappedFile(const std::string &filename);
+	~MappedFile();
+
+	bool isOpen() const;
+
+	const char *begin() const;
+	const char *end() const;
+	std::size_t size() const;
+
+	// Hints that it will be read once from start to end, e.g. line by line
+	void adviseSequential() const;
+
+private:
+	// Deliberately private & unimplemented
+	MappedFile(const MappedFile &);
+	MappedFile &operator=(const MappedFile &);
+
+	bool open_;
+	void *data_;
+	std::size_t size_;
+};
+
+#endif
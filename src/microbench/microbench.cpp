@@ -0,0 +1,695 @@
+// Times the interpreter's primitives in isolation, in nanoseconds per
+// operation. Built as a separate binary, see "make microbench".
+
+#include <cmath>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <algorithm>
+
+#include "api.h"
+#include "lexer.h"
+#include "parser.h"
+#include "bindings.h"
+#include "settings.h"
+#include "array_kernels.h"
+#include "exceptions.h"
+#include "instruction.h"
+#include "interpreter.h"
+#include "standard_math.h"
+#include "standard_library.h"
+
+namespace
+{
+	// Stops the compiler from discarding the work being timed
+	template <typename T>
+	void keep(const T &value)
+	{
+		asm volatile("" : : "r"(&value) : "memory");
+	}
+
+	// A benchmark sets up its state, then runs the timed loop of
+	// iterations() operations between start() and stop()
+	class Timer
+	{
+	public:
+		explicit Timer(unsigned long long iterations)
+		:
+			iterations_(iterations),
+			nanoseconds_(0)
+		{
+		}
+
+		unsigned long long iterations() const
+		{
+			return iterations_;
+		}
+
+		void start()
+		{
+			start_ = std::chrono::steady_clock::now();
+		}
+
+		void stop()
+		{
+			std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start_;
+			nanoseconds_ += elapsed.count();
+		}
+
+		double nanoseconds() const
+		{
+			return nanoseconds_;
+		}
+
+	private:
+		unsigned long long iterations_;
+		double nanoseconds_;
+		std::chrono::steady_clock::time_point start_;
+	};
+
+	typedef void MicroBenchmarkFunction(Timer &timer);
+
+	struct MicroBenchmark
+	{
+		const char *name;
+		MicroBenchmarkFunction *function;
+	};
+
+	const SourceLocation LOCATION("<microbench>", 1);
+
+	Interpreter::Globals builtins()
+	{
+		Interpreter::Globals globals;
+		standardMath(globals);
+		standardLibrary(globals);
+		return globals;
+	}
+
+	InstructionList compile(Interpreter &interpreter, const std::string &source)
+	{
+		Token token = lex("<microbench>", source);
+		Declarations declarations = interpreter.declarations();
+		return parse(token, declarations, interpreter.settings());
+	}
+
+	// Values of each type
+
+	Value identity(const Arguments &arguments)
+	{
+		return arguments.front();
+	}
+
+	const PureExternalFunction IDENTITY("identity", LOCATION, &identity);
+
+	Value sampleValue(Value::Type type)
+	{
+		switch (type)
+		{
+		case Value::TNil:
+			return Value::nil();
+		case Value::TBoolean:
+			return Value::boolean(true);
+		case Value::TNumber:
+			return Value::number(42);
+		case Value::TFloat:
+			return Value::floating(4.2);
+		case Value::TString:
+			return Value::string("a short-ish string, over the SSO limit");
+		case Value::TArray:
+			return Value::array(Value::Array(8, Value::number(1)));
+		case Value::TIntArray:
+			return Value::intArray(Value::IntArray(8, 1));
+		case Value::TFloatArray:
+			return Value::floatArray(Value::FloatArray(8, 1.0));
+		case Value::TObject:
+			{
+				Value::Object object;
+				object["x"] = Value::number(1);
+				object["y"] = Value::number(2);
+				object["name"] = Value::string("point");
+				object["next"] = Value::nil();
+				return Value::object(object);
+			}
+		case Value::TFunction:
+			return Value::function(IDENTITY);
+		case Value::TTypeDefinition:
+			{
+				std::vector<Identifier> members;
+				members.push_back(Identifier("x"));
+				members.push_back(Identifier("y"));
+				return Value::typeDefinition(std::make_shared<TypeDefinition>(Identifier("point"), members));
+			}
+		}
+		return Value::nil();
+	}
+
+	template <Value::Type TYPE>
+	void valueCopy(Timer &timer)
+	{
+		Value value = sampleValue(TYPE);
+		timer.start();
+		for (unsigned long long i = 0 ; i < timer.iterations() ; ++i)
+		{
+			Value copy(value);
+			keep(copy);
+		}
+		timer.stop();
+	}
+
+	// Summing an array of numbers, packed at each SIMD level and boxed
+
+	const std::size_t SUMMED = 1024;
+
+	template <SimdLevel LEVEL>
+	void sumPacked(Timer &timer)
+	{
+		Value::IntArray elements;
+		for (std::size_t i = 0 ; i < SUMMED ; ++i)
+		{
+			elements.push_back(i);
+		}
+		SimdLevel previous = simdLevel();
+		setSimdLevel(LEVEL);
+		timer.start();
+		for (unsigned long long i = 0 ; i < timer.iterations() ; ++i)
+		{
+			long long sum;
+			sumInts(elements.data(), elements.size(), sum);
+			keep(sum);
+		}
+		timer.stop();
+		setSimdLevel(previous);
+	}
+
+	void sumBoxed(Timer &timer)
+	{
+		Value::Array elements;
+		for (std::size_t i = 0 ; i < SUMMED ; ++i)
+		{
+			elements.push_back(Value::number(i));
+		}
+		timer.start();
+		for (unsigned long long i = 0 ; i < timer.iterations() ; ++i)
+		{
+			long long sum = 0;
+			for (const Value &element : elements)
+			{
+				if (element.isNumber() && __builtin_add_overflow(sum, element.number(), &sum))
+				{
+					break;
+				}
+			}
+			keep(sum);
+		}
+		timer.stop();
+	}
+
+	// Bindings, with a realistic number of names in each mapping
+
+	const int NAMES = 32;
+
+	Identifier name(int i)
+	{
+		return Identifier("name" + str(i));
+	}
+
+	template <Bindings::RefType REF_TYPE>
+	void bindingsGet(Timer &timer)
+	{
+		Bindings::Mapping globals;
+		Bindings::Mapping closed;
+		Bindings bindings(&globals, &closed);
+		for (int i = 0 ; i < NAMES ; ++i)
+		{
+			bindings.init(REF_TYPE, name(i), Value::number(i));
+		}
+		Identifier identifier = name(NAMES / 2);
+		timer.start();
+		for (unsigned long long i = 0 ; i < timer.iterations() ; ++i)
+		{
+			keep(bindings.get(REF_TYPE, identifier));
+		}
+		timer.stop();
+	}
+
+	template <Bindings::RefType REF_TYPE>
+	void bindingsSet(Timer &timer)
+	{
+		Bindings::Mapping globals;
+		Bindings::Mapping closed;
+		Bindings bindings(&globals, &closed);
+		for (int i = 0 ; i < NAMES ; ++i)
+		{
+			bindings.init(REF_TYPE, name(i), Value::number(i));
+		}
+		Identifier identifier = name(NAMES / 2);
+		Value value = Value::number(7);
+		timer.start();
+		for (unsigned long long i = 0 ; i < timer.iterations() ; ++i)
+		{
+			bindings.set(REF_TYPE, identifier, value);
+		}
+		timer.stop();
+	}
+
+	// Declarations: the builtins as globals, then two function scopes
+
+	void checkIdentifier(Timer &timer, const Identifier &identifier)
+	{
+		Declarations declarations(builtins());
+		declarations.add(Identifier("global"));
+		Declarations outer = declarations.newScope();
+		outer.add(Identifier("captured"));
+		Declarations inner = outer.newScope();
+		for (int i = 0 ; i < 8 ; ++i)
+		{
+			inner.add(name(i));
+		}
+		timer.start();
+		for (unsigned long long i = 0 ; i < timer.iterations() ; ++i)
+		{
+			IdentifierDefinition definition = inner.checkIdentifier(identifier);
+			keep(definition);
+		}
+		timer.stop();
+	}
+
+	void checkLocal(Timer &timer)
+	{
+		checkIdentifier(timer, name(3));
+	}
+
+	void checkClosure(Timer &timer)
+	{
+		checkIdentifier(timer, Identifier("captured"));
+	}
+
+	void checkGlobal(Timer &timer)
+	{
+		checkIdentifier(timer, Identifier("global"));
+	}
+
+	void checkUndefined(Timer &timer)
+	{
+		checkIdentifier(timer, Identifier("undefined"));
+	}
+
+	// Interpreter::exec, on a list repeating one opcode's pattern. Timer
+	// iterations are always a multiple of REPEATS, see measure().
+
+	const unsigned REPEATS = 256;
+
+	// Appends the instructions for the given repeat
+	typedef void Pattern(InstructionList &instructions, unsigned repeat);
+
+	void execPattern(Timer &timer, Pattern *pattern, const Value &function)
+	{
+		Interpreter interpreter(builtins(), Settings());
+		InstructionList instructions;
+		for (unsigned i = 0 ; i < REPEATS ; ++i)
+		{
+			pattern(instructions, i);
+		}
+
+		Bindings::Mapping initialGlobals;
+		initialGlobals[Identifier("g")] = makeValue(Value::number(1));
+		initialGlobals[Identifier("o")] = makeValue(sampleValue(Value::TObject));
+		initialGlobals[Identifier("f")] = makeValue(function);
+		Bindings::Mapping closed;
+		closed[Identifier("c")] = makeValue(Value::number(3));
+
+		unsigned long long runs = timer.iterations() / REPEATS;
+		for (unsigned long long i = 0 ; i < runs ; ++i)
+		{
+			// Fresh globals, so INIT_GLOBAL can run again
+			Bindings::Mapping globals = initialGlobals;
+			Bindings bindings(&globals, &closed);
+			bindings.initLocal(Identifier("l"), Value::number(2));
+			timer.start();
+			keep(interpreter.exec(instructions, bindings));
+			timer.stop();
+		}
+	}
+
+	Identifier numbered(const char *prefix, unsigned repeat)
+	{
+		return Identifier(prefix + str(repeat));
+	}
+
+	void pushOne(InstructionList &instructions, unsigned)
+	{
+		instructions.push_back(Instruction::push(LOCATION, Value::number(1)));
+	}
+
+	void refLocal(InstructionList &instructions, unsigned)
+	{
+		instructions.push_back(Instruction::refLocal(LOCATION, Identifier("l")));
+	}
+
+	void refGlobal(InstructionList &instructions, unsigned)
+	{
+		instructions.push_back(Instruction::refGlobal(LOCATION, Identifier("g")));
+	}
+
+	void refClosure(InstructionList &instructions, unsigned)
+	{
+		instructions.push_back(Instruction::refClosure(LOCATION, Identifier("c")));
+	}
+
+	// Initialisation and assignment leave the value on the stack
+	void initLocal(InstructionList &instructions, unsigned repeat)
+	{
+		if (repeat == 0)
+		{
+			pushOne(instructions, repeat);
+		}
+		instructions.push_back(Instruction::initLocal(LOCATION, numbered("v", repeat)));
+	}
+
+	void initGlobal(InstructionList &instructions, unsigned repeat)
+	{
+		if (repeat == 0)
+		{
+			pushOne(instructions, repeat);
+		}
+		instructions.push_back(Instruction::initGlobal(LOCATION, numbered("v", repeat)));
+	}
+
+	void initClosure(InstructionList &instructions, unsigned)
+	{
+		instructions.push_back(Instruction::initClosure(LOCATION, Identifier("l")));
+	}
+
+	void assignLocal(InstructionList &instructions, unsigned repeat)
+	{
+		if (repeat == 0)
+		{
+			pushOne(instructions, repeat);
+		}
+		instructions.push_back(Instruction::assignLocal(LOCATION, Identifier("l")));
+	}
+
+	void assignGlobal(InstructionList &instructions, unsigned repeat)
+	{
+		if (repeat == 0)
+		{
+			pushOne(instructions, repeat);
+		}
+		instructions.push_back(Instruction::assignGlobal(LOCATION, Identifier("g")));
+	}
+
+	void assignClosure(InstructionList &instructions, unsigned repeat)
+	{
+		if (repeat == 0)
+		{
+			pushOne(instructions, repeat);
+		}
+		instructions.push_back(Instruction::assignClosure(LOCATION, Identifier("c")));
+	}
+
+	// The skipped push is never executed
+	void jump(InstructionList &instructions, unsigned repeat)
+	{
+		instructions.push_back(Instruction::jump(LOCATION, 1));
+		pushOne(instructions, repeat);
+	}
+
+	void condJump(InstructionList &instructions, unsigned repeat)
+	{
+		instructions.push_back(Instruction::push(LOCATION, Value::boolean(false)));
+		instructions.push_back(Instruction::condJump(LOCATION, 1));
+		pushOne(instructions, repeat);
+	}
+
+	void close(InstructionList &instructions, unsigned)
+	{
+		instructions.push_back(Instruction::initClosure(LOCATION, Identifier("l")));
+		instructions.push_back(Instruction::refGlobal(LOCATION, Identifier("f")));
+		instructions.push_back(Instruction::close(LOCATION, 1));
+	}
+
+	void memberAccess(InstructionList &instructions, unsigned)
+	{
+		instructions.push_back(Instruction::refGlobal(LOCATION, Identifier("o")));
+		instructions.push_back(Instruction::memberAccess(LOCATION, Identifier("x")));
+	}
+
+	void callOne(InstructionList &instructions, unsigned repeat)
+	{
+		pushOne(instructions, repeat);
+		instructions.push_back(Instruction::refGlobal(LOCATION, Identifier("f")));
+		instructions.push_back(Instruction::call(LOCATION, 1));
+	}
+
+	template <Pattern *PATTERN>
+	void execOpcode(Timer &timer)
+	{
+		execPattern(timer, PATTERN, Value::function(IDENTITY));
+	}
+
+	// handleFunction, for each kind of function. Each takes one argument
+	// and returns it, or for the closure a captured value.
+
+	Value compiledFunction(const std::string &source, const char *name)
+	{
+		Interpreter interpreter(builtins(), Settings());
+		interpreter.exec(compile(interpreter, source));
+		return *interpreter.global(Identifier(name));
+	}
+
+	void callPureExternal(Timer &timer)
+	{
+		execPattern(timer, &callOne, Value::function(IDENTITY));
+	}
+
+	void callInternal(Timer &timer)
+	{
+		execPattern(timer, &callOne, compiledFunction("(defun identity (x) x)", "identity"));
+	}
+
+	void callClosure(Timer &timer)
+	{
+		Value closure = compiledFunction("(defun make (y) (defun inner (x) y) inner) (var closure (make 1))", "closure");
+		execPattern(timer, &callOne, closure);
+	}
+
+	// The front end, per definition of a typical small function
+
+	std::string definitions()
+	{
+		std::string source;
+		for (unsigned i = 0 ; i < REPEATS ; ++i)
+		{
+			source += "(defun f" + str(i) + " (x) (var y (+ x " + str(i) + ")) (if (< y 0) (- 0 y) y))\n";
+		}
+		return source;
+	}
+
+	void lexDefinitions(Timer &timer)
+	{
+		std::string source = definitions();
+		unsigned long long runs = timer.iterations() / REPEATS;
+		timer.start();
+		for (unsigned long long i = 0 ; i < runs ; ++i)
+		{
+			Token token = lex("<microbench>", source.data(), source.data() + source.size());
+			keep(token);
+		}
+		timer.stop();
+	}
+
+	void parseDefinitions(Timer &timer)
+	{
+		Interpreter interpreter(builtins(), Settings());
+		Token token = lex("<microbench>", definitions());
+		Declarations globals = interpreter.declarations();
+		unsigned long long runs = timer.iterations() / REPEATS;
+		timer.start();
+		for (unsigned long long i = 0 ; i < runs ; ++i)
+		{
+			Declarations declarations = globals;
+			InstructionList instructions = parse(token, declarations, interpreter.settings());
+			keep(instructions);
+		}
+		timer.stop();
+	}
+
+	#define MICROBENCHMARK(name, function) MicroBenchmark { name, &function }
+
+	MicroBenchmark benchmarks[] = {
+		MICROBENCHMARK("value copy nil", valueCopy<Value::TNil>),
+		MICROBENCHMARK("value copy boolean", valueCopy<Value::TBoolean>),
+		MICROBENCHMARK("value copy number", valueCopy<Value::TNumber>),
+		MICROBENCHMARK("value copy float", valueCopy<Value::TFloat>),
+		MICROBENCHMARK("value copy string", valueCopy<Value::TString>),
+		MICROBENCHMARK("value copy array (8 numbers)", valueCopy<Value::TArray>),
+		MICROBENCHMARK("value copy object (4 fields)", valueCopy<Value::TObject>),
+		MICROBENCHMARK("value copy function", valueCopy<Value::TFunction>),
+		MICROBENCHMARK("value copy type definition", valueCopy<Value::TTypeDefinition>),
+		MICROBENCHMARK("sum 1024 boxed numbers", sumBoxed),
+		MICROBENCHMARK("sum 1024 packed ints scalar", sumPacked<SIMD_SCALAR>),
+		MICROBENCHMARK("sum 1024 packed ints sse4.2", sumPacked<SIMD_SSE42>),
+		MICROBENCHMARK("sum 1024 packed ints avx2", sumPacked<SIMD_AVX2>),
+		MICROBENCHMARK("bindings get local", bindingsGet<Bindings::Local>),
+		MICROBENCHMARK("bindings get global", bindingsGet<Bindings::Global>),
+		MICROBENCHMARK("bindings get closure", bindingsGet<Bindings::Closure>),
+		MICROBENCHMARK("bindings set local", bindingsSet<Bindings::Local>),
+		MICROBENCHMARK("bindings set global", bindingsSet<Bindings::Global>),
+		MICROBENCHMARK("bindings set closure", bindingsSet<Bindings::Closure>),
+		MICROBENCHMARK("checkIdentifier local", checkLocal),
+		MICROBENCHMARK("checkIdentifier closure", checkClosure),
+		MICROBENCHMARK("checkIdentifier global", checkGlobal),
+		MICROBENCHMARK("checkIdentifier undefined", checkUndefined),
+		MICROBENCHMARK("exec PUSH", execOpcode<pushOne>),
+		MICROBENCHMARK("exec REF_LOCAL", execOpcode<refLocal>),
+		MICROBENCHMARK("exec REF_GLOBAL", execOpcode<refGlobal>),
+		MICROBENCHMARK("exec REF_CLOSURE", execOpcode<refClosure>),
+		MICROBENCHMARK("exec INIT_LOCAL", execOpcode<initLocal>),
+		MICROBENCHMARK("exec INIT_GLOBAL", execOpcode<initGlobal>),
+		MICROBENCHMARK("exec INIT_CLOSURE", execOpcode<initClosure>),
+		MICROBENCHMARK("exec ASSIGN_LOCAL", execOpcode<assignLocal>),
+		MICROBENCHMARK("exec ASSIGN_GLOBAL", execOpcode<assignGlobal>),
+		MICROBENCHMARK("exec ASSIGN_CLOSURE", execOpcode<assignClosure>),
+		MICROBENCHMARK("exec JUMP", execOpcode<jump>),
+		MICROBENCHMARK("exec PUSH + COND_JUMP", execOpcode<condJump>),
+		MICROBENCHMARK("exec INIT_CLOSURE + REF_GLOBAL + CLOSE", execOpcode<close>),
+		MICROBENCHMARK("exec REF_GLOBAL + MEMBER_ACCESS", execOpcode<memberAccess>),
+		MICROBENCHMARK("call PureExternalFunction", callPureExternal),
+		MICROBENCHMARK("call InternalFunction", callInternal),
+		MICROBENCHMARK("call Closure", callClosure),
+		MICROBENCHMARK("lex, per definition", lexDefinitions),
+		MICROBENCHMARK("parse, per definition", parseDefinitions),
+	};
+
+	// Statistics over batches of iterations, in nanoseconds per operation
+
+	double nanosecondsPerOperation(MicroBenchmarkFunction *function, unsigned long long iterations)
+	{
+		Timer timer(iterations);
+		function(timer);
+		return timer.nanoseconds() / iterations;
+	}
+
+	double median(std::vector<double> samples)
+	{
+		std::sort(samples.begin(), samples.end());
+		std::size_t middle = samples.size() / 2;
+		return samples.size() % 2 ? samples[middle] : (samples[middle - 1] + samples[middle]) / 2;
+	}
+
+	// Median absolute deviation, relative to the median
+	double relativeDeviation(const std::vector<double> &samples)
+	{
+		double centre = median(samples);
+		std::vector<double> deviations;
+		for (double sample : samples)
+		{
+			deviations.push_back(std::fabs(sample - centre));
+		}
+		return median(deviations) / centre;
+	}
+
+	// Each batch runs for at least this long
+	const double BATCH_NANOSECONDS = 5e6;
+	// Warmed up once this many consecutive batches agree to within STABLE
+	const std::size_t WARM_UP_WINDOW = 5;
+	const double STABLE = 0.02;
+	const double MAX_WARM_UP_NANOSECONDS = 1e9;
+	const unsigned BATCHES = 15;
+
+	struct Measurement
+	{
+		double nanoseconds;
+		double deviation;
+		unsigned long long iterations;
+		bool warmedUp;
+	};
+
+	Measurement measure(MicroBenchmarkFunction *function)
+	{
+		Measurement measurement;
+		measurement.iterations = REPEATS;
+		while (nanosecondsPerOperation(function, measurement.iterations) * measurement.iterations < BATCH_NANOSECONDS)
+		{
+			measurement.iterations *= 2;
+		}
+
+		// Caches, the branch predictor and the allocator settle before timing
+		std::vector<double> recent;
+		double warmUp = 0;
+		measurement.warmedUp = false;
+		while (!measurement.warmedUp && warmUp < MAX_WARM_UP_NANOSECONDS)
+		{
+			double sample = nanosecondsPerOperation(function, measurement.iterations);
+			warmUp += sample * measurement.iterations;
+			recent.push_back(sample);
+			if (recent.size() > WARM_UP_WINDOW)
+			{
+				recent.erase(recent.begin());
+			}
+			if (recent.size() == WARM_UP_WINDOW)
+			{
+				double centre = median(recent);
+				double spread = (*std::max_element(recent.begin(), recent.end()) - *std::min_element(recent.begin(), recent.end())) / centre;
+				measurement.warmedUp = spread <= STABLE;
+			}
+		}
+
+		std::vector<double> samples;
+		for (unsigned i = 0 ; i < BATCHES ; ++i)
+		{
+			samples.push_back(nanosecondsPerOperation(function, measurement.iterations));
+		}
+		measurement.nanoseconds = median(samples);
+		measurement.deviation = relativeDeviation(samples);
+		return measurement;
+	}
+
+	bool selected(const char *name, int argc, char *argv[])
+	{
+		if (argc < 2)
+		{
+			return true;
+		}
+		for (int i = 1 ; i < argc ; ++i)
+		{
+			if (std::strstr(name, argv[i]))
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+}
+
+// Runs the benchmarks whose names contain any of the arguments, or all of them
+int main(int argc, char *argv[])
+{
+	try
+	{
+		std::cout << std::left << std::setw(42) << "benchmark" << std::right << std::setw(12) << "ns/op" << std::setw(10) << "+/-" << std::setw(14) << "iterations" << '\n';
+		for (const MicroBenchmark &benchmark : benchmarks)
+		{
+			if (!selected(benchmark.name, argc, argv))
+			{
+				continue;
+			}
+			Measurement measurement = measure(benchmark.function);
+			std::cout << std::left << std::setw(42) << benchmark.name << std::right << std::fixed;
+			std::cout << std::setw(12) << std::setprecision(2) << measurement.nanoseconds;
+			std::cout << std::setw(9) << std::setprecision(1) << measurement.deviation * 100 << '%';
+			std::cout << std::setw(14) << measurement.iterations;
+			std::cout << (measurement.warmedUp ? "" : "  (unstable)") << std::endl;
+		}
+	}
+	catch(const RaspError &e)
+	{
+		std::cerr << "ERROR: " << e.what() << '\n';
+		printStackTrace(std::cerr, e);
+		return 1;
+	}
+	return 0;
+}
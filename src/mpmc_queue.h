@@ -0,0 +1,129 @@
+#ifndef MPMC_QUEUE_H
+#define MPMC_QUEUE_H
+
+#include <atomic>
+#include <vector>
+#include <cstddef>
+
+// Bounded queue for any number of producer and consumer threads, without
+// locks: each slot has a sequence number saying whether it is ready for the
+// push, or the pop, of a given lap around the buffer (Dmitry Vyukov's
+// design). Values are swapped in and out, so are never copied.
+template<typename T>
+class MpmcQueue
+{
+public:
+	// Rounded up to a power of two
+	explicit MpmcQueue(std::size_t capacity)
+	:
+		mask_(0),
+		pushes_(0),
+		pops_(0)
+	{
+		std::size_t size = 2;
+		while (size < capacity)
+		{
+			size *= 2;
+		}
+		slots_ = std::vector<Slot>(size);
+		for (std::size_t i = 0 ; i < size ; ++i)
+		{
+			slots_[i].sequence.store(i, std::memory_order_relaxed);
+		}
+		mask_ = size - 1;
+	}
+
+	std::size_t capacity() const
+	{
+		return slots_.size();
+	}
+
+	// False, leaving value alone, when full. Otherwise value is left with
+	// what the slot held, a default T.
+	bool tryPush(T &value)
+	{
+		std::size_t position = pushes_.load(std::memory_order_relaxed);
+		for (;;)
+		{
+			Slot &slot = slots_[position & mask_];
+			std::size_t sequence = slot.sequence.load(std::memory_order_acquire);
+			std::ptrdiff_t lap = static_cast<std::ptrdiff_t>(sequence - position);
+			if (lap == 0)
+			{
+				if (pushes_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+				{
+					using std::swap;
+					swap(slot.value, value);
+					slot.sequence.store(position + 1, std::memory_order_release);
+					return true;
+				}
+			}
+			else if (lap < 0)
+			{
+				// Not yet popped, a lap ago
+				return false;
+			}
+			else
+			{
+				position = pushes_.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	// False when empty
+	bool tryPop(T &value)
+	{
+		std::size_t position = pops_.load(std::memory_order_relaxed);
+		for (;;)
+		{
+			Slot &slot = slots_[position & mask_];
+			std::size_t sequence = slot.sequence.load(std::memory_order_acquire);
+			std::ptrdiff_t lap = static_cast<std::ptrdiff_t>(sequence - (position + 1));
+			if (lap == 0)
+			{
+				if (pops_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+				{
+					using std::swap;
+					swap(slot.value, value);
+					slot.value = T();
+					slot.sequence.store(position + mask_ + 1, std::memory_order_release);
+					return true;
+				}
+			}
+			else if (lap < 0)
+			{
+				// Not yet pushed
+				return false;
+			}
+			else
+			{
+				position = pops_.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+private:
+	// Deliberately private & unimplemented
+	MpmcQueue(const MpmcQueue &);
+	MpmcQueue &operator=(const MpmcQueue &);
+
+	struct Slot
+	{
+		Slot()
+		:
+			sequence(0)
+		{
+		}
+
+		std::atomic<std::size_t> sequence;
+		T value;
+	};
+
+	std::vector<Slot> slots_;
+	std::size_t mask_;
+	// On their own cache lines, as producers and consumers race on them
+	alignas(64) std::atomic<std::size_t> pushes_;
+	alignas(64) std::atomic<std::size_t> pops_;
+};
+
+#endif
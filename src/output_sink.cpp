@@ -0,0 +1,103 @@
+#include "output_sink.h"
+
+#include <cerrno>
+#include <cstring>
+
+#include <unistd.h>
+
+OutputSink::OutputSink(int fd, std::size_t capacity)
+:
+	fd_(fd),
+	capacity_(capacity),
+	stream_(this)
+{
+}
+
+OutputSink::~OutputSink()
+{
+	flush();
+}
+
+std::ostream &OutputSink::stream()
+{
+	return stream_;
+}
+
+bool OutputSink::flush()
+{
+	if (buffer_.empty())
+	{
+		return true;
+	}
+	bool written = write(pbase(), pptr() - pbase());
+	setp(buffer_.data(), buffer_.data() + capacity_);
+	return written;
+}
+
+OutputSink::int_type OutputSink::overflow(int_type c)
+{
+	bool written = true;
+	if (buffer_.empty())
+	{
+		buffer_.resize(capacity_);
+		setp(buffer_.data(), buffer_.data() + capacity_);
+	}
+	else
+	{
+		// Keeping back a partial last line, unless it is all there is
+		char *end = pptr();
+		char *lineEnd = end;
+		while (lineEnd != pbase() && lineEnd[-1] != '\n')
+		{
+			--lineEnd;
+		}
+		if (lineEnd == pbase())
+		{
+			lineEnd = end;
+		}
+		written = write(pbase(), lineEnd - pbase());
+		std::size_t kept = end - lineEnd;
+		std::memmove(buffer_.data(), lineEnd, kept);
+		setp(buffer_.data(), buffer_.data() + capacity_);
+		pbump(kept);
+	}
+
+	if (!written)
+	{
+		return traits_type::eof();
+	}
+	if (!traits_type::eq_int_type(c, traits_type::eof()))
+	{
+		*pptr() = traits_type::to_char_type(c);
+		pbump(1);
+	}
+	return traits_type::not_eof(c);
+}
+
+int OutputSink::sync()
+{
+	return flush() ? 0 : -1;
+}
+
+bool OutputSink::write(const char *data, std::size_t size)
+{
+	if (fd_ == DISCARD)
+	{
+		return true;
+	}
+	while (size > 0)
+	{
+		ssize_t count = ::write(fd_, data, size);
+		if (count < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			return false;
+		}
+		data += count;
+		size -= count;
+	}
+	return true;
+}
@@ -0,0 +1,48 @@
+#ifndef OUTPUT_SINK_H
+#define OUTPUT_SINK_H
+
+#include <vector>
+#include <ostream>
+#include <streambuf>
+
+// Where an interpreter's print, println, debug and --trace write, so they
+// keep their order. Output collects in a large buffer, written to the file
+// descriptor in blocks instead of piece by piece through std::cout. When the
+// buffer fills, only whole lines are written, so isolates sharing a
+// descriptor do not tear each other's lines.
+class OutputSink : public std::streambuf
+{
+public:
+	// Writes nothing, e.g. while benchmarking
+	static const int DISCARD = -1;
+	static const std::size_t DEFAULT_CAPACITY = 64 * 1024;
+
+	explicit OutputSink(int fd, std::size_t capacity = DEFAULT_CAPACITY);
+	// Flushes
+	~OutputSink();
+
+	std::ostream &stream();
+
+	// False, with errno set, if writing failed
+	bool flush();
+
+protected:
+	virtual int_type overflow(int_type c);
+	virtual int sync();
+
+private:
+	// Deliberately private & unimplemented
+	OutputSink(const OutputSink &);
+	OutputSink &operator=(const OutputSink &);
+
+	bool write(const char *data, std::size_t size);
+
+	int fd_;
+	std::size_t capacity_;
+	// Allocated on first use, as most interpreters, e.g. a parallel_map's,
+	// never print
+	std::vector<char> buffer_;
+	std::ostream stream_;
+};
+
+#endif
@@ -0,0 +1,94 @@
+#include "parallel.h"
+
+#include <memory>
+
+#include "channel.h"
+#include "isolate.h"
+#include "interpreter.h"
+#include "work_stealing_pool.h"
+
+namespace
+{
+	// More chunks than threads, for stealing to even out uneven ones
+	const std::size_t CHUNKS_PER_THREAD = 4;
+
+	struct Chunk
+	{
+		std::shared_ptr<const SharedGlobals> globals;
+		Value function;
+		Value::Array elements;
+		Value::Array results;
+	};
+
+	void apply(ParallelOperation operation, const Settings &settings, Chunk &chunk)
+	{
+		Interpreter interpreter(chunk.globals->isolate(), settings);
+		Value::Array &elements = chunk.elements;
+		if (operation == PARALLEL_REDUCE)
+		{
+			Value result = elements.front();
+			for (std::size_t i = 1 ; i < elements.size() ; ++i)
+			{
+				Arguments arguments;
+				arguments.push_back(result);
+				arguments.push_back(elements[i]);
+				result = interpreter.call(chunk.function, arguments);
+			}
+			chunk.results.push_back(transferable(result));
+			return;
+		}
+		for (Value &element : elements)
+		{
+			Value result = interpreter.call(chunk.function, Arguments(1, element));
+			if (operation == PARALLEL_MAP)
+			{
+				chunk.results.push_back(transferable(result));
+			}
+			else if (result.isTruthy())
+			{
+				chunk.results.push_back(transferable(element));
+			}
+		}
+	}
+}
+
+Value::Array parallelApply(ParallelOperation operation, CallContext &callContext, const Value &function, const Value::Array &elements)
+{
+	const Settings &settings = callContext.interpreter()->settings();
+	WorkStealingPool &pool = sharedWorkStealingPool(settings.workers);
+	std::size_t chunkCount = std::min<std::size_t>(elements.size(), pool.threads() * CHUNKS_PER_THREAD);
+
+	// Copied on this thread, which owns the originals, the globals once for
+	// every chunk
+	std::shared_ptr<const SharedGlobals> globals = std::make_shared<SharedGlobals>(*callContext.globals());
+	std::vector<std::shared_ptr<Chunk>> chunks;
+	std::vector<WorkStealingPool::Task> tasks;
+	for (std::size_t i = 0 ; i < chunkCount ; ++i)
+	{
+		std::shared_ptr<Chunk> chunk = std::make_shared<Chunk>();
+		IsolatingCopier copier;
+		chunk->globals = globals;
+		chunk->function = copier.copy(function);
+		std::size_t begin = elements.size() * i / chunkCount;
+		std::size_t end = elements.size() * (i + 1) / chunkCount;
+		for (std::size_t j = begin ; j < end ; ++j)
+		{
+			chunk->elements.push_back(copier.copy(elements[j]));
+		}
+		chunks.push_back(chunk);
+		tasks.push_back([operation, &settings, chunk]() { apply(operation, settings, *chunk); });
+	}
+	pool.run(tasks);
+
+	Value::Array results;
+	for (const std::shared_ptr<Chunk> &chunk : chunks)
+	{
+		std::size_t start = results.size();
+		results.resize(start + chunk->results.size());
+		for (std::size_t i = 0 ; i < chunk->results.size() ; ++i)
+		{
+			swap(results[start + i], chunk->results[i]);
+		}
+	}
+	return results;
+}
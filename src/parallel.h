@@ -0,0 +1,22 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include "value.h"
+#include "call_context.h"
+
+enum ParallelOperation
+{
+	PARALLEL_MAP,
+	PARALLEL_FILTER,
+	// The chunks' partial results, each reduced from its first element
+	PARALLEL_REDUCE,
+};
+
+// Applies function to the elements, in chunks across the shared work
+// stealing pool, returning the results in order. Each chunk runs in its own
+// interpreter, with isolated globals copied once for all the chunks (see
+// SharedGlobals), so the function should be pure: assignments to globals are
+// lost. The chunks share the function's compiled code.
+Value::Array parallelApply(ParallelOperation operation, CallContext &callContext, const Value &function, const Value::Array &elements);
+
+#endif
@@ -10,6 +10,8 @@
 #include "bindings.h"
 #include "settings.h"
 #include "exceptions.h"
+#include "allocations.h"
+#include "trace_events.h"
 #include "type_definition.h"
 #include "internal_function.h"
 
@@ -445,6 +447,17 @@ namespace
 		}
 	}
 
+	void handleYieldKeyword(const Token &token, Declarations &declarations, InstructionList &instructions, const Settings &settings)
+	{
+		const Token::Children &children = token.children();
+		if(children.size() != 2)
+		{
+			throw ParseError(token.sourceLocation(), "Keyword 'yield' takes a single value");
+		}
+		parse(children[1], declarations, instructions, settings);
+		instructions.push_back(Instruction::yield(token.sourceLocation()));
+	}
+
 	void handleList(const Token &token, Declarations &declarations, InstructionList &instructions, const Settings &settings)
 	{
 		const Token::Children &children = token.children();
@@ -489,6 +502,10 @@ namespace
 			{
 				handleDefunKeyword(token, declarations, instructions, settings);
 			}
+			else if(keyword == KEYWORD_YIELD)
+			{
+				handleYieldKeyword(token, declarations, instructions, settings);
+			}
 			else if(!handleLiteral(token, instructions))
 			{
 				throw CompilerBug("unhandled keyword '" + token.string() + "' at line " + str(token.sourceLocation()));
@@ -537,8 +554,12 @@ namespace
 			instructions.push_back(Instruction::push(token.sourceLocation(), Value::string(token.string())));
 			break;
 		case Token::NUMBER:
-			assert(children.empty());
-			instructions.push_back(Instruction::push(token.sourceLocation(), Value::number(to<int>(token.string()))));
+			{
+				assert(children.empty());
+				const std::string &number = token.string();
+				Value value = is<long long>(number) ? Value::number(to<long long>(number)) : Value::floating(to<double>(number));
+				instructions.push_back(Instruction::push(token.sourceLocation(), value));
+			}
 			break;
 		case Token::KEYWORD:
 			if(!handleLiteral(token, instructions))
@@ -617,8 +638,32 @@ namespace
 	}
 }
 
+namespace
+{
+	// e.g. "defun fib (fib.rasp:3)", for naming the form's trace span
+	std::string describeForm(const Token &form)
+	{
+		std::string description = "form";
+		const Token::Children &children = form.children();
+		if (form.type() == Token::LIST && !children.empty() && children[0].type() == Token::KEYWORD)
+		{
+			description = children[0].string();
+			if (children.size() > 1 && children[1].type() == Token::IDENTIFIER)
+			{
+				description += " " + children[1].string();
+			}
+			else if (children.size() > 1 && children[1].type() == Token::DECLARATION)
+			{
+				description += " " + children[1].children()[0].string();
+			}
+		}
+		return description + " (" + str(form.sourceLocation()) + ")";
+	}
+}
+
 InstructionList parse(const Token &tree, Declarations &declarations, const Settings &settings)
 {
+	AllocationScope allocationScope(ALLOCATION_INSTRUCTIONS);
 	if (settings.printSyntaxTree)
 	{
 		printTree(tree);
@@ -629,7 +674,17 @@ InstructionList parse(const Token &tree, Declarations &declarations, const Setti
 	const Token::Children &children = tree.children();
 	for(Token::Children::const_iterator it = children.begin() ; it != children.end() ; ++it)
 	{
+		TraceSpan span("compile", "parse", traceEventsEnabled() ? describeForm(*it) : std::string());
+		std::size_t start = result.size();
 		parse(*it, declarations, result, settings);
+		// Only a function's own instructions can make it a generator
+		for (std::size_t i = start ; i < result.size() ; ++i)
+		{
+			if (result[i].type() == Instruction::YIELD)
+			{
+				throw ParseError(result[i].sourceLocation(), "Keyword 'yield' can only be used inside a defun");
+			}
+		}
 	}
 
 	if (settings.printInstructions)
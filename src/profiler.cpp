@@ -0,0 +1,176 @@
+#include "profiler.h"
+
+#include <map>
+#include <vector>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <algorithm>
+
+namespace
+{
+	double milliseconds(long long nanoseconds)
+	{
+		return nanoseconds / 1e6;
+	}
+
+	double percentage(long long part, long long total)
+	{
+		return total == 0 ? 0 : 100.0 * part / total;
+	}
+
+	// The text of a line, for files that can still be read
+	class SourceLines
+	{
+	public:
+		const std::string &line(const std::string &filename, unsigned line)
+		{
+			Files::iterator it = files_.find(filename);
+			if (it == files_.end())
+			{
+				it = files_.insert(std::make_pair(filename, read(filename))).first;
+			}
+			const std::vector<std::string> &lines = it->second;
+			static const std::string unknown;
+			return (line >= 1 && line <= lines.size()) ? lines[line - 1] : unknown;
+		}
+
+	private:
+		static std::vector<std::string> read(const std::string &filename)
+		{
+			std::vector<std::string> lines;
+			std::ifstream file(filename.c_str());
+			std::string line;
+			while (std::getline(file, line))
+			{
+				std::string::size_type start = line.find_first_not_of(" \t");
+				lines.push_back(start == std::string::npos ? "" : line.substr(start));
+			}
+			return lines;
+		}
+
+		typedef std::map<std::string, std::vector<std::string>> Files;
+		Files files_;
+	};
+}
+
+Profiler::Profiler()
+:
+	lastLineCounters_(nullptr),
+	lastOpcodeCounters_(nullptr)
+{
+	lastLine_.filename = nullptr;
+	lastLine_.line = 0;
+}
+
+void Profiler::charge(Clock::time_point now)
+{
+	if (lastOpcodeCounters_)
+	{
+		long long elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(now - lastStart_).count();
+		lastOpcodeCounters_->nanoseconds += elapsed;
+		lastLineCounters_->nanoseconds += elapsed;
+	}
+}
+
+void Profiler::enter(const Instruction &instruction)
+{
+	Clock::time_point now = Clock::now();
+	charge(now);
+	lastStart_ = now;
+
+	lastOpcodeCounters_ = &opcodes_[instruction.type()];
+	++lastOpcodeCounters_->executions;
+
+	const SourceLocation &sourceLocation = instruction.sourceLocation();
+	if (!lastLineCounters_ || lastLine_.line != sourceLocation.line() || lastLine_.filename != &sourceLocation.filename())
+	{
+		lastLine_.filename = &sourceLocation.filename();
+		lastLine_.line = sourceLocation.line();
+		// References to unordered_map elements survive rehashing
+		lastLineCounters_ = &lines_[lastLine_];
+	}
+	++lastLineCounters_->executions;
+}
+
+unsigned long long Profiler::executions(Instruction::Type type) const
+{
+	return opcodes_[type].executions;
+}
+
+unsigned long long Profiler::executions(const SourceLocation &sourceLocation) const
+{
+	Line line = { &sourceLocation.filename(), sourceLocation.line() };
+	Lines::const_iterator it = lines_.find(line);
+	return it == lines_.end() ? 0 : it->second.executions;
+}
+
+void Profiler::report(std::ostream &out, unsigned hotLines)
+{
+	// The last instruction executed ends now
+	charge(Clock::now());
+	lastOpcodeCounters_ = nullptr;
+	lastLineCounters_ = nullptr;
+
+	unsigned long long executions = 0;
+	long long total = 0;
+	std::vector<Instruction::Type> types;
+	for (int i = 0 ; i < Instruction::TYPE_COUNT ; ++i)
+	{
+		executions += opcodes_[i].executions;
+		total += opcodes_[i].nanoseconds;
+		if (opcodes_[i].executions > 0)
+		{
+			types.push_back(static_cast<Instruction::Type>(i));
+		}
+	}
+	std::sort(types.begin(), types.end(), [this](Instruction::Type a, Instruction::Type b) {
+		return opcodes_[a].nanoseconds > opcodes_[b].nanoseconds;
+	});
+
+	std::ios::fmtflags flags = out.flags();
+	out << std::fixed << std::setprecision(2);
+	out << "Profile: " << executions << " instructions in " << milliseconds(total) << " ms\n";
+	out << '\n';
+	out << std::left << std::setw(16) << "opcode" << std::right << std::setw(14) << "executions" << std::setw(12) << "ms" << std::setw(8) << "%" << std::setw(10) << "ns/op" << '\n';
+	for (Instruction::Type type : types)
+	{
+		const Counters &counters = opcodes_[type];
+		out << std::left << std::setw(16) << Instruction::typeName(type) << std::right;
+		out << std::setw(14) << counters.executions;
+		out << std::setw(12) << milliseconds(counters.nanoseconds);
+		out << std::setw(8) << percentage(counters.nanoseconds, total);
+		out << std::setw(10) << static_cast<double>(counters.nanoseconds) / counters.executions << '\n';
+	}
+
+	std::vector<Lines::const_iterator> lines;
+	for (Lines::const_iterator it = lines_.begin() ; it != lines_.end() ; ++it)
+	{
+		lines.push_back(it);
+	}
+	std::size_t shown = std::min<std::size_t>(hotLines, lines.size());
+	std::partial_sort(lines.begin(), lines.begin() + shown, lines.end(), [](Lines::const_iterator a, Lines::const_iterator b) {
+		return a->second.nanoseconds > b->second.nanoseconds;
+	});
+
+	out << '\n';
+	out << "Hottest " << shown << " of " << lines.size() << " lines:\n";
+	out << std::setw(12) << "ms" << std::setw(8) << "%" << std::setw(14) << "executions" << "  location\n";
+	SourceLines source;
+	for (std::size_t i = 0 ; i < shown ; ++i)
+	{
+		const Line &line = lines[i]->first;
+		const Counters &counters = lines[i]->second;
+		out << std::setw(12) << milliseconds(counters.nanoseconds);
+		out << std::setw(8) << percentage(counters.nanoseconds, total);
+		out << std::setw(14) << counters.executions;
+		out << "  " << *line.filename << ":" << line.line;
+		const std::string &text = source.line(*line.filename, line.line);
+		if (!text.empty())
+		{
+			out << "  " << text;
+		}
+		out << '\n';
+	}
+	out.flags(flags);
+}
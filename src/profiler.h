@@ -0,0 +1,83 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <chrono>
+#include <iosfwd>
+#include <string>
+#include <unordered_map>
+
+#include "instruction.h"
+#include "source_location.h"
+
+// Counts executions, and accumulates time, per opcode and per source line.
+// Each instruction is charged the time until the next one starts, so a call
+// to a builtin is charged to its CALL, while a call to a rasp function is
+// charged to the function's own instructions.
+class Profiler
+{
+public:
+	Profiler();
+
+	// Called by the interpreter before executing each instruction
+	void enter(const Instruction &instruction);
+
+	unsigned long long executions(Instruction::Type type) const;
+
+	unsigned long long executions(const SourceLocation &sourceLocation) const;
+
+	// Prints the opcodes, then the hottest lines, most time first
+	void report(std::ostream &out, unsigned hotLines = 20);
+
+private:
+	// Deliberately private & unimplemented
+	Profiler(const Profiler &);
+	Profiler &operator=(const Profiler &);
+
+	typedef std::chrono::steady_clock Clock;
+
+	struct Counters
+	{
+		Counters() : executions(0), nanoseconds(0)
+		{
+		}
+
+		unsigned long long executions;
+		long long nanoseconds;
+	};
+
+	// Filenames are interned, so compared by address
+	struct Line
+	{
+		const std::string *filename;
+		unsigned line;
+
+		bool operator==(const Line &other) const
+		{
+			return filename == other.filename && line == other.line;
+		}
+	};
+
+	struct LineHash
+	{
+		std::size_t operator()(const Line &line) const
+		{
+			return std::hash<const std::string *>()(line.filename) * 31 + line.line;
+		}
+	};
+
+	typedef std::unordered_map<Line, Counters, LineHash> Lines;
+
+	// Charges the time since the last instruction started to it
+	void charge(Clock::time_point now);
+
+	Counters opcodes_[Instruction::TYPE_COUNT];
+	Lines lines_;
+
+	// Consecutive instructions are usually on the same line
+	Line lastLine_;
+	Counters *lastLineCounters_;
+	Counters *lastOpcodeCounters_;
+	Clock::time_point lastStart_;
+};
+
+#endif
@@ -2,31 +2,201 @@
 
 #include <string>
 #include <iostream>
+#include <unordered_map>
 
 #include "lexer.h"
 #include "parser.h"
 #include "exceptions.h"
 #include "interpreter.h"
+#include "global_names.h"
 #include "execution_error.h"
 
+namespace
+{
+	// Tracks whether the input so far forms complete expressions, so
+	// definitions can be entered or pasted over several lines
+	class InputBalance
+	{
+	public:
+		InputBalance()
+		:
+			depth_(0),
+			inString_(false),
+			inComment_(false)
+		{
+		}
+
+		void feed(const std::string &line)
+		{
+			bool escape = false;
+			for (std::string::size_type i = 0 ; i < line.size() ; ++i)
+			{
+				char c = line[i];
+				char next = (i + 1 < line.size()) ? line[i + 1] : '\0';
+				if (inComment_)
+				{
+					if (c == '*' && next == '/')
+					{
+						inComment_ = false;
+						++i;
+					}
+				}
+				else if (inString_)
+				{
+					if (escape)
+					{
+						escape = false;
+					}
+					else if (c == '\\')
+					{
+						escape = true;
+					}
+					else if (c == '"')
+					{
+						inString_ = false;
+					}
+				}
+				else if (c == '/' && next == '/')
+				{
+					break;
+				}
+				else if (c == '/' && next == '*')
+				{
+					inComment_ = true;
+					++i;
+				}
+				else if (c == '"')
+				{
+					inString_ = true;
+				}
+				else if (c == '(')
+				{
+					++depth_;
+				}
+				else if (c == ')')
+				{
+					--depth_;
+				}
+			}
+		}
+
+		// A stray ) also counts as complete, for the lexer to report
+		bool complete() const
+		{
+			return depth_ <= 0 && !inString_ && !inComment_;
+		}
+
+	private:
+		int depth_;
+		bool inString_;
+		bool inComment_;
+	};
+
+	// Expressions typed again (e.g. re-running a call while debugging)
+	// skip the front end, for as long as the globals they use are unchanged
+	class CompiledInputCache
+	{
+	public:
+		bool find(const std::string &input, const Interpreter &interpreter, InstructionList &instructions) const
+		{
+			Entries::const_iterator it = entries_.find(input);
+			if (it == entries_.end() || !it->second.names.consistentWith(interpreter))
+			{
+				return false;
+			}
+			instructions = it->second.instructions;
+			return true;
+		}
+
+		void insert(const std::string &input, const InstructionList &instructions)
+		{
+			for (const Instruction &instruction : instructions)
+			{
+				if (instruction.type() == Instruction::INIT_GLOBAL)
+				{
+					// Cannot succeed a second time anyway
+					return;
+				}
+			}
+
+			if (entries_.size() >= MAX_ENTRIES)
+			{
+				entries_.clear();
+			}
+			Entry &entry = entries_[input];
+			entry.instructions = instructions;
+			entry.names = GlobalNames(instructions);
+		}
+
+	private:
+		static const std::size_t MAX_ENTRIES = 1024;
+
+		struct Entry
+		{
+			InstructionList instructions;
+			GlobalNames names;
+		};
+
+		typedef std::unordered_map<std::string, Entry> Entries;
+		Entries entries_;
+	};
+
+	// Globals declared by the input, but never defined. For example after an
+	// execution error, or a (var ...) in a branch that was not taken.
+	bool declaredAllGlobals(const InstructionList &instructions, const Interpreter &interpreter)
+	{
+		for (const Instruction &instruction : instructions)
+		{
+			if (instruction.type() == Instruction::INIT_GLOBAL && !interpreter.global(Identifier(instruction.value().string())))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+}
+
 void repl(Interpreter &interpreter, const Settings &settings)
 {
 	std::cout << "Enter some code, or type \'exit\' when finished:\n";
 	std::string line;
 	int count = 0;
+
+	// Kept in step with the globals, rather than rebuilt for every input
+	Declarations declarations = interpreter.declarations();
+	CompiledInputCache cache;
+
 	while((std::cout << " > ") && std::getline(std::cin, line) && !(line == "quit" || line == "exit"))
 	{
 		++count;
+		std::string input = line;
+		InputBalance balance;
+		balance.feed(line);
+		while (!balance.complete() && (std::cout << " . ") && std::getline(std::cin, line))
+		{
+			input += '\n';
+			input += line;
+			balance.feed(line);
+		}
+
+		bool synchronised = false;
 		try
 		{
-			Token token = lex("repl(" + str(count) + ")", line);
-			Declarations declarations = interpreter.declarations();
-			InstructionList instructions = parse(token, declarations, settings);
+			InstructionList instructions;
+			if (!cache.find(input, interpreter, instructions))
+			{
+				Token token = lex("repl(" + str(count) + ")", input);
+				instructions = parse(token, declarations, settings);
+				cache.insert(input, instructions);
+			}
+
 			if (!instructions.empty())
 			{
 				Value result = interpreter.exec(instructions);
+				interpreter.output().flush();
 				std::cout << " < " << result << std::endl;
 			}
+			synchronised = declaredAllGlobals(instructions, interpreter);
 		}
 		catch(const LexError &e)
 		{
@@ -52,8 +222,13 @@ void repl(Interpreter &interpreter, const Settings &settings)
 		{
 			std::cerr << "Internal Error: " << error.what() << std::endl;
 		}
+
+		if (!synchronised)
+		{
+			// The parser may have declared names that never became globals
+			declarations = interpreter.declarations();
+		}
 	}
 	// If you use CTRL-D, nice to output a newline...
 	std::cout << '\n';
 }
-
@@ -0,0 +1,412 @@
+#include "sampling_profiler.h"
+
+#include <map>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+namespace
+{
+	// Only one profiler runs at a time, the handler has no other way to find it
+	SamplingProfiler *volatile running = nullptr;
+
+	// Encodes the subset of protocol buffers used by profile.proto
+	class ProtobufWriter
+	{
+	public:
+		void writeUnsigned(int field, unsigned long long number)
+		{
+			writeTag(field, 0);
+			writeVarint(number);
+		}
+
+		void writeString(int field, const std::string &text)
+		{
+			writeTag(field, 2);
+			writeVarint(text.size());
+			buffer_ += text;
+		}
+
+		void writeMessage(int field, const ProtobufWriter &message)
+		{
+			writeString(field, message.buffer_);
+		}
+
+		void writePacked(int field, const std::vector<unsigned long long> &numbers)
+		{
+			ProtobufWriter packed;
+			for (unsigned long long number : numbers)
+			{
+				packed.writeVarint(number);
+			}
+			writeString(field, packed.buffer_);
+		}
+
+		const std::string &buffer() const
+		{
+			return buffer_;
+		}
+
+	private:
+		void writeTag(int field, int wireType)
+		{
+			writeVarint((field << 3) | wireType);
+		}
+
+		void writeVarint(unsigned long long number)
+		{
+			while (number >= 0x80)
+			{
+				buffer_ += static_cast<char>((number & 0x7f) | 0x80);
+				number >>= 7;
+			}
+			buffer_ += static_cast<char>(number);
+		}
+
+		std::string buffer_;
+	};
+
+	class StringTable
+	{
+	public:
+		StringTable()
+		{
+			// Index 0 is always the empty string
+			index("");
+		}
+
+		unsigned long long index(const std::string &text)
+		{
+			std::map<std::string, unsigned long long>::const_iterator it = indices_.find(text);
+			if (it != indices_.end())
+			{
+				return it->second;
+			}
+			indices_[text] = strings_.size();
+			strings_.push_back(text);
+			return strings_.size() - 1;
+		}
+
+		const std::vector<std::string> &strings() const
+		{
+			return strings_;
+		}
+
+	private:
+		std::map<std::string, unsigned long long> indices_;
+		std::vector<std::string> strings_;
+	};
+
+	const char TOP_LEVEL[] = "(toplevel)";
+}
+
+SamplingProfiler::SamplingProfiler(unsigned hertz)
+:
+	hertz_(hertz),
+	running_(false),
+	timer_(),
+	depth_(0),
+	sampledFrames_(MAX_SAMPLED_FRAMES),
+	sampleDepths_(MAX_SAMPLES),
+	frameCount_(0),
+	sampleCount_(0),
+	dropped_(0)
+{
+}
+
+SamplingProfiler::~SamplingProfiler()
+{
+	stop();
+}
+
+bool SamplingProfiler::start()
+{
+	if (running || hertz_ == 0)
+	{
+		return false;
+	}
+
+	struct sigaction action;
+	std::memset(&action, 0, sizeof(action));
+	action.sa_handler = &SamplingProfiler::handleSignal;
+	action.sa_flags = SA_RESTART;
+	sigemptyset(&action.sa_mask);
+	if (sigaction(SIGPROF, &action, &previousAction_) != 0)
+	{
+		return false;
+	}
+
+	// Signals this thread only, as it is the one maintaining the shadow stack
+	struct sigevent event;
+	std::memset(&event, 0, sizeof(event));
+	event.sigev_notify = SIGEV_THREAD_ID;
+	event.sigev_signo = SIGPROF;
+	event._sigev_un._tid = syscall(SYS_gettid);
+	if (timer_create(CLOCK_THREAD_CPUTIME_ID, &event, &timer_) != 0)
+	{
+		sigaction(SIGPROF, &previousAction_, nullptr);
+		return false;
+	}
+
+	running = this;
+	running_ = true;
+	long interval = 1000000000L / hertz_;
+	struct itimerspec period;
+	period.it_interval.tv_sec = interval / 1000000000L;
+	period.it_interval.tv_nsec = interval % 1000000000L;
+	period.it_value = period.it_interval;
+	if (timer_settime(timer_, 0, &period, nullptr) != 0)
+	{
+		stop();
+		return false;
+	}
+	return true;
+}
+
+void SamplingProfiler::stop()
+{
+	if (!running_)
+	{
+		return;
+	}
+	timer_delete(timer_);
+	sigaction(SIGPROF, &previousAction_, nullptr);
+	running = nullptr;
+	running_ = false;
+}
+
+void SamplingProfiler::handleSignal(int)
+{
+	SamplingProfiler *profiler = running;
+	if (profiler)
+	{
+		profiler->sample();
+	}
+}
+
+// Async signal safe: copies into the buffers allocated up front
+void SamplingProfiler::sample()
+{
+	int current = depth_;
+	std::size_t depth = current < MAX_DEPTH ? current : MAX_DEPTH;
+	if (sampleCount_ == MAX_SAMPLES || frameCount_ + depth > MAX_SAMPLED_FRAMES)
+	{
+		dropped_ = dropped_ + 1;
+		return;
+	}
+	std::size_t start = frameCount_;
+	for (std::size_t i = 0 ; i < depth ; ++i)
+	{
+		frames_[i].sampled = 1;
+		sampledFrames_[start + i] = frames_[i].key;
+	}
+	sampleDepths_[sampleCount_] = depth;
+	frameCount_ = start + depth;
+	sampleCount_ = sampleCount_ + 1;
+}
+
+void SamplingProfiler::name(const Frame &frame)
+{
+	if (names_.find(frame.key) == names_.end())
+	{
+		names_[frame.key] = frame.function->name();
+	}
+}
+
+std::string SamplingProfiler::nameOf(const Key &key) const
+{
+	if (!key.filename)
+	{
+		return TOP_LEVEL;
+	}
+	std::unordered_map<Key, std::string, KeyHash>::const_iterator it = names_.find(key);
+	if (it != names_.end())
+	{
+		return it->second;
+	}
+	// Still on the stack when the profile was written
+	return *key.filename + ":" + std::to_string(key.line);
+}
+
+unsigned long long SamplingProfiler::samples() const
+{
+	return sampleCount_;
+}
+
+// Each distinct stack with its number of samples, the top level first
+std::vector<std::pair<SamplingProfiler::Stack, unsigned long long>> SamplingProfiler::stacks() const
+{
+	struct Less
+	{
+		bool operator()(const Stack &a, const Stack &b) const
+		{
+			return std::lexicographical_compare(a.begin(), a.end(), b.begin(), b.end(), [](const Key &x, const Key &y) {
+				return x.filename != y.filename ? std::less<const std::string *>()(x.filename, y.filename) : x.line < y.line;
+			});
+		}
+	};
+
+	std::map<Stack, unsigned long long, Less> counts;
+	std::size_t offset = 0;
+	for (std::size_t i = 0 ; i < sampleCount_ ; ++i)
+	{
+		Key topLevel = { nullptr, 0 };
+		Stack stack(1, topLevel);
+		stack.insert(stack.end(), sampledFrames_.begin() + offset, sampledFrames_.begin() + offset + sampleDepths_[i]);
+		offset += sampleDepths_[i];
+		++counts[stack];
+	}
+	return std::vector<std::pair<Stack, unsigned long long>>(counts.begin(), counts.end());
+}
+
+void SamplingProfiler::writeFoldedStacks(std::ostream &out) const
+{
+	for (const std::pair<Stack, unsigned long long> &entry : stacks())
+	{
+		const Stack &stack = entry.first;
+		for (std::size_t i = 0 ; i < stack.size() ; ++i)
+		{
+			out << (i == 0 ? "" : ";") << nameOf(stack[i]);
+		}
+		out << ' ' << entry.second << '\n';
+	}
+}
+
+void SamplingProfiler::writePprof(std::ostream &out) const
+{
+	long long period = 1000000000LL / hertz_;
+	StringTable strings;
+	ProtobufWriter profile;
+
+	ProtobufWriter samplesType;
+	samplesType.writeUnsigned(1, strings.index("samples"));
+	samplesType.writeUnsigned(2, strings.index("count"));
+	profile.writeMessage(1, samplesType);
+	ProtobufWriter cpuType;
+	cpuType.writeUnsigned(1, strings.index("cpu"));
+	cpuType.writeUnsigned(2, strings.index("nanoseconds"));
+	profile.writeMessage(1, cpuType);
+
+	// A function and a location for each function, with the same ids
+	std::unordered_map<Key, unsigned long long, KeyHash> ids;
+	std::vector<Key> keys;
+	for (const std::pair<Stack, unsigned long long> &entry : stacks())
+	{
+		std::vector<unsigned long long> locations;
+		const Stack &stack = entry.first;
+		for (Stack::const_reverse_iterator it = stack.rbegin() ; it != stack.rend() ; ++it)
+		{
+			unsigned long long &id = ids[*it];
+			if (id == 0)
+			{
+				keys.push_back(*it);
+				id = keys.size();
+			}
+			locations.push_back(id);
+		}
+
+		ProtobufWriter sample;
+		sample.writePacked(1, locations);
+		std::vector<unsigned long long> values;
+		values.push_back(entry.second);
+		values.push_back(entry.second * period);
+		sample.writePacked(2, values);
+		profile.writeMessage(2, sample);
+	}
+
+	for (std::size_t i = 0 ; i < keys.size() ; ++i)
+	{
+		const Key &key = keys[i];
+		ProtobufWriter line;
+		line.writeUnsigned(1, i + 1);
+		line.writeUnsigned(2, key.line);
+		ProtobufWriter location;
+		location.writeUnsigned(1, i + 1);
+		location.writeMessage(4, line);
+		profile.writeMessage(4, location);
+	}
+
+	for (std::size_t i = 0 ; i < keys.size() ; ++i)
+	{
+		const Key &key = keys[i];
+		std::string name = nameOf(key);
+		ProtobufWriter function;
+		function.writeUnsigned(1, i + 1);
+		function.writeUnsigned(2, strings.index(name));
+		function.writeUnsigned(3, strings.index(name));
+		function.writeUnsigned(4, strings.index(key.filename ? *key.filename : ""));
+		function.writeUnsigned(5, key.line);
+		profile.writeMessage(5, function);
+	}
+
+	// The strings are only complete now, but may follow the messages using them
+	for (const std::string &text : strings.strings())
+	{
+		profile.writeString(6, text);
+	}
+	profile.writeUnsigned(10, sampleCount_ * period);
+	ProtobufWriter periodType;
+	periodType.writeUnsigned(1, strings.index("cpu"));
+	periodType.writeUnsigned(2, strings.index("nanoseconds"));
+	profile.writeMessage(11, periodType);
+	profile.writeUnsigned(12, period);
+
+	out << profile.buffer();
+}
+
+void SamplingProfiler::report(std::ostream &out, unsigned functions) const
+{
+	std::unordered_map<Key, unsigned long long, KeyHash> exclusive;
+	std::unordered_map<Key, unsigned long long, KeyHash> inclusive;
+	for (const std::pair<Stack, unsigned long long> &entry : stacks())
+	{
+		const Stack &stack = entry.first;
+		exclusive[stack.back()] += entry.second;
+		// Recursive functions count once per sample
+		Stack distinct;
+		for (const Key &key : stack)
+		{
+			if (std::find(distinct.begin(), distinct.end(), key) == distinct.end())
+			{
+				distinct.push_back(key);
+				inclusive[key] += entry.second;
+			}
+		}
+	}
+
+	std::vector<Key> keys;
+	for (const auto &entry : inclusive)
+	{
+		keys.push_back(entry.first);
+	}
+	std::sort(keys.begin(), keys.end(), [&](const Key &a, const Key &b) {
+		return exclusive[a] != exclusive[b] ? exclusive[a] > exclusive[b] : inclusive[a] > inclusive[b];
+	});
+	keys.resize(std::min<std::size_t>(keys.size(), functions));
+
+	std::ios::fmtflags flags = out.flags();
+	out << "Sampled " << sampleCount_ << " times at " << hertz_ << " Hz";
+	if (dropped_)
+	{
+		out << ", dropping " << dropped_ << " samples once the buffers were full";
+	}
+	out << '\n';
+	out << std::fixed << std::setprecision(1);
+	out << std::setw(12) << "exclusive %" << std::setw(13) << "inclusive %" << "  function\n";
+	double total = sampleCount_ ? sampleCount_ : 1;
+	for (const Key &key : keys)
+	{
+		out << std::setw(12) << 100 * exclusive[key] / total;
+		out << std::setw(13) << 100 * inclusive[key] / total;
+		out << "  " << nameOf(key);
+		if (key.filename)
+		{
+			out << " (" << *key.filename << ":" << key.line << ")";
+		}
+		out << '\n';
+	}
+	out.flags(flags);
+}
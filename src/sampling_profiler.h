@@ -0,0 +1,161 @@
+#ifndef SAMPLING_PROFILER_H
+#define SAMPLING_PROFILER_H
+
+#include <atomic>
+#include <csignal>
+#include <iosfwd>
+#include <string>
+#include <vector>
+#include <time.h>
+#include <unordered_map>
+
+#include "function.h"
+
+// Samples the stack of rasp functions being called, including builtins,
+// from a SIGPROF timer on the thread's CPU time. The interpreter maintains
+// the stack cheaply as a shadow stack, see SampledCall.
+class SamplingProfiler
+{
+public:
+	explicit SamplingProfiler(unsigned hertz);
+	~SamplingProfiler();
+
+	// Samples the calling thread until stopped. Only one profiler can be
+	// running at a time.
+	bool start();
+	void stop();
+
+	void push(const Function &function)
+	{
+		if (depth_ < MAX_DEPTH)
+		{
+			Frame &frame = frames_[depth_];
+			const SourceLocation &sourceLocation = function.sourceLocation();
+			frame.function = &function;
+			frame.key.filename = &sourceLocation.filename();
+			frame.key.line = sourceLocation.line();
+			frame.sampled = 0;
+		}
+		// The frame is complete before the signal handler can see it
+		std::atomic_signal_fence(std::memory_order_seq_cst);
+		depth_ = depth_ + 1;
+	}
+
+	void pop()
+	{
+		depth_ = depth_ - 1;
+		std::atomic_signal_fence(std::memory_order_seq_cst);
+		if (depth_ < MAX_DEPTH && frames_[depth_].sampled)
+		{
+			// Named now, the handler cannot copy strings
+			name(frames_[depth_]);
+		}
+	}
+
+	unsigned long long samples() const;
+
+	// One line per distinct stack, root first, for flamegraph.pl
+	void writeFoldedStacks(std::ostream &out) const;
+
+	// The profile.proto format read by pprof, uncompressed
+	void writePprof(std::ostream &out) const;
+
+	// Exclusive and inclusive samples of the functions with most samples
+	void report(std::ostream &out, unsigned functions = 10) const;
+
+private:
+	// Deliberately private & unimplemented
+	SamplingProfiler(const SamplingProfiler &);
+	SamplingProfiler &operator=(const SamplingProfiler &);
+
+	static const int MAX_DEPTH = 4096;
+	static const std::size_t MAX_SAMPLES = 1 << 18;
+	static const std::size_t MAX_SAMPLED_FRAMES = 1 << 20;
+
+	// Functions are identified by where they are defined, as the
+	// Function objects themselves are copied and destroyed freely
+	struct Key
+	{
+		const std::string *filename;
+		unsigned line;
+
+		bool operator==(const Key &other) const
+		{
+			return filename == other.filename && line == other.line;
+		}
+	};
+
+	struct KeyHash
+	{
+		std::size_t operator()(const Key &key) const
+		{
+			return std::hash<const std::string *>()(key.filename) * 31 + key.line;
+		}
+	};
+
+	struct Frame
+	{
+		const Function *function;
+		Key key;
+		volatile std::sig_atomic_t sampled;
+	};
+
+	typedef std::vector<Key> Stack;
+
+	static void handleSignal(int);
+	void sample();
+	void name(const Frame &frame);
+	std::string nameOf(const Key &key) const;
+	std::vector<std::pair<Stack, unsigned long long>> stacks() const;
+
+	unsigned hertz_;
+	bool running_;
+	timer_t timer_;
+	struct sigaction previousAction_;
+
+	// Written by push() and pop(), read by the handler
+	Frame frames_[MAX_DEPTH];
+	volatile int depth_;
+
+	// Written by the handler, read once stopped
+	std::vector<Key> sampledFrames_;
+	std::vector<unsigned> sampleDepths_;
+	volatile std::size_t frameCount_;
+	volatile std::size_t sampleCount_;
+	volatile unsigned long long dropped_;
+
+	std::unordered_map<Key, std::string, KeyHash> names_;
+};
+
+// Pushes a function on the profiler's shadow stack for the duration of the
+// call, if there is a profiler
+class SampledCall
+{
+public:
+	SampledCall(SamplingProfiler *profiler, const Function &function)
+	:
+		profiler_(profiler)
+	{
+		if (profiler_)
+		{
+			profiler_->push(function);
+		}
+	}
+
+	~SampledCall()
+	{
+		if (profiler_)
+		{
+			profiler_->pop();
+		}
+	}
+
+private:
+	// Deliberately private & unimplemented
+	SampledCall(const SampledCall &);
+	SampledCall &operator=(const SampledCall &);
+
+	SamplingProfiler *profiler_;
+};
+
+#endif
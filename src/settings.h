@@ -1,22 +1,54 @@
 #ifndef SETTINGS_H
 #define SETTINGS_H
 
+#include <string>
+
 class Settings
 {
 public:
 	bool repl;
 	bool trace;
+	bool profile;
+	unsigned profileSampleHertz;
+	bool memStats;
 	bool unitTests;
 	bool printSyntaxTree;
 	bool printInstructions;
+	bool bytecodeCache;
+	unsigned jobs;
+	// Isolates running files at a time, or 0 to run them in one interpreter
+	unsigned threads;
+	// Threads for parallel_map and async tasks, or 0 for one per core
+	unsigned workers;
+	unsigned benchRuns;
+	bool benchScaling;
+	std::string cacheDirectory;
+	std::string libraryImageSource;
+	std::string snapshot;
+	std::string fromSnapshot;
+	std::string traceBuffer;
+	std::string decodeTrace;
+	std::string traceEvents;
+	// Where print writes, or -1 to discard it
+	int outputFd;
 
 	Settings() 
 	:
 		repl(false),
 		trace(false),
+		profile(false),
+		profileSampleHertz(0),
+		memStats(false),
 		unitTests(false),
 		printSyntaxTree(false),
-		printInstructions(false)
+		printInstructions(false),
+		bytecodeCache(true),
+		jobs(1),
+		threads(0),
+		workers(0),
+		benchRuns(0),
+		benchScaling(false),
+		outputFd(1)
 	{
 	}
 };
@@ -0,0 +1,76 @@
+#include "snapshot.h"
+
+#include <fstream>
+#include <iostream>
+
+#include "bytecode.h"
+#include "mapped_file.h"
+
+namespace
+{
+	const std::string MAGIC = "RASPS";
+}
+
+bool writeSnapshot(const Interpreter::Globals &globals, const std::string &filename)
+{
+	BytecodeWriter writer;
+	try
+	{
+		writer.writeUnsigned(BYTECODE_VERSION);
+		writer.writeBindings(globals);
+	}
+	catch (const BytecodeError &e)
+	{
+		std::cerr << "Failed to snapshot globals: " << e.what() << '\n';
+		return false;
+	}
+
+	std::ofstream file(filename.c_str(), std::ios::binary | std::ios::trunc);
+	file << MAGIC << writer.buffer();
+	if (!file.flush())
+	{
+		std::cerr << "Failed to write snapshot " << filename << '\n';
+		return false;
+	}
+	return true;
+}
+
+bool readSnapshot(const std::string &filename, const Interpreter::Globals &builtins, Interpreter::Globals &globals)
+{
+	MappedFile file(filename);
+	if (!file.isOpen())
+	{
+		std::cerr << "Failed to load snapshot " << filename << '\n';
+		return false;
+	}
+
+	if (file.size() < MAGIC.size() || MAGIC.compare(0, MAGIC.size(), file.begin(), MAGIC.size()) != 0)
+	{
+		std::cerr << "Not a snapshot: " << filename << '\n';
+		return false;
+	}
+
+	try
+	{
+		BytecodeReader reader(file.begin() + MAGIC.size(), file.end());
+		reader.resolveExternalFunctionsFrom(&builtins);
+		unsigned long long version = reader.readUnsigned();
+		if (version != BYTECODE_VERSION)
+		{
+			std::cerr << "Snapshot " << filename << " has version " << version << ", expected " << BYTECODE_VERSION << '\n';
+			return false;
+		}
+		Interpreter::Globals result = reader.readBindings();
+		if (!reader.atEnd())
+		{
+			throw BytecodeError("Unexpected data after globals");
+		}
+		globals.swap(result);
+		return true;
+	}
+	catch (const BytecodeError &e)
+	{
+		std::cerr << "Snapshot " << filename << " is corrupt: " << e.what() << '\n';
+		return false;
+	}
+}
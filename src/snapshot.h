@@ -0,0 +1,14 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <string>
+
+#include "interpreter.h"
+
+// Saves the globals of an initialised interpreter, e.g. after running a prelude
+bool writeSnapshot(const Interpreter::Globals &globals, const std::string &filename);
+
+// External functions in the snapshot are resolved against the builtins
+bool readSnapshot(const std::string &filename, const Interpreter::Globals &builtins, Interpreter::Globals &globals);
+
+#endif
@@ -1,11 +1,26 @@
 #include "source_location.h"
 
+#include <set>
+#include <mutex>
 #include <iostream>
 
+namespace
+{
+	const std::string *intern(const std::string &filename)
+	{
+		// Never shrinks, a program only ever sees a handful of filenames
+		static std::set<std::string> filenames;
+		// Files may be lexed on several threads
+		static std::mutex mutex;
+		std::lock_guard<std::mutex> lock(mutex);
+		return &*filenames.insert(filename).first;
+	}
+}
+
 SourceLocation::SourceLocation(const std::string &filename, unsigned line)
 :
 	line_(line),
-	filename_(filename)
+	filename_(intern(filename))
 {
 }
 
@@ -14,8 +29,20 @@ unsigned SourceLocation::line() const
 	return line_;
 }
 
+const std::string &SourceLocation::filename() const
+{
+	return *filename_;
+}
+
+SourceLocation SourceLocation::atLine(unsigned line) const
+{
+	SourceLocation result = *this;
+	result.line_ = line;
+	return result;
+}
+
 std::ostream &operator<<(std::ostream &out, const SourceLocation &sourceLocation)
 {
-	return out << sourceLocation.filename_ << ":" << sourceLocation.line_;
+	return out << *sourceLocation.filename_ << ":" << sourceLocation.line_;
 }
 
@@ -11,10 +11,16 @@ public:
 
 	unsigned line() const;
 
+	const std::string &filename() const;
+
+	// Same file, without interning the filename again
+	SourceLocation atLine(unsigned line) const;
+
     friend std::ostream &operator<<(std::ostream &out, const SourceLocation &);
 private:
 	unsigned line_;
-	std::string filename_;
+	// Interned, so copying a location never copies the filename
+	const std::string *filename_;
 };
 
 #define CURRENT_SOURCE_LOCATION SourceLocation(__FILE__, __LINE__)
@@ -1,9 +1,23 @@
 #include "standard_library.h"
 
 #include <ctime>
+#include <cerrno>
+#include <cstring>
+#include <new>
+#include <random>
 #include <iostream>
 
 #include "api.h"
+#include "async_task.h"
+#include "channel.h"
+#include "event_loop.h"
+#include "file_lines.h"
+#include "isolate.h"
+#include "iterator.h"
+#include "parallel.h"
+#include "interpreter.h"
+#include "allocations.h"
+#include "array_kernels.h"
 #include "standard_library_error.h"
 #include "type_definition.h"
 
@@ -36,6 +50,9 @@ namespace
 		case Value::TNumber:
 			out << value.number();
 			break;
+		case Value::TFloat:
+			out << value;
+			break;
 		case Value::TBoolean:
 			out << (value.boolean() ? "true" : "false");
 			break;
@@ -56,23 +73,38 @@ namespace
 
 namespace
 {
-	Value print(const Arguments &arguments)
+	Value print(CallContext &callContext)
+	{
+		print_to_stream(callContext.interpreter()->output().stream(), callContext.arguments(), &formattingUnsupported);
+		return Value::nil();
+	}
+
+	Value println(CallContext &callContext)
 	{
-	  print_to_stream(std::cout, arguments, &formattingUnsupported);
+		std::ostream &out = callContext.interpreter()->output().stream();
+		print_to_stream(out, callContext.arguments(), &formattingUnsupported);
+		out << '\n';
 		return Value::nil();
 	}
 
-	Value println(const Arguments &arguments)
+	Value debug(CallContext &callContext)
 	{
-		print_to_stream(std::cout, arguments, &formattingUnsupported);
-		std::cout << '\n';
+		std::ostream &out = callContext.interpreter()->output().stream();
+		print_to_stream(out, callContext.arguments(), &debugFormatting);
+		out << '\n';
 		return Value::nil();
 	}
 
-	Value debug(const Arguments &arguments)
+	Value flush(CallContext &callContext)
 	{
-		print_to_stream(std::cout, arguments, &debugFormatting);
-		std::cout << '\n';
+		if(!callContext.arguments().empty())
+		{
+			throw ExternalFunctionError("Expected no arguments");
+		}
+		if(!callContext.interpreter()->output().flush())
+		{
+			throw ExternalFunctionError(std::string("Cannot write output: ") + std::strerror(errno));
+		}
 		return Value::nil();
 	}
 
@@ -107,12 +139,26 @@ namespace
 		return Value::number(std::time(0));
 	}
 
+	bool isPackedArray(const Value &value)
+	{
+		return value.isIntArray() || value.isFloatArray();
+	}
+
+	std::size_t packedSize(const Value &value)
+	{
+		return value.isIntArray() ? value.intArray().size() : value.floatArray().size();
+	}
+
 	Value array_length(const Arguments &arguments)
 	{
-		if(arguments.size() != 1 || !arguments[0].isArray())
+		if(arguments.size() != 1 || !(arguments[0].isArray() || isPackedArray(arguments[0])))
 		{
 			throw ExternalFunctionError("Expected 1 array argument");
 		}
+		if (isPackedArray(arguments[0]))
+		{
+			return Value::number(packedSize(arguments[0]));
+		}
 		return Value::number(arguments[0].array().size());
 	}
 
@@ -124,11 +170,11 @@ namespace
 		}
 
 		const Value &arrayValue = arguments[0];
-		if(!arrayValue.isArray())
+		if(!(arrayValue.isArray() || isPackedArray(arrayValue)))
 		{
 			throw ExternalFunctionError("Expected array first argument");
 		}
-		const Value::Array &array = arrayValue.array();
+		std::size_t size = isPackedArray(arrayValue) ? packedSize(arrayValue) : arrayValue.array().size();
 
 		const Value &indexValue = arguments[1];
 		if(!indexValue.isNumber())
@@ -137,11 +183,19 @@ namespace
 		}
 
 		std::size_t index = indexValue.number();
-		if (index < 0 || index >= array.size())
+		if (index < 0 || index >= size)
+		{
+			throw ExternalFunctionError("Array has " + str(size) + " elements, cannot get index " + str(index));
+		}
+		if (arrayValue.isIntArray())
 		{
-			throw ExternalFunctionError("Array has " + str(array.size()) + " elements, cannot get index " + str(index));
+			return Value::number(arrayValue.intArray()[index]);
 		}
-		return array[index];
+		if (arrayValue.isFloatArray())
+		{
+			return Value::floating(arrayValue.floatArray()[index]);
+		}
+		return arrayValue.array()[index];
 	}
 
 	Value array_set_element(const Arguments &arguments)
@@ -152,11 +206,11 @@ namespace
 		}
 
 		const Value &arrayValue = arguments[0];
-		if(!arrayValue.isArray())
+		if(!(arrayValue.isArray() || isPackedArray(arrayValue)))
 		{
 			throw ExternalFunctionError("Expected array first argument");
 		}
-		Value::Array array = arrayValue.array();
+		std::size_t size = isPackedArray(arrayValue) ? packedSize(arrayValue) : arrayValue.array().size();
 
 		const Value &indexValue = arguments[1];
 		if(!indexValue.isNumber())
@@ -165,12 +219,34 @@ namespace
 		}
 
 		std::size_t index = indexValue.number();
-		if (index < 0 || index >= array.size())
+		if (index < 0 || index >= size)
+		{
+			throw ExternalFunctionError("Array has " + str(size) + " elements, cannot get index " + str(index));
+		}
+		const Value &element = arguments[2];
+		if (arrayValue.isIntArray())
 		{
-			throw ExternalFunctionError("Array has " + str(array.size()) + " elements, cannot get index " + str(index));
+			if (!element.isNumber())
+			{
+				throw ExternalFunctionError("Expected an integer element for an int array");
+			}
+			Value::IntArray array = arrayValue.intArray();
+			array[index] = element.number();
+			return Value::intArray(array);
+		}
+		if (arrayValue.isFloatArray())
+		{
+			if (!element.isNumeric())
+			{
+				throw ExternalFunctionError("Expected a numeric element for a float array");
+			}
+			Value::FloatArray array = arrayValue.floatArray();
+			array[index] = element.numeric();
+			return Value::floatArray(array);
 		}
-		
-		array[index] = arguments[2];
+
+		Value::Array array = arrayValue.array();
+		array[index] = element;
 		return Value::array(array);
 	}
 	
@@ -197,21 +273,329 @@ namespace
 			throw ExternalFunctionError("Expected numeric argument");
 		}
 
-		std::size_t size = arguments[0].number();
+		long long size = arguments[0].number();
+		if(size < 0)
+		{
+			throw ExternalFunctionError("Expected a size of at least 0");
+		}
 		Value::Array result;
-		for (unsigned i = 0 ; i < size ; ++i)
+		// Reserved up front, so an impossible size fails here rather than
+		// once memory runs out
+		if(static_cast<unsigned long long>(size) > result.max_size())
+		{
+			throw ExternalFunctionError("Array size " + str(size) + " is too large");
+		}
+		try
+		{
+			result.reserve(size);
+		}
+		catch(const std::bad_alloc &)
+		{
+			throw ExternalFunctionError("Array size " + str(size) + " is too large");
+		}
+		for (std::size_t i = 0 ; i < static_cast<std::size_t>(size) ; ++i)
 		{
 			result.push_back(Value::nil());
 		}
 		return Value::array(result);
 	}
 
-	Value read_line(const Arguments &arguments)
+	Value int_array(const Arguments &arguments)
 	{
-		if(!arguments.empty())
+		Value::IntArray result;
+		for (const Value &argument : arguments)
+		{
+			if (!argument.isNumber())
+			{
+				throw ExternalFunctionError("Expected integer arguments");
+			}
+			result.push_back(argument.number());
+		}
+		return Value::intArray(result);
+	}
+
+	Value float_array(const Arguments &arguments)
+	{
+		Value::FloatArray result;
+		for (const Value &argument : arguments)
+		{
+			if (!argument.isNumeric())
+			{
+				throw ExternalFunctionError("Expected numeric arguments");
+			}
+			result.push_back(argument.numeric());
+		}
+		return Value::floatArray(result);
+	}
+
+	// Into an int array if every element is an integer, otherwise a float
+	// array. False if any element is not a number.
+	bool pack(const Value::Array &elements, Value &packed)
+	{
+		bool floats = false;
+		for (const Value &element : elements)
+		{
+			if (!element.isNumeric())
+			{
+				return false;
+			}
+			floats = floats || element.isFloat();
+		}
+		if (floats)
+		{
+			Value::FloatArray array;
+			array.reserve(elements.size());
+			for (const Value &element : elements)
+			{
+				array.push_back(element.numeric());
+			}
+			packed = Value::floatArray(array);
+		}
+		else
+		{
+			Value::IntArray array;
+			array.reserve(elements.size());
+			for (const Value &element : elements)
+			{
+				array.push_back(element.number());
+			}
+			packed = Value::intArray(array);
+		}
+		return true;
+	}
+
+	// What the kernels work on: packed arrays as they are, and boxed arrays
+	// of numbers packed into temporary. Null for anything else.
+	const Value *packedArgument(const Value &argument, Value &temporary)
+	{
+		if (isPackedArray(argument))
+		{
+			return &argument;
+		}
+		if (argument.isArray() && pack(argument.array(), temporary))
+		{
+			return &temporary;
+		}
+		return nullptr;
+	}
+
+	// A float array's elements, or an int array's converted into storage, for
+	// arithmetic mixing the two
+	const Value::FloatArray &asFloats(const Value &packed, Value::FloatArray &storage)
+	{
+		if (packed.isFloatArray())
+		{
+			return packed.floatArray();
+		}
+		const Value::IntArray &elements = packed.intArray();
+		storage.assign(elements.begin(), elements.end());
+		return storage;
+	}
+
+	Value array_pack(const Arguments &arguments)
+	{
+		Value temporary;
+		const Value *packed = (arguments.size() == 1) ? packedArgument(arguments[0], temporary) : nullptr;
+		if (!packed)
+		{
+			throw ExternalFunctionError("Expected 1 array of numbers");
+		}
+		return *packed;
+	}
+
+	Value array_sum(const Arguments &arguments)
+	{
+		Value temporary;
+		const Value *packed = (arguments.size() == 1) ? packedArgument(arguments[0], temporary) : nullptr;
+		if (!packed)
+		{
+			throw ExternalFunctionError("Expected 1 array of numbers");
+		}
+		if (packed->isIntArray())
+		{
+			const Value::IntArray &elements = packed->intArray();
+			long long sum;
+			if (!sumInts(elements.data(), elements.size(), sum))
+			{
+				throw ExternalFunctionError("integer overflow");
+			}
+			return Value::number(sum);
+		}
+		const Value::FloatArray &elements = packed->floatArray();
+		return Value::floating(sumFloats(elements.data(), elements.size()));
+	}
+
+	Value array_min(const Arguments &arguments)
+	{
+		Value temporary;
+		const Value *packed = (arguments.size() == 1) ? packedArgument(arguments[0], temporary) : nullptr;
+		if (!packed)
+		{
+			throw ExternalFunctionError("Expected 1 array of numbers");
+		}
+		if (packedSize(*packed) == 0)
+		{
+			throw ExternalFunctionError("Cannot take the minimum of an empty array");
+		}
+		if (packed->isIntArray())
+		{
+			return Value::number(minInt(packed->intArray().data(), packed->intArray().size()));
+		}
+		return Value::floating(minFloat(packed->floatArray().data(), packed->floatArray().size()));
+	}
+
+	Value array_max(const Arguments &arguments)
+	{
+		Value temporary;
+		const Value *packed = (arguments.size() == 1) ? packedArgument(arguments[0], temporary) : nullptr;
+		if (!packed)
+		{
+			throw ExternalFunctionError("Expected 1 array of numbers");
+		}
+		if (packedSize(*packed) == 0)
+		{
+			throw ExternalFunctionError("Cannot take the maximum of an empty array");
+		}
+		if (packed->isIntArray())
+		{
+			return Value::number(maxInt(packed->intArray().data(), packed->intArray().size()));
+		}
+		return Value::floating(maxFloat(packed->floatArray().data(), packed->floatArray().size()));
+	}
+
+	// Integers stay integers, unless mixed with floats
+	Value array_add(const Arguments &arguments)
+	{
+		Value leftTemporary;
+		Value rightTemporary;
+		const Value *left = (arguments.size() == 2) ? packedArgument(arguments[0], leftTemporary) : nullptr;
+		const Value *right = (arguments.size() == 2) ? packedArgument(arguments[1], rightTemporary) : nullptr;
+		if (!left || !right)
+		{
+			throw ExternalFunctionError("Expected 2 arrays of numbers");
+		}
+		std::size_t size = packedSize(*left);
+		if (packedSize(*right) != size)
+		{
+			throw ExternalFunctionError("Cannot add arrays of " + str(size) + " and " + str(packedSize(*right)) + " elements");
+		}
+		if (left->isIntArray() && right->isIntArray())
+		{
+			Value::IntArray result(size);
+			if (!addInts(left->intArray().data(), right->intArray().data(), result.data(), size))
+			{
+				throw ExternalFunctionError("integer overflow");
+			}
+			return Value::intArray(result);
+		}
+		Value::FloatArray leftStorage;
+		Value::FloatArray rightStorage;
+		Value::FloatArray result(size);
+		addFloats(asFloats(*left, leftStorage).data(), asFloats(*right, rightStorage).data(), result.data(), size);
+		return Value::floatArray(result);
+	}
+
+	Value array_scale(const Arguments &arguments)
+	{
+		Value temporary;
+		const Value *packed = (arguments.size() == 2) ? packedArgument(arguments[0], temporary) : nullptr;
+		if (!packed || !arguments[1].isNumeric())
+		{
+			throw ExternalFunctionError("Expected an array of numbers and a number");
+		}
+		const Value &factor = arguments[1];
+		std::size_t size = packedSize(*packed);
+		if (packed->isIntArray() && factor.isNumber())
+		{
+			Value::IntArray result(size);
+			if (!scaleInts(packed->intArray().data(), factor.number(), result.data(), size))
+			{
+				throw ExternalFunctionError("integer overflow");
+			}
+			return Value::intArray(result);
+		}
+		Value::FloatArray storage;
+		Value::FloatArray result(size);
+		scaleFloats(asFloats(*packed, storage).data(), factor.numeric(), result.data(), size);
+		return Value::floatArray(result);
+	}
+
+	Value array_dot(const Arguments &arguments)
+	{
+		Value leftTemporary;
+		Value rightTemporary;
+		const Value *left = (arguments.size() == 2) ? packedArgument(arguments[0], leftTemporary) : nullptr;
+		const Value *right = (arguments.size() == 2) ? packedArgument(arguments[1], rightTemporary) : nullptr;
+		if (!left || !right)
+		{
+			throw ExternalFunctionError("Expected 2 arrays of numbers");
+		}
+		std::size_t size = packedSize(*left);
+		if (packedSize(*right) != size)
+		{
+			throw ExternalFunctionError("Cannot multiply arrays of " + str(size) + " and " + str(packedSize(*right)) + " elements");
+		}
+		if (left->isIntArray() && right->isIntArray())
+		{
+			long long result;
+			if (!dotInts(left->intArray().data(), right->intArray().data(), size, result))
+			{
+				throw ExternalFunctionError("integer overflow");
+			}
+			return Value::number(result);
+		}
+		Value::FloatArray leftStorage;
+		Value::FloatArray rightStorage;
+		return Value::floating(dotFloats(asFloats(*left, leftStorage).data(), asFloats(*right, rightStorage).data(), size));
+	}
+
+	// -1 if the number is not there. Numbers compare as for ==, so 2.0 is
+	// found in an int array holding 2.
+	Value array_index_of(const Arguments &arguments)
+	{
+		Value temporary;
+		const Value *packed = (arguments.size() == 2) ? packedArgument(arguments[0], temporary) : nullptr;
+		if (!packed || !arguments[1].isNumeric())
+		{
+			throw ExternalFunctionError("Expected an array of numbers and a number");
+		}
+		const Value &number = arguments[1];
+		std::size_t size = packedSize(*packed);
+		std::size_t index = size;
+		if (packed->isFloatArray())
+		{
+			// Only an integer that converts exactly can equal a float
+			Value floating = Value::floating(number.numeric());
+			int order;
+			if (number.isFloat() || (compareNumbers(number, floating, order) && order == 0))
+			{
+				index = indexOfFloat(packed->floatArray().data(), size, floating.floating());
+			}
+		}
+		else if (number.isNumber())
+		{
+			index = indexOfInt(packed->intArray().data(), size, number.number());
+		}
+		else
+		{
+			// Only a whole float, in range, can equal an integer
+			double floating = number.floating();
+			if (floating >= -9223372036854775808.0 && floating < 9223372036854775808.0 && floating == static_cast<long long>(floating))
+			{
+				index = indexOfInt(packed->intArray().data(), size, static_cast<long long>(floating));
+			}
+		}
+		return Value::number(index == size ? -1 : static_cast<long long>(index));
+	}
+
+	Value read_line(CallContext &callContext)
+	{
+		if(!callContext.arguments().empty())
 		{
 			throw ExternalFunctionError("Expect no arguments");
 		}
+		// So that a prompt is seen
+		callContext.interpreter()->output().flush();
 		std::string line;
 		if (!std::getline(std::cin, line)) 
 		{
@@ -228,7 +612,7 @@ namespace
 		}
 		const std::string &text = arguments[0].string();
 		std::stringstream stream(text);
-		int i;
+		long long i;
 		if (stream >> i && stream.eof())
 		{
 			return Value::number(i);
@@ -379,23 +763,341 @@ namespace
 		return Value::boolean(result);
 	}
 
-	Value srand(const Arguments &arguments)
+	Value srand(CallContext &callContext)
 	{
-	  if(!arguments.empty())
+		if(!callContext.arguments().empty())
 		{
 			throw ExternalFunctionError("Expected no arguments");
 		}
-		std::srand(std::time(nullptr));
+		// Not only the time, as isolates seeding together should still differ
+		std::random_device device;
+		callContext.interpreter()->random().seed(std::time(nullptr) ^ device());
 		return Value::nil();
 	}
 
-	Value rand(const Arguments &arguments)
+	Value rand(CallContext &callContext)
 	{
-	  if(!arguments.empty())
+		if(!callContext.arguments().empty())
 		{
 			throw ExternalFunctionError("Expected no arguments");
 		}
-		return Value::number(std::rand());
+		std::uniform_int_distribution<int> distribution(0, RAND_MAX);
+		return Value::number(distribution(callContext.interpreter()->random()));
+	}
+
+	Value spawn(CallContext &callContext)
+	{
+		const Arguments &arguments = callContext.arguments();
+		if(arguments.empty() || !arguments[0].isFunction())
+		{
+			throw ExternalFunctionError("Expected a function, and its arguments");
+		}
+		Arguments functionArguments(arguments.begin() + 1, arguments.end());
+		int id = spawnIsolate(*callContext.globals(), callContext.interpreter()->settings(), arguments[0], functionArguments);
+		return Value::number(id);
+	}
+
+	Value join(const Arguments &arguments)
+	{
+		if(arguments.size() != 1 || !arguments[0].isNumber())
+		{
+			throw ExternalFunctionError("Expected 1 isolate id argument");
+		}
+		Value result;
+		std::string error;
+		if(!joinIsolate(arguments[0].number(), result, error))
+		{
+			throw ExternalFunctionError(error);
+		}
+		return result;
+	}
+
+	// Null if the value is not a channel
+	std::shared_ptr<Channel> channelArgument(const Value &value)
+	{
+		const ChannelHandle *handle = value.isFunction() ? dynamic_cast<const ChannelHandle *>(&value.function()) : nullptr;
+		return handle ? handle->channel() : std::shared_ptr<Channel>();
+	}
+
+	Value chan_new(const Arguments &arguments)
+	{
+		if(arguments.size() != 1 || !arguments[0].isNumber() || arguments[0].number() < 1)
+		{
+			throw ExternalFunctionError("Expected 1 capacity argument, at least 1");
+		}
+		return Value::function(ChannelHandle(arguments[0].number()));
+	}
+
+	Value chan_send(CallContext &callContext)
+	{
+		Arguments &arguments = callContext.arguments();
+		if(arguments.size() != 2)
+		{
+			throw ExternalFunctionError("Expected a channel and a value");
+		}
+		std::shared_ptr<Channel> channel = channelArgument(arguments[0]);
+		if(!channel)
+		{
+			throw ExternalFunctionError("Expected a channel, from chan_new");
+		}
+		Value value = transferable(arguments[1]);
+		if(!channel->send(value))
+		{
+			throw ExternalFunctionError("Cannot send on a closed channel");
+		}
+		return Value::nil();
+	}
+
+	Value chan_recv(const Arguments &arguments)
+	{
+		if(arguments.size() != 1)
+		{
+			throw ExternalFunctionError("Expected 1 channel argument");
+		}
+		std::shared_ptr<Channel> channel = channelArgument(arguments[0]);
+		if(!channel)
+		{
+			throw ExternalFunctionError("Expected a channel, from chan_new");
+		}
+		Value value;
+		// nil once closed and empty
+		channel->receive(value);
+		return value;
+	}
+
+	Value chan_close(const Arguments &arguments)
+	{
+		if(arguments.size() != 1)
+		{
+			throw ExternalFunctionError("Expected 1 channel argument");
+		}
+		std::shared_ptr<Channel> channel = channelArgument(arguments[0]);
+		if(!channel)
+		{
+			throw ExternalFunctionError("Expected a channel, from chan_new");
+		}
+		channel->close();
+		return Value::nil();
+	}
+
+	// nil once the iterator has finished
+	Value next(CallContext &callContext)
+	{
+		const Arguments &arguments = callContext.arguments();
+		const Iterator *iterator = arguments.size() == 1 && arguments[0].isFunction() ? dynamic_cast<const Iterator *>(&arguments[0].function()) : nullptr;
+		if(!iterator)
+		{
+			throw ExternalFunctionError("Expected 1 iterator argument, e.g. from calling a function that yields");
+		}
+		return iterator->next(*callContext.interpreter());
+	}
+
+	Value async(CallContext &callContext)
+	{
+		const Arguments &arguments = callContext.arguments();
+		if(arguments.empty() || !arguments[0].isFunction())
+		{
+			throw ExternalFunctionError("Expected a function, and its arguments");
+		}
+		Arguments functionArguments(arguments.begin() + 1, arguments.end());
+		int id = startAsyncTask(callContext, arguments[0], functionArguments);
+		return Value::number(id);
+	}
+
+	Value await(const Arguments &arguments)
+	{
+		if(arguments.size() != 1 || !arguments[0].isNumber())
+		{
+			throw ExternalFunctionError("Expected 1 future argument, from async");
+		}
+		Value result;
+		std::string error;
+		if(!awaitAsyncTask(arguments[0].number(), result, error))
+		{
+			throw ExternalFunctionError(error);
+		}
+		return result;
+	}
+
+	Value file_read(CallContext &callContext)
+	{
+		const Arguments &arguments = callContext.arguments();
+		if(arguments.size() != 2 || !arguments[0].isString() || !arguments[1].isFunction())
+		{
+			throw ExternalFunctionError("Expected a path and a callback");
+		}
+		callContext.interpreter()->eventLoop().readFile(arguments[0].string(), arguments[1]);
+		return Value::nil();
+	}
+
+	Value file_write(CallContext &callContext)
+	{
+		const Arguments &arguments = callContext.arguments();
+		if(arguments.size() != 3 || !arguments[0].isString() || !arguments[1].isString() || !arguments[2].isFunction())
+		{
+			throw ExternalFunctionError("Expected a path, a string and a callback");
+		}
+		callContext.interpreter()->eventLoop().writeFile(arguments[0].string(), arguments[1].string(), arguments[2]);
+		return Value::nil();
+	}
+
+	Value pipe_read(CallContext &callContext)
+	{
+		const Arguments &arguments = callContext.arguments();
+		if(arguments.size() != 2 || !arguments[0].isString() || !arguments[1].isFunction())
+		{
+			throw ExternalFunctionError("Expected a path and a callback");
+		}
+		callContext.interpreter()->eventLoop().readPipe(arguments[0].string(), arguments[1]);
+		return Value::nil();
+	}
+
+	Value timer(CallContext &callContext)
+	{
+		const Arguments &arguments = callContext.arguments();
+		if(arguments.size() != 2 || !arguments[0].isNumber() || arguments[0].number() < 0 || !arguments[1].isFunction())
+		{
+			throw ExternalFunctionError("Expected milliseconds, at least 0, and a callback");
+		}
+		callContext.interpreter()->eventLoop().startTimer(arguments[0].number(), arguments[1]);
+		return Value::nil();
+	}
+
+	Value file_open_mmap(const Arguments &arguments)
+	{
+		if(arguments.size() != 1 || !arguments[0].isString())
+		{
+			throw ExternalFunctionError("Expected 1 path argument");
+		}
+		int id = openMappedFile(arguments[0].string());
+		if(id == 0)
+		{
+			throw ExternalFunctionError("Cannot map '" + arguments[0].string() + "'");
+		}
+		return Value::number(id);
+	}
+
+	Value file_close(const Arguments &arguments)
+	{
+		if(arguments.size() != 1 || !arguments[0].isNumber() || !closeMappedFile(arguments[0].number()))
+		{
+			throw ExternalFunctionError("Expected 1 open file argument, from file_open_mmap");
+		}
+		return Value::nil();
+	}
+
+	// By id, from file_open_mmap, or by path, mapped just for this. Null if
+	// it is neither, or cannot be mapped.
+	std::shared_ptr<const MappedFile> mappedFileArgument(const Value &value, std::string &name)
+	{
+		if(value.isNumber())
+		{
+			name = "mapped file " + str(value.number());
+			return findMappedFile(value.number());
+		}
+		if(value.isString())
+		{
+			name = value.string();
+			std::shared_ptr<MappedFile> file = std::make_shared<MappedFile>(name);
+			if(file->isOpen())
+			{
+				file->adviseSequential();
+				return file;
+			}
+		}
+		return std::shared_ptr<const MappedFile>();
+	}
+
+	Value file_lines(const Arguments &arguments)
+	{
+		std::string name;
+		std::shared_ptr<const MappedFile> file = arguments.size() == 1 ? mappedFileArgument(arguments[0], name) : nullptr;
+		if(!file)
+		{
+			throw ExternalFunctionError("Expected a path that can be mapped, or an open file from file_open_mmap");
+		}
+		return Value::function(LineIterator(name, file));
+	}
+
+	Value file_read_all(const Arguments &arguments)
+	{
+		std::string name;
+		std::shared_ptr<const MappedFile> file = arguments.size() == 1 ? mappedFileArgument(arguments[0], name) : nullptr;
+		if(!file)
+		{
+			throw ExternalFunctionError("Expected a path that can be mapped, or an open file from file_open_mmap");
+		}
+		return Value::string(file->begin(), file->size());
+	}
+
+	Value run_events(CallContext &callContext)
+	{
+		if(!callContext.arguments().empty())
+		{
+			throw ExternalFunctionError("Expected no arguments");
+		}
+		return Value::number(callContext.interpreter()->runEventLoop());
+	}
+
+	Value parallel_map(CallContext &callContext)
+	{
+		const Arguments &arguments = callContext.arguments();
+		if(arguments.size() != 2 || !arguments[0].isFunction() || !arguments[1].isArray())
+		{
+			throw ExternalFunctionError("Expected a function and an array");
+		}
+		return Value::array(parallelApply(PARALLEL_MAP, callContext, arguments[0], arguments[1].array()));
+	}
+
+	Value parallel_filter(CallContext &callContext)
+	{
+		const Arguments &arguments = callContext.arguments();
+		if(arguments.size() != 2 || !arguments[0].isFunction() || !arguments[1].isArray())
+		{
+			throw ExternalFunctionError("Expected a function and an array");
+		}
+		return Value::array(parallelApply(PARALLEL_FILTER, callContext, arguments[0], arguments[1].array()));
+	}
+
+	// The function must be associative, as the chunks are reduced separately
+	Value parallel_reduce(CallContext &callContext)
+	{
+		const Arguments &arguments = callContext.arguments();
+		if(arguments.size() != 3 || !arguments[0].isFunction() || !arguments[2].isArray())
+		{
+			throw ExternalFunctionError("Expected a function, an initial value and an array");
+		}
+		Value::Array partials = parallelApply(PARALLEL_REDUCE, callContext, arguments[0], arguments[2].array());
+		Value result = arguments[1];
+		for (const Value &partial : partials)
+		{
+			Arguments pair;
+			pair.push_back(result);
+			pair.push_back(partial);
+			result = callContext.interpreter()->call(arguments[0], pair);
+		}
+		return result;
+	}
+
+	Value runtime_stats(const Arguments &arguments)
+	{
+		if(!arguments.empty())
+		{
+			throw ExternalFunctionError("Expected no arguments");
+		}
+		AllocationStats stats = allocationStats();
+		Value::Object object;
+		object["allocations"] = Value::number(stats.allocations);
+		object["allocated_bytes"] = Value::number(stats.allocatedBytes);
+		object["live_bytes"] = Value::number(stats.liveBytes);
+		object["peak_bytes"] = Value::number(stats.peakBytes);
+		for (int i = 0 ; i < ALLOCATION_CATEGORY_COUNT ; ++i)
+		{
+			std::string name = allocationCategoryName(static_cast<AllocationCategory>(i));
+			object[name + "_bytes"] = Value::number(stats.liveBytesByCategory[i]);
+			object[name + "_allocations"] = Value::number(stats.liveAllocationsByCategory[i]);
+		}
+		return Value::object(object);
 	}
 
 #define ENTRY(X) ApiReg(#X, CURRENT_SOURCE_LOCATION, &X)
@@ -417,15 +1119,48 @@ namespace
 		ENTRY(is_nil),
 		ENTRY(format),
 		ENTRY(println),
+		ENTRY(flush),
 		ENTRY(read_line),
 		ENTRY(array_length),
 		ENTRY(array_element),
 		ENTRY(array_set_element),
 		ENTRY(array),
 		ENTRY(array_new),
+		ENTRY(int_array),
+		ENTRY(float_array),
+		ENTRY(array_pack),
+		ENTRY(array_sum),
+		ENTRY(array_min),
+		ENTRY(array_max),
+		ENTRY(array_add),
+		ENTRY(array_scale),
+		ENTRY(array_dot),
+		ENTRY(array_index_of),
 		ENTRY(try_convert_string_to_int),
 		ENTRY(srand),
 		ENTRY(rand),
+		ENTRY(runtime_stats),
+		ENTRY(spawn),
+		ENTRY(join),
+		ENTRY(chan_new),
+		ENTRY(chan_send),
+		ENTRY(chan_recv),
+		ENTRY(chan_close),
+		ENTRY(next),
+		ENTRY(async),
+		ENTRY(await),
+		ENTRY(file_read),
+		ENTRY(file_write),
+		ENTRY(pipe_read),
+		ENTRY(timer),
+		ENTRY(run_events),
+		ENTRY(file_open_mmap),
+		ENTRY(file_close),
+		ENTRY(file_lines),
+		ENTRY(file_read_all),
+		ENTRY(parallel_map),
+		ENTRY(parallel_filter),
+		ENTRY(parallel_reduce),
 	};
 
 #undef ENTRY
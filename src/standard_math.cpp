@@ -1,5 +1,8 @@
 #include "standard_math.h"
 
+#include <cmath>
+#include <climits>
+
 #include "api.h"
 #include "standard_library_error.h"
 
@@ -35,58 +38,154 @@ namespace
 		}
 	}
 
-	int add(int x, int y)
+	// Integer arithmetic throws rather than overflowing. Otherwise either
+	// argument being a float makes it floating point, in double precision.
+	struct Add
 	{
-		return x + y;
-	}
+		static const MathFunction function = ADD;
+
+		static long long integer(long long x, long long y)
+		{
+			long long result;
+			if (__builtin_add_overflow(x, y, &result))
+			{
+				throw ExternalFunctionError(functionName(function), "integer overflow");
+			}
+			return result;
+		}
+
+		static double floating(double x, double y)
+		{
+			return x + y;
+		}
+	};
 
-	int mul(int x, int y)
+	struct Mul
 	{
-		return x * y;
-	}
+		static const MathFunction function = MUL;
+
+		static long long integer(long long x, long long y)
+		{
+			long long result;
+			if (__builtin_mul_overflow(x, y, &result))
+			{
+				throw ExternalFunctionError(functionName(function), "integer overflow");
+			}
+			return result;
+		}
+
+		static double floating(double x, double y)
+		{
+			return x * y;
+		}
+	};
 
-	int sub(int x, int y)
+	struct Sub
 	{
-		return x - y;
-	}
+		static const MathFunction function = SUB;
+
+		static long long integer(long long x, long long y)
+		{
+			long long result;
+			if (__builtin_sub_overflow(x, y, &result))
+			{
+				throw ExternalFunctionError(functionName(function), "integer overflow");
+			}
+			return result;
+		}
+
+		static double floating(double x, double y)
+		{
+			return x - y;
+		}
+	};
 
-	int div(int x, int y)
+	struct Div
 	{
-		if (y == 0)
+		static const MathFunction function = DIV;
+
+		static long long integer(long long x, long long y)
 		{
-			throw ExternalFunctionError(functionName(DIV), "cannot divide by zero");
+			if (y == 0)
+			{
+				throw ExternalFunctionError(functionName(function), "cannot divide by zero");
+			}
+			if (x == LLONG_MIN && y == -1)
+			{
+				throw ExternalFunctionError(functionName(function), "integer overflow");
+			}
+			return x / y;
 		}
-		return x / y;
-	}
 
-	int mod(int x, int y)
+		static double floating(double x, double y)
+		{
+			if (y == 0)
+			{
+				throw ExternalFunctionError(functionName(function), "cannot divide by zero");
+			}
+			return x / y;
+		}
+	};
+
+	struct Mod
 	{
-		if (y == 0)
+		static const MathFunction function = MOD;
+
+		static long long integer(long long x, long long y)
 		{
-			throw ExternalFunctionError(functionName(MOD), "cannot mod by zero");
+			if (y == 0)
+			{
+				throw ExternalFunctionError(functionName(function), "cannot mod by zero");
+			}
+			// Which would overflow computing the quotient
+			return y == -1 ? 0 : x % y;
 		}
-		return x % y;
-	}
 
-	bool less(int x, int y)
+		static double floating(double x, double y)
+		{
+			if (y == 0)
+			{
+				throw ExternalFunctionError(functionName(function), "cannot mod by zero");
+			}
+			return std::fmod(x, y);
+		}
+	};
+
+	template<typename T>
+	struct Less
 	{
-		return x < y;
-	}
+		static bool compare(T x, T y)
+		{
+			return x < y;
+		}
+	};
 
-	bool greater(int x, int y)
+	template<typename T>
+	struct Greater
 	{
-		return x > y;
-	}
+		static bool compare(T x, T y)
+		{
+			return x > y;
+		}
+	};
 
-	bool lessEqual(int x, int y)
+	template<typename T>
+	struct LessEqual
 	{
-		return x <= y;
-	}
+		static bool compare(T x, T y)
+		{
+			return x <= y;
+		}
+	};
 
-	bool greaterEqual(int x, int y)
+	template<typename T>
+	struct GreaterEqual
 	{
-		return x >= y;
-	}
+		static bool compare(T x, T y)
+		{
+			return x >= y;
+		}
+	};
 
 	void expectTwoNumbers(MathFunction mathFunction, const Arguments &arguments)
 	{
@@ -95,58 +194,82 @@ namespace
 			throw ExternalFunctionError(functionName(mathFunction), "Expected 2 arguments");
 		}
 
-		if(!(arguments[0].isNumber() && arguments[1].isNumber()))
+		if(!(arguments[0].isNumeric() && arguments[1].isNumeric()))
 		{
 			throw ExternalFunctionError(functionName(mathFunction), "Expected numeric argument");
 		}
 	}
 
-	template<MathFunction math, int init, int (*aggregate)(int, int)>
+	// Stays with integers until the first float
+	template<typename Operation, long long init>
 	Value numericFold(const Arguments &arguments)
 	{
 		if(arguments.size() < 2)
 		{
-			throw ExternalFunctionError(functionName(math), "Expected at least 2 arguments");
+			throw ExternalFunctionError(functionName(Operation::function), "Expected at least 2 arguments");
 		}
-		int result = init;
-		for(Arguments::const_iterator i = arguments.begin() ; i != arguments.end() ; ++i)
+		long long integer = init;
+		Arguments::const_iterator i = arguments.begin();
+		for( ; i != arguments.end() && i->isNumber() ; ++i)
 		{
-			if(!i->isNumber())
+			integer = Operation::integer(integer, i->number());
+		}
+		if(i == arguments.end())
+		{
+			return Value::number(integer);
+		}
+
+		double floating = integer;
+		for( ; i != arguments.end() ; ++i)
+		{
+			if(!i->isNumeric())
 			{
-				throw ExternalFunctionError(functionName(math), "Expected numeric argument");
+				throw ExternalFunctionError(functionName(Operation::function), "Expected numeric argument");
 			}
-			result = aggregate(result, i->number());
+			floating = Operation::floating(floating, i->numeric());
 		}
-		return Value::number(result);
+		return Value::floating(floating);
 	}
 
-	template<MathFunction math, int (*function)(int, int)>
+	template<typename Operation>
 	Value binaryOperation(const Arguments &arguments)
 	{
-		expectTwoNumbers(math, arguments);
-		int result = function(arguments[0].number(), arguments[1].number());
-		return Value::number(result);
+		expectTwoNumbers(Operation::function, arguments);
+		const Value &x = arguments[0];
+		const Value &y = arguments[1];
+		if(x.isNumber() && y.isNumber())
+		{
+			return Value::number(Operation::integer(x.number(), y.number()));
+		}
+		return Value::floating(Operation::floating(x.numeric(), y.numeric()));
 	}
 
-	template<MathFunction math, bool (*predicate)(int, int)>
+	template<MathFunction math, template<typename> class Predicate>
 	Value numericPredicate(const Arguments &arguments)
 	{
 		expectTwoNumbers(math, arguments);
-		bool result = predicate(arguments[0].number(), arguments[1].number());
-		return Value::boolean(result);
+		const Value &x = arguments[0];
+		const Value &y = arguments[1];
+		if(x.isNumber() && y.isNumber())
+		{
+			return Value::boolean(Predicate<long long>::compare(x.number(), y.number()));
+		}
+		// Exactly, as an integer rounded to a double may equal its neighbours
+		int order;
+		return Value::boolean(compareNumbers(x, y, order) && Predicate<int>::compare(order, 0));
 	}
 
 	const ApiReg registry[] = 
 	{
-		ApiReg(functionName(ADD), CURRENT_SOURCE_LOCATION, numericFold<ADD, 0, &add>),
-		ApiReg(functionName(MUL), CURRENT_SOURCE_LOCATION, numericFold<MUL, 1, &mul>),
-		ApiReg(functionName(SUB), CURRENT_SOURCE_LOCATION, binaryOperation<SUB, &sub>),
-		ApiReg(functionName(DIV), CURRENT_SOURCE_LOCATION, binaryOperation<DIV, &div>),
-		ApiReg(functionName(MOD), CURRENT_SOURCE_LOCATION, binaryOperation<MOD, &mod>),
-		ApiReg(functionName(LT),  CURRENT_SOURCE_LOCATION, numericPredicate<LT, &less>),
-		ApiReg(functionName(GT),  CURRENT_SOURCE_LOCATION, numericPredicate<GT, &greater>),
-		ApiReg(functionName(LTE), CURRENT_SOURCE_LOCATION, numericPredicate<LTE, &lessEqual>),
-		ApiReg(functionName(GTE), CURRENT_SOURCE_LOCATION, numericPredicate<GTE, &greaterEqual>),
+		ApiReg(functionName(ADD), CURRENT_SOURCE_LOCATION, numericFold<Add, 0>),
+		ApiReg(functionName(MUL), CURRENT_SOURCE_LOCATION, numericFold<Mul, 1>),
+		ApiReg(functionName(SUB), CURRENT_SOURCE_LOCATION, binaryOperation<Sub>),
+		ApiReg(functionName(DIV), CURRENT_SOURCE_LOCATION, binaryOperation<Div>),
+		ApiReg(functionName(MOD), CURRENT_SOURCE_LOCATION, binaryOperation<Mod>),
+		ApiReg(functionName(LT),  CURRENT_SOURCE_LOCATION, numericPredicate<LT, Less>),
+		ApiReg(functionName(GT),  CURRENT_SOURCE_LOCATION, numericPredicate<GT, Greater>),
+		ApiReg(functionName(LTE), CURRENT_SOURCE_LOCATION, numericPredicate<LTE, LessEqual>),
+		ApiReg(functionName(GTE), CURRENT_SOURCE_LOCATION, numericPredicate<GTE, GreaterEqual>),
 	};
 }
 
@@ -0,0 +1,58 @@
+#include "thread_pool.h"
+
+#include <memory>
+
+ThreadPool::ThreadPool(unsigned threads)
+:
+	stopping_(false)
+{
+	for (unsigned i = 0 ; i < threads ; ++i)
+	{
+		threads_.push_back(std::thread(&ThreadPool::run, this));
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stopping_ = true;
+	}
+	available_.notify_all();
+	for (std::thread &thread : threads_)
+	{
+		thread.join();
+	}
+}
+
+std::future<void> ThreadPool::submit(const std::function<void()> &task)
+{
+	// std::function requires a copyable target
+	std::shared_ptr<std::packaged_task<void()>> packaged = std::make_shared<std::packaged_task<void()>>(task);
+	std::future<void> result = packaged->get_future();
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		tasks_.push_back([packaged]() { (*packaged)(); });
+	}
+	available_.notify_one();
+	return result;
+}
+
+void ThreadPool::run()
+{
+	while (true)
+	{
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			available_.wait(lock, [this]() { return stopping_ || !tasks_.empty(); });
+			if (tasks_.empty())
+			{
+				return;
+			}
+			task = tasks_.front();
+			tasks_.pop_front();
+		}
+		task();
+	}
+}
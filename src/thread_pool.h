@@ -0,0 +1,36 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <deque>
+#include <mutex>
+#include <future>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+
+// Fixed set of threads running tasks in submission order.
+// The destructor finishes any queued tasks before joining.
+class ThreadPool
+{
+public:
+	explicit ThreadPool(unsigned threads);
+	~ThreadPool();
+
+	std::future<void> submit(const std::function<void()> &task);
+
+private:
+	// Deliberately private & unimplemented
+	ThreadPool(const ThreadPool &);
+	ThreadPool &operator=(const ThreadPool &);
+
+	void run();
+
+	std::mutex mutex_;
+	std::condition_variable available_;
+	std::deque<std::function<void()>> tasks_;
+	bool stopping_;
+	std::vector<std::thread> threads_;
+};
+
+#endif
@@ -13,7 +13,7 @@ Token Token::string(const SourceLocation &sourceLocation, const std::string &tex
 
 Token Token::number(const SourceLocation &sourceLocation, const std::string &number)
 {
-	assert(is<int>(number));
+	assert(is<long long>(number) || is<double>(number));
 	return Token(sourceLocation, NUMBER, number); 
 }
 
@@ -66,6 +66,12 @@ void Token::addChild(const Token &token)
 	children_.push_back(token);
 }
 
+void Token::addChild(Token &&token)
+{
+	assert(!(type_ == STRING || type_ == NUMBER || type_ == KEYWORD));
+	children_.push_back(std::move(token));
+}
+
 
 Token::Token(const SourceLocation &sourceLocation, Type type, const std::string &string)
 :
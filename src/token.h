@@ -46,6 +46,9 @@ public:
 
 	void addChild(const Token &token);
 
+	// Avoids copying the subtree of a freshly lexed list
+	void addChild(Token &&token);
+
 private:
 	Token(const SourceLocation &sourceLocation, Type type, const std::string &string);
 
@@ -0,0 +1,398 @@
+#include "trace_buffer.h"
+
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace
+{
+	const char MAGIC[8] = { 'R', 'A', 'S', 'P', 'T', 'R', 'C', '1' };
+	const char TOP_LEVEL[] = "(toplevel)";
+	const int FATAL_SIGNALS[] = { SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT };
+
+	TraceBuffer *volatile dumpingOnSignal = nullptr;
+
+	// Where the handler runs, as a stack overflow leaves no room on the
+	// thread's own stack. Enough for dump(), which writes through a 4 KiB
+	// buffer.
+	const std::size_t SIGNAL_STACK_SIZE = 64 * 1024;
+	char signalStack[SIGNAL_STACK_SIZE];
+
+	// Buffers writes to a file descriptor, without allocating
+	class FileWriter
+	{
+	public:
+		explicit FileWriter(int fd)
+		:
+			fd_(fd),
+			used_(0),
+			failed_(fd < 0)
+		{
+		}
+
+		~FileWriter()
+		{
+			close();
+		}
+
+		void write(const void *data, std::size_t size)
+		{
+			const char *bytes = static_cast<const char *>(data);
+			while (size > 0)
+			{
+				if (used_ == sizeof(buffer_))
+				{
+					flush();
+				}
+				std::size_t chunk = sizeof(buffer_) - used_ < size ? sizeof(buffer_) - used_ : size;
+				std::memcpy(buffer_ + used_, bytes, chunk);
+				used_ += chunk;
+				bytes += chunk;
+				size -= chunk;
+			}
+		}
+
+		void writeUnsigned(std::uint32_t number)
+		{
+			write(&number, sizeof(number));
+		}
+
+		void writeString(const char *text, std::size_t size)
+		{
+			writeUnsigned(size);
+			write(text, size);
+		}
+
+		bool close()
+		{
+			if (fd_ >= 0)
+			{
+				flush();
+				if (::close(fd_) != 0)
+				{
+					failed_ = true;
+				}
+				fd_ = -1;
+			}
+			return !failed_;
+		}
+
+	private:
+		void flush()
+		{
+			const char *bytes = buffer_;
+			while (!failed_ && used_ > 0)
+			{
+				ssize_t written = ::write(fd_, bytes, used_);
+				if (written < 0 && errno == EINTR)
+				{
+					continue;
+				}
+				if (written <= 0)
+				{
+					failed_ = true;
+					break;
+				}
+				bytes += written;
+				used_ -= written;
+			}
+			used_ = 0;
+		}
+
+		int fd_;
+		char buffer_[4096];
+		std::size_t used_;
+		bool failed_;
+	};
+
+	class FileReader
+	{
+	public:
+		explicit FileReader(std::istream &in)
+		:
+			in_(in)
+		{
+		}
+
+		template<typename T>
+		bool read(T &value)
+		{
+			return static_cast<bool>(in_.read(reinterpret_cast<char *>(&value), sizeof(value)));
+		}
+
+		bool readString(std::string &text)
+		{
+			std::uint32_t size;
+			if (!read(size))
+			{
+				return false;
+			}
+			text.resize(size);
+			return size == 0 || static_cast<bool>(in_.read(&text[0], size));
+		}
+
+	private:
+		std::istream &in_;
+	};
+}
+
+TraceBuffer::TraceBuffer(const std::string &filename, std::size_t capacity)
+:
+	filename_(filename),
+	mask_(0),
+	recorded_(0),
+	start_(Clock::now()),
+	lastFile_(nullptr),
+	lastFileId_(0),
+	function_(0),
+	callDepth_(0),
+	handlingSignals_(false)
+{
+	std::size_t size = 1;
+	while (size < capacity)
+	{
+		size *= 2;
+	}
+	records_.resize(size);
+	mask_ = size - 1;
+
+	FunctionInfo topLevel = { 0, 0, TOP_LEVEL };
+	functions_.push_back(topLevel);
+	files_.push_back(nullptr);
+}
+
+TraceBuffer::~TraceBuffer()
+{
+	if (handlingSignals_)
+	{
+		dumpingOnSignal = nullptr;
+		for (int signal : FATAL_SIGNALS)
+		{
+			std::signal(signal, SIG_DFL);
+		}
+		stack_t disabled;
+		std::memset(&disabled, 0, sizeof(disabled));
+		disabled.ss_flags = SS_DISABLE;
+		sigaltstack(&disabled, nullptr);
+	}
+}
+
+std::uint32_t TraceBuffer::fileId(const std::string *filename)
+{
+	for (std::size_t i = 1 ; i < files_.size() ; ++i)
+	{
+		if (files_[i] == filename)
+		{
+			return i;
+		}
+	}
+	files_.push_back(filename);
+	return files_.size() - 1;
+}
+
+void TraceBuffer::enter(const Function &function)
+{
+	const SourceLocation &sourceLocation = function.sourceLocation();
+	Key key = { &sourceLocation.filename(), sourceLocation.line() };
+	std::unordered_map<Key, std::uint32_t, KeyHash>::const_iterator it = ids_.find(key);
+	std::uint32_t id;
+	if (it == ids_.end())
+	{
+		FunctionInfo info = { fileId(key.filename), key.line, function.name() };
+		functions_.push_back(info);
+		id = functions_.size() - 1;
+		ids_[key] = id;
+	}
+	else
+	{
+		id = it->second;
+	}
+	callers_.push_back(function_);
+	function_ = id;
+	callDepth_ = callers_.size() < UINT16_MAX ? callers_.size() : UINT16_MAX;
+}
+
+void TraceBuffer::leave()
+{
+	function_ = callers_.back();
+	callers_.pop_back();
+	callDepth_ = callers_.size() < UINT16_MAX ? callers_.size() : UINT16_MAX;
+}
+
+unsigned long long TraceBuffer::recorded() const
+{
+	return recorded_;
+}
+
+// File layout, in the host's byte order:
+//   magic, record size, opcode names, files, functions,
+//   records ever made, records kept, then the records, oldest first.
+// Strings and tables are prefixed with their 32 bit size.
+bool TraceBuffer::dump() const
+{
+	FileWriter out(open(filename_.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644));
+	out.write(MAGIC, sizeof(MAGIC));
+	out.writeUnsigned(sizeof(Record));
+
+	out.writeUnsigned(Instruction::TYPE_COUNT);
+	for (int i = 0 ; i < Instruction::TYPE_COUNT ; ++i)
+	{
+		const char *name = Instruction::typeName(static_cast<Instruction::Type>(i));
+		out.writeString(name, std::strlen(name));
+	}
+
+	out.writeUnsigned(files_.size());
+	for (const std::string *file : files_)
+	{
+		out.writeString(file ? file->data() : "", file ? file->size() : 0);
+	}
+
+	out.writeUnsigned(functions_.size());
+	for (const FunctionInfo &function : functions_)
+	{
+		out.writeUnsigned(function.file);
+		out.writeUnsigned(function.line);
+		out.writeString(function.name.data(), function.name.size());
+	}
+
+	unsigned long long recorded = recorded_;
+	std::size_t kept = recorded < records_.size() ? recorded : records_.size();
+	out.write(&recorded, sizeof(recorded));
+	out.writeUnsigned(kept);
+	for (unsigned long long i = recorded - kept ; i < recorded ; ++i)
+	{
+		out.write(&records_[i & mask_], sizeof(Record));
+	}
+	return out.close();
+}
+
+bool TraceBuffer::dumpOnFatalSignal()
+{
+	if (dumpingOnSignal)
+	{
+		return false;
+	}
+	// For this thread, which runs the interpreter
+	stack_t stack;
+	std::memset(&stack, 0, sizeof(stack));
+	stack.ss_sp = signalStack;
+	stack.ss_size = SIGNAL_STACK_SIZE;
+	if (sigaltstack(&stack, nullptr) != 0)
+	{
+		return false;
+	}
+	struct sigaction action;
+	std::memset(&action, 0, sizeof(action));
+	action.sa_handler = &TraceBuffer::handleFatalSignal;
+	// Back to the default action, for the signal raised again afterwards
+	action.sa_flags = SA_RESETHAND | SA_ONSTACK;
+	sigemptyset(&action.sa_mask);
+	for (int signal : FATAL_SIGNALS)
+	{
+		if (sigaction(signal, &action, nullptr) != 0)
+		{
+			return false;
+		}
+	}
+	dumpingOnSignal = this;
+	handlingSignals_ = true;
+	return true;
+}
+
+void TraceBuffer::handleFatalSignal(int signal)
+{
+	TraceBuffer *buffer = dumpingOnSignal;
+	if (buffer)
+	{
+		dumpingOnSignal = nullptr;
+		buffer->dump();
+	}
+	// Delivered once the handler returns, now with the default action
+	raise(signal);
+}
+
+bool TraceBuffer::decode(const std::string &filename, std::ostream &out)
+{
+	std::ifstream file(filename.c_str(), std::ios::binary);
+	FileReader in(file);
+
+	char magic[sizeof(MAGIC)];
+	std::uint32_t recordSize = 0;
+	if (!in.read(magic) || std::memcmp(magic, MAGIC, sizeof(MAGIC)) != 0 || !in.read(recordSize) || recordSize != sizeof(Record))
+	{
+		std::cerr << filename << " is not a trace written by this version of rasp\n";
+		return false;
+	}
+
+	std::uint32_t count = 0;
+	std::vector<std::string> opcodes;
+	bool ok = in.read(count);
+	for (std::uint32_t i = 0 ; ok && i < count ; ++i)
+	{
+		opcodes.push_back(std::string());
+		ok = in.readString(opcodes.back());
+	}
+
+	std::vector<std::string> files;
+	ok = ok && in.read(count);
+	for (std::uint32_t i = 0 ; ok && i < count ; ++i)
+	{
+		files.push_back(std::string());
+		ok = in.readString(files.back());
+	}
+
+	std::vector<FunctionInfo> functions;
+	ok = ok && in.read(count);
+	for (std::uint32_t i = 0 ; ok && i < count ; ++i)
+	{
+		FunctionInfo function;
+		ok = in.read(function.file) && in.read(function.line) && in.readString(function.name) && function.file < files.size();
+		functions.push_back(function);
+	}
+
+	unsigned long long recorded = 0;
+	ok = ok && in.read(recorded) && in.read(count);
+	if (!ok)
+	{
+		std::cerr << filename << " is truncated\n";
+		return false;
+	}
+
+	std::ios::fmtflags flags = out.flags();
+	out << "Last " << count << " of " << recorded << " instructions recorded\n";
+	out << std::setw(14) << "time (us)" << std::setw(7) << "calls" << std::setw(7) << "stack" << std::setw(7) << "pc" << "  " << std::left << std::setw(16) << "opcode" << std::right << "location, in function\n";
+	out << std::fixed << std::setprecision(3);
+	for (std::uint32_t i = 0 ; i < count ; ++i)
+	{
+		Record record;
+		if (!in.read(record))
+		{
+			std::cerr << filename << " is truncated, after " << i << " records\n";
+			out.flags(flags);
+			return false;
+		}
+		out << std::setw(14) << record.timestamp / 1e3;
+		out << std::setw(7) << record.callDepth;
+		out << std::setw(7) << record.stackDepth;
+		out << std::setw(7) << record.pc;
+		out << "  " << std::left << std::setw(16) << (record.opcode < opcodes.size() ? opcodes[record.opcode] : "?") << std::right;
+		out << (record.file < files.size() ? files[record.file] : "?") << ":" << record.line;
+		if (record.function < functions.size())
+		{
+			const FunctionInfo &function = functions[record.function];
+			out << ", in " << function.name;
+			if (record.function != 0)
+			{
+				out << " (" << files[function.file] << ":" << function.line << ")";
+			}
+		}
+		out << '\n';
+	}
+	out.flags(flags);
+	return true;
+}
@@ -0,0 +1,169 @@
+#ifndef TRACE_BUFFER_H
+#define TRACE_BUFFER_H
+
+#include <chrono>
+#include <iosfwd>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <unordered_map>
+
+#include "function.h"
+#include "instruction.h"
+
+// Records each instruction executed into a fixed size ring buffer, keeping
+// the most recent, cheaply enough to leave enabled. The buffer is written to
+// a file in a compact binary form on error, on exit or on a fatal signal,
+// and printed by decode().
+class TraceBuffer
+{
+public:
+	// Capacity is rounded up to a power of two
+	TraceBuffer(const std::string &filename, std::size_t capacity = DEFAULT_CAPACITY);
+	~TraceBuffer();
+
+	static const std::size_t DEFAULT_CAPACITY = 1 << 16;
+
+	// Called by the interpreter before executing each instruction, pc being
+	// its index in the function's (or top level form's) instructions
+	void record(const Instruction &instruction, std::size_t pc, std::size_t stackDepth)
+	{
+		const SourceLocation &sourceLocation = instruction.sourceLocation();
+		// Consecutive instructions are usually in the same file
+		if (&sourceLocation.filename() != lastFile_)
+		{
+			lastFile_ = &sourceLocation.filename();
+			lastFileId_ = fileId(lastFile_);
+		}
+		Record &record = records_[recorded_ & mask_];
+		record.timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start_).count();
+		record.pc = pc;
+		record.function = function_;
+		record.file = lastFileId_;
+		record.line = sourceLocation.line();
+		record.stackDepth = stackDepth;
+		record.callDepth = callDepth_;
+		record.opcode = instruction.type();
+		++recorded_;
+	}
+
+	// The function whose instructions are recorded until leave()
+	void enter(const Function &function);
+	void leave();
+
+	unsigned long long recorded() const;
+
+	// Overwrites the file. Only uses write(2) and memory already allocated,
+	// so is safe in a signal handler.
+	bool dump() const;
+
+	// Dumps the buffer if the process is killed by SIGSEGV, SIGBUS, SIGFPE,
+	// SIGILL or SIGABRT, until destroyed. Only one buffer can do so at a time.
+	// The handler runs on an alternate stack installed for the calling
+	// thread, so a stack overflow there is dumped too.
+	bool dumpOnFatalSignal();
+
+	// Prints a file written by dump() as text, oldest record first
+	static bool decode(const std::string &filename, std::ostream &out);
+
+private:
+	// Deliberately private & unimplemented
+	TraceBuffer(const TraceBuffer &);
+	TraceBuffer &operator=(const TraceBuffer &);
+
+	typedef std::chrono::steady_clock Clock;
+
+	// Written to the file as is, so only fixed size members without padding
+	struct Record
+	{
+		std::uint64_t timestamp;
+		std::uint32_t pc;
+		std::uint32_t function;
+		std::uint32_t file;
+		std::uint32_t line;
+		std::uint32_t stackDepth;
+		std::uint16_t callDepth;
+		std::uint16_t opcode;
+	};
+
+	// Function ids index functions_, 0 being the top level
+	struct FunctionInfo
+	{
+		std::uint32_t file;
+		std::uint32_t line;
+		std::string name;
+	};
+
+	struct Key
+	{
+		const std::string *filename;
+		unsigned line;
+
+		bool operator==(const Key &other) const
+		{
+			return filename == other.filename && line == other.line;
+		}
+	};
+
+	struct KeyHash
+	{
+		std::size_t operator()(const Key &key) const
+		{
+			return std::hash<const std::string *>()(key.filename) * 31 + key.line;
+		}
+	};
+
+	std::uint32_t fileId(const std::string *filename);
+
+	static void handleFatalSignal(int signal);
+
+	std::string filename_;
+	std::vector<Record> records_;
+	std::size_t mask_;
+	unsigned long long recorded_;
+	Clock::time_point start_;
+
+	// Filenames are interned, so compared by address
+	std::vector<const std::string *> files_;
+	const std::string *lastFile_;
+	std::uint32_t lastFileId_;
+
+	std::uint32_t function_;
+	std::uint16_t callDepth_;
+	std::vector<std::uint32_t> callers_;
+	std::vector<FunctionInfo> functions_;
+	std::unordered_map<Key, std::uint32_t, KeyHash> ids_;
+	bool handlingSignals_;
+};
+
+// Records a call to the function for its duration, if there is a buffer
+class TracedCall
+{
+public:
+	TracedCall(TraceBuffer *buffer, const Function &function)
+	:
+		buffer_(buffer)
+	{
+		if (buffer_)
+		{
+			buffer_->enter(function);
+		}
+	}
+
+	~TracedCall()
+	{
+		if (buffer_)
+		{
+			buffer_->leave();
+		}
+	}
+
+private:
+	// Deliberately private & unimplemented
+	TracedCall(const TracedCall &);
+	TracedCall &operator=(const TracedCall &);
+
+	TraceBuffer *buffer_;
+};
+
+#endif
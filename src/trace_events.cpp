@@ -0,0 +1,112 @@
+#include "trace_events.h"
+
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <fstream>
+#include <unistd.h>
+
+#include "escape.h"
+
+namespace
+{
+	typedef std::chrono::steady_clock Clock;
+
+	struct Event
+	{
+		const char *category;
+		std::string name;
+		long long start;
+		long long duration;
+		unsigned thread;
+	};
+
+	std::atomic<bool> enabled(false);
+	Clock::time_point origin;
+	std::mutex mutex;
+	std::vector<Event> events;
+	// Small numbers read better than std::thread::id in the viewers, the
+	// thread starting tracing being 1
+	std::map<std::thread::id, unsigned> threads;
+
+	long long microseconds(Clock::time_point time)
+	{
+		return std::chrono::duration_cast<std::chrono::microseconds>(time - origin).count();
+	}
+}
+
+void startTraceEvents()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	origin = Clock::now();
+	threads[std::this_thread::get_id()] = 1;
+	enabled = true;
+}
+
+void stopTraceEvents()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	enabled = false;
+	events.clear();
+	threads.clear();
+}
+
+bool traceEventsEnabled()
+{
+	return enabled.load(std::memory_order_relaxed);
+}
+
+bool writeTraceEvents(const std::string &filename)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	std::ofstream out(filename.c_str());
+	long pid = getpid();
+	out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+	for (std::size_t i = 0 ; i < events.size() ; ++i)
+	{
+		const Event &event = events[i];
+		out << (i == 0 ? "\n" : ",\n");
+		out << "  {\"name\": " << jsonString(event.name) << ", \"cat\": \"" << event.category << "\", \"ph\": \"X\"";
+		out << ", \"ts\": " << event.start << ", \"dur\": " << event.duration;
+		out << ", \"pid\": " << pid << ", \"tid\": " << event.thread << "}";
+	}
+	for (const auto &thread : threads)
+	{
+		out << (events.empty() ? "\n" : ",\n");
+		out << "  {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": " << pid << ", \"tid\": " << thread.second;
+		out << ", \"args\": {\"name\": \"" << (thread.second == 1 ? "main" : "worker") << "\"}}";
+	}
+	out << "\n]}\n";
+	return static_cast<bool>(out);
+}
+
+TraceSpan::TraceSpan(const char *category, const char *name, const std::string &detail)
+:
+	category_(category && traceEventsEnabled() ? category : nullptr)
+{
+	if (category_)
+	{
+		name_ = detail.empty() ? name : name + (" " + detail);
+		start_ = Clock::now();
+	}
+}
+
+TraceSpan::~TraceSpan()
+{
+	if (!category_)
+	{
+		return;
+	}
+	Clock::time_point end = Clock::now();
+	Event event = { category_, name_, microseconds(start_), microseconds(end) - microseconds(start_), 0 };
+	std::lock_guard<std::mutex> lock(mutex);
+	unsigned &thread = threads[std::this_thread::get_id()];
+	if (thread == 0)
+	{
+		thread = threads.size();
+	}
+	event.thread = thread;
+	events.push_back(event);
+}
@@ -0,0 +1,37 @@
+#ifndef TRACE_EVENTS_H
+#define TRACE_EVENTS_H
+
+#include <chrono>
+#include <string>
+
+// Spans of the interpreter's phases on all threads, such as lexing a file or
+// running a top level form, written in the Chrome trace event format for
+// chrome://tracing or Perfetto. Disabled, a span costs a check of a flag.
+void startTraceEvents();
+bool traceEventsEnabled();
+
+// Discards the spans recorded so far
+void stopTraceEvents();
+
+// The spans ended so far, false if the file could not be written
+bool writeTraceEvents(const std::string &filename);
+
+class TraceSpan
+{
+public:
+	// Named e.g. "lex file.rasp", from the name and the detail. Records
+	// nothing when tracing is disabled, or when the category is null.
+	TraceSpan(const char *category, const char *name, const std::string &detail);
+	~TraceSpan();
+
+private:
+	// Deliberately private & unimplemented
+	TraceSpan(const TraceSpan &);
+	TraceSpan &operator=(const TraceSpan &);
+
+	const char *category_;
+	std::string name_;
+	std::chrono::steady_clock::time_point start_;
+};
+
+#endif
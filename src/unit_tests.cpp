@@ -1,15 +1,33 @@
 #include "unit_tests.h"
 
+#include <limits>
 #include <cassert>
+#include <fstream>
 #include <iostream>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "token.h"
 #include "lexer.h"
 #include "parser.h"
+#include "bytecode.h"
+#include "profiler.h"
+#include "sampling_profiler.h"
+#include "allocation_profiler.h"
+#include "trace_buffer.h"
+#include "trace_events.h"
+#include "isolate.h"
+#include "channel.h"
+#include "work_stealing_pool.h"
 #include "settings.h"
+#include "output_sink.h"
+#include "array_kernels.h"
 #include "exceptions.h"
 #include "instruction.h"
 #include "interpreter.h"
+#include "global_names.h"
 #include "standard_math.h"
 #include "standard_library.h"
 #include "internal_function.h"
@@ -1089,6 +1107,796 @@ namespace
 		}
 	}
 
+	InstructionList roundTrip(const InstructionList &instructions)
+	{
+		BytecodeWriter writer;
+		writer.writeInstructions(instructions);
+		const std::string &buffer = writer.buffer();
+		BytecodeReader reader(buffer.data(), buffer.data() + buffer.size());
+		InstructionList result = reader.readInstructions();
+		assertTrue(reader.atEnd(), "Expected all bytecode to be consumed");
+		return result;
+	}
+
+	void testBytecodeRoundTrip(Interpreter &interpreter)
+	{
+		Source source;
+		source << "(type Person id name)";
+		source << "(defun outer (person)";
+		source << "  (var greeting \"Hello, \")";
+		source << "  (defun inner () (concat greeting person.name))";
+		source << "  inner)";
+		source << "(var greet (outer (new Person -7 \"Alice\")))";
+		source << "(greet)";
+		Token token = lex(source);
+		Declarations declarations = interpreter.declarations();
+		InstructionList instructions = parse(token, declarations, interpreter.settings());
+
+		InstructionList loaded = roundTrip(instructions);
+		assertEquals(loaded.size(), instructions.size());
+		for (unsigned i = 0 ; i < loaded.size() ; ++i)
+		{
+			assertEquals(loaded[i].type(), instructions[i].type());
+			assertEquals(str(loaded[i].sourceLocation()), str(instructions[i].sourceLocation()));
+		}
+
+		Value result = interpreter.exec(loaded);
+		assertEquals(result.type(), Value::TString);
+		assertEquals(result.string(), "Hello, Alice");
+	}
+
+	void testTruncatedBytecodeIsRejected(Interpreter &)
+	{
+		InstructionList instructions;
+		instructions.push_back(Instruction::push(CURRENT_SOURCE_LOCATION, Value::string("truncated")));
+		instructions.push_back(Instruction::refGlobal(CURRENT_SOURCE_LOCATION, Identifier("println")));
+		instructions.push_back(Instruction::call(CURRENT_SOURCE_LOCATION, 1));
+		BytecodeWriter writer;
+		writer.writeInstructions(instructions);
+		const std::string &buffer = writer.buffer();
+		for (unsigned length = 0 ; length < buffer.size() ; ++length)
+		{
+			try
+			{
+				BytecodeReader reader(buffer.data(), buffer.data() + length);
+				reader.readInstructions();
+				fail("Expected BytecodeError");
+			}
+			catch (const BytecodeError &)
+			{
+			}
+		}
+	}
+
+	void testGlobalNamesConsistency(Interpreter &interpreter)
+	{
+		Token token = lex("(var answer 42) (defun show () (println answer))");
+		Declarations declarations = interpreter.declarations();
+		InstructionList instructions = parse(token, declarations, interpreter.settings());
+
+		GlobalNames names(instructions);
+		assertTrue(names.consistentWith(interpreter), "Expected names to match the globals before running");
+		interpreter.exec(instructions);
+		assertTrue(!names.consistentWith(interpreter), "Expected 'answer' to be already defined");
+	}
+
+	void testDeclarationsScopeChain(Interpreter &interpreter)
+	{
+		Identifier global("println");
+		Identifier outerName("outerName");
+		Identifier innerName("innerName");
+
+		Declarations declarations = interpreter.declarations();
+		Declarations outer = declarations.newScope();
+		outer.add(outerName);
+		Declarations inner = outer.newScope();
+		inner.add(innerName);
+
+		assertEquals(inner.checkIdentifier(global), IDENTIFIER_DEFINITION_GLOBAL);
+		assertEquals(inner.checkIdentifier(outerName), IDENTIFIER_DEFINITION_CLOSURE);
+		assertEquals(inner.checkIdentifier(innerName), IDENTIFIER_DEFINITION_LOCAL);
+		assertEquals(outer.checkIdentifier(outerName), IDENTIFIER_DEFINITION_LOCAL);
+		assertEquals(outer.checkIdentifier(innerName), IDENTIFIER_DEFINITION_UNDEFINED);
+
+		// A copy has its own innermost scope
+		Declarations copy = outer;
+		copy.add(innerName);
+		assertEquals(copy.checkIdentifier(innerName), IDENTIFIER_DEFINITION_LOCAL);
+		assertEquals(outer.checkIdentifier(innerName), IDENTIFIER_DEFINITION_UNDEFINED);
+	}
+
+	void testSnapshotPreservesSharedClosureState(Interpreter &interpreter)
+	{
+		Source source;
+		source << "(type Counter increment read)";
+		source << "(defun makeCounter ()";
+		source << "  (var count 0)";
+		source << "  (defun increment () (set count (+ count 1)))";
+		source << "  (defun read () count)";
+		source << "  (new Counter increment read))";
+		source << "(var counter (makeCounter))";
+		source << "(var output println)";
+		source << "(counter.increment)";
+		execute(interpreter, source);
+
+		BytecodeWriter writer;
+		writer.writeBindings(interpreter.globals());
+		const std::string &buffer = writer.buffer();
+
+		Interpreter::Globals builtins;
+		standardMath(builtins);
+		standardLibrary(builtins);
+		BytecodeReader reader(buffer.data(), buffer.data() + buffer.size());
+		reader.resolveExternalFunctionsFrom(&builtins);
+		Interpreter::Globals globals = reader.readBindings();
+		assertTrue(reader.atEnd(), "Expected all bytecode to be consumed");
+
+		Interpreter restored(globals, interpreter.settings());
+		execute(restored, "(counter.increment)");
+		Value result = execute(restored, "(counter.read)");
+		assertEquals(result.type(), Value::TNumber);
+		assertEquals(result.number(), 2);
+
+		result = execute(restored, "(output \"restored\")");
+		assertEquals(result.type(), Value::TNil);
+	}
+
+	void testProfilerCountsOpcodesAndLines(Interpreter &interpreter)
+	{
+		Source source;
+		source << "(var total 0)";
+		source << "(var i 0)";
+		source << "(while (< i 10)";
+		source << "  (set total (+ total i))";
+		source << "  (inc i))";
+		Token token = (::lex)("profiled.rasp", source.str());
+		Declarations declarations = interpreter.declarations();
+		InstructionList instructions = parse(token, declarations, interpreter.settings());
+
+		Profiler profiler;
+		interpreter.profile(&profiler);
+		unsigned long long before = interpreter.instructionsExecuted();
+		interpreter.exec(instructions);
+		interpreter.profile(nullptr);
+
+		unsigned long long executions = 0;
+		for (int i = 0 ; i < Instruction::TYPE_COUNT ; ++i)
+		{
+			executions += profiler.executions(static_cast<Instruction::Type>(i));
+		}
+		assertEquals(executions, interpreter.instructionsExecuted() - before);
+		assertEquals(profiler.executions(Instruction::INIT_GLOBAL), 2ull);
+
+		unsigned long long once = profiler.executions(SourceLocation("profiled.rasp", 1));
+		unsigned long long loopBody = profiler.executions(SourceLocation("profiled.rasp", 4));
+		assertTrue(once > 0, "Expected the first line to be counted");
+		assertEquals(loopBody % 10, 0ull);
+		assertTrue(loopBody >= 10 * once, "Expected the loop body to be counted each iteration");
+	}
+
+	void testSamplingProfilerRecordsCallStacks(Interpreter &interpreter)
+	{
+		Source source;
+		source << "(defun spin (count)";
+		source << "  (var i 0)";
+		source << "  (while (< i count) (inc i))";
+		source << "  i)";
+		execute(interpreter, source);
+
+		SamplingProfiler profiler(1000);
+		assertTrue(profiler.start(), "Expected the profiler to start");
+		interpreter.sample(&profiler);
+		// CPU time, so keep going until the timer has fired a few times
+		for (int i = 0 ; i < 100 && profiler.samples() < 5 ; ++i)
+		{
+			execute(interpreter, "(spin 2000)");
+		}
+		interpreter.sample(nullptr);
+		profiler.stop();
+		assertTrue(profiler.samples() >= 5, "Expected samples");
+
+		std::stringstream folded;
+		profiler.writeFoldedStacks(folded);
+		assertTrue(folded.str().find("(toplevel);spin") != std::string::npos, "Expected spin to be sampled: " + folded.str());
+
+		std::stringstream pprof;
+		profiler.writePprof(pprof);
+		assertTrue(pprof.str().find("spin") != std::string::npos, "Expected spin in the string table");
+	}
+
+	void testAllocationsAreAccountedAndAttributed(Interpreter &interpreter)
+	{
+		Value before = execute(interpreter, "(runtime_stats)");
+		assertEquals(before.type(), Value::TObject);
+		Value kept = Value::string(std::string(1000, 'x'));
+		Value after = execute(interpreter, "(runtime_stats)");
+		int stringBytes = after.object().at("string_bytes").number() - before.object().at("string_bytes").number();
+		assertTrue(stringBytes >= 1000, "Expected the string to be counted, but got " + str(stringBytes));
+		assertTrue(after.object().at("peak_bytes").number() >= after.object().at("live_bytes").number(), "Expected the peak to include the live bytes");
+
+		Source source;
+		source << "(defun pad (text) (concat text text))";
+		source << "(defun outer (text) (pad (pad text)))";
+		Token token = (::lex)("allocating.rasp", source.str());
+		Declarations declarations = interpreter.declarations();
+		interpreter.exec(parse(token, declarations, interpreter.settings()));
+
+		AllocationProfiler profiler;
+		interpreter.profileAllocations(&profiler);
+		execute(interpreter, "(outer \"a string too long for the small string optimisation\")");
+		interpreter.profileAllocations(nullptr);
+
+		SourceLocation pad("allocating.rasp", 1);
+		SourceLocation outer("allocating.rasp", 2);
+		assertTrue(profiler.inclusiveBytes(pad) > 0, "Expected pad to allocate");
+		assertEquals(profiler.inclusiveBytes(outer), profiler.exclusiveBytes(outer) + profiler.inclusiveBytes(pad));
+	}
+
+	void testTraceBufferKeepsTheLastInstructions(Interpreter &interpreter)
+	{
+		Source source;
+		source << "(defun traced (n) (+ n 1))";
+		execute(interpreter, source);
+
+		std::string filename = "rasp-unit-test-trace.bin";
+		TraceBuffer buffer(filename, 10);
+		interpreter.traceBuffer(&buffer);
+		unsigned long long before = interpreter.instructionsExecuted();
+		execute(interpreter, "(traced (traced (traced (traced 1))))");
+		interpreter.traceBuffer(nullptr);
+		assertEquals(buffer.recorded(), interpreter.instructionsExecuted() - before);
+		assertTrue(buffer.recorded() > 16, "Expected more instructions than the buffer holds");
+		assertTrue(buffer.dump(), "Expected the trace to be written");
+
+		std::stringstream decoded;
+		bool ok = TraceBuffer::decode(filename, decoded);
+		std::remove(filename.c_str());
+		assertTrue(ok, "Expected the trace to decode");
+		std::string text = decoded.str();
+		assertTrue(text.find("Last 16 of " + str(buffer.recorded()) + " instructions") != std::string::npos, "Expected a full buffer: " + text);
+		assertTrue(text.find("ref_local") != std::string::npos, "Expected the opcodes: " + text);
+		assertTrue(text.find(", in traced (") != std::string::npos, "Expected the function: " + text);
+	}
+
+	void testTraceEventsRecordFormsAndTopLevelCalls(Interpreter &interpreter)
+	{
+		startTraceEvents();
+		Source source;
+		source << "(defun spanned (n) (+ n 1))";
+		source << "(defun twice (n) (spanned (spanned n)))";
+		source << "(twice 1)";
+		execute(interpreter, source);
+
+		std::string filename = "rasp-unit-test-trace.json";
+		bool written = writeTraceEvents(filename);
+		stopTraceEvents();
+		std::ifstream file(filename.c_str());
+		std::string json((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+		std::remove(filename.c_str());
+		assertTrue(written, "Expected the trace to be written");
+
+		assertTrue(json.find("\"name\": \"parse defun spanned (") != std::string::npos, "Expected a span parsing the defun: " + json);
+		assertTrue(json.find("\"name\": \"call twice\"") != std::string::npos, "Expected a span for the call: " + json);
+		// Not called from the top level
+		assertTrue(json.find("\"name\": \"call spanned\"") == std::string::npos, "Expected no spans for nested calls: " + json);
+		assertTrue(json.find("\"ph\": \"X\"") != std::string::npos, "Expected complete events: " + json);
+	}
+
+	void testIsolatesShareNoState(Interpreter &interpreter)
+	{
+		Source source;
+		source << "(var shared 10)";
+		source << "(defun work (n) (set shared (+ shared n)) shared)";
+		source << "(var worker (spawn work 5))";
+		source << "(+ (* 100 (join worker)) shared)";
+		Value result = execute(interpreter, source);
+		assertEquals(result.type(), Value::TNumber);
+		assertEquals(result.number(), 1510);
+
+		bool failed = false;
+		try
+		{
+			execute(interpreter, "(defun fail () (/ 1 0)) (join (spawn fail))");
+		}
+		catch (const ExternalFunctionError &e)
+		{
+			failed = std::string(e.what()).find("cannot divide by zero") != std::string::npos;
+		}
+		assertTrue(failed, "Expected joining a failed isolate to report its error");
+
+		Source counter;
+		counter << "(defun makeCounter ()";
+		counter << "  (var count 0)";
+		counter << "  (defun bump () (set count (+ count 1)) count)";
+		counter << "  bump)";
+		counter << "(var counter (makeCounter))";
+		counter << "(counter)";
+		counter << "counter";
+		Value original = execute(interpreter, counter);
+		Value copy = IsolatingCopier().copy(original);
+		assertEquals(interpreter.call(copy, Arguments()).number(), 2);
+		assertEquals(interpreter.call(copy, Arguments()).number(), 3);
+		// The original's count is a different cell
+		assertEquals(interpreter.call(original, Arguments()).number(), 2);
+	}
+
+	void testChannelsPassValuesBetweenIsolates(Interpreter &interpreter)
+	{
+		Source source;
+		source << "(defun produce (channel from count)";
+		source << "  (var i 0)";
+		source << "  (while (< i count)";
+		source << "    (chan_send channel (array (+ from i) \"payload\"))";
+		source << "    (set i (+ i 1)))";
+		source << "  count)";
+		source << "(var channel (chan_new 2))";
+		source << "(var producers (array (spawn produce channel 0 100) (spawn produce channel 100 100)))";
+		source << "(var total 0)";
+		source << "(var received 0)";
+		source << "(while (< received 200)";
+		source << "  (set total (+ total (array_element (chan_recv channel) 0)))";
+		source << "  (set received (+ received 1)))";
+		source << "(join (array_element producers 0))";
+		source << "(join (array_element producers 1))";
+		source << "(chan_close channel)";
+		source << "(array total (chan_recv channel))";
+		Value result = execute(interpreter, source);
+		assertEquals(result.array().at(0).number(), 19900);
+		assertTrue(result.array().at(1).isNil(), "Expected nil from a closed, empty channel");
+
+		bool failed = false;
+		try
+		{
+			execute(interpreter, "(var closed (chan_new 1)) (chan_close closed) (chan_send closed 1)");
+		}
+		catch (const ExternalFunctionError &e)
+		{
+			failed = std::string(e.what()).find("closed channel") != std::string::npos;
+		}
+		assertTrue(failed, "Expected sending on a closed channel to fail");
+
+		// Channels are values, freed with the last copy, rather than ids
+		failed = false;
+		try
+		{
+			execute(interpreter, "(chan_send 1 2)");
+		}
+		catch (const ExternalFunctionError &e)
+		{
+			failed = std::string(e.what()).find("Expected a channel") != std::string::npos;
+		}
+		assertTrue(failed, "Expected a number not to be accepted as a channel");
+
+		std::weak_ptr<Channel> released;
+		{
+			Value handle = execute(interpreter, "(chan_new 4)");
+			const ChannelHandle *channelHandle = dynamic_cast<const ChannelHandle *>(&handle.function());
+			assertTrue(channelHandle != nullptr, "Expected chan_new to return a channel");
+			released = channelHandle->channel();
+			assertTrue(!released.expired(), "Expected the channel to live while a copy does");
+		}
+		assertTrue(released.expired(), "Expected the channel to be freed with the last copy");
+
+		// Handed over as it is, leaving nil
+		Value text = Value::string("not copied");
+		const std::string *buffer = &text.string();
+		Value transferred = transferable(text);
+		assertTrue(&transferred.string() == buffer, "Expected the string to be handed over");
+		assertTrue(text.isNil(), "Expected nothing left to send");
+
+		Channel channel(1);
+		Value sent = Value::number(42);
+		Value received;
+		assertTrue(channel.send(sent), "Expected room in the channel");
+		assertTrue(channel.receive(received), "Expected the value sent");
+		assertEquals(received.number(), 42);
+	}
+
+	void testParallelBuiltinsKeepOrder(Interpreter &interpreter)
+	{
+		Source source;
+		source << "(defun square (n) (* n n))";
+		source << "(defun odd (n) (== (% n 2) 1))";
+		source << "(defun add (a b) (+ a b))";
+		source << "(array (parallel_map square (array 1 2 3 4 5)) (parallel_filter odd (array 1 2 3 4 5 6 7)) (parallel_reduce add 1000 (array 1 2 3 4 5)) (parallel_map square (array)))";
+		Value result = execute(interpreter, source);
+		const Value::Array &results = result.array();
+		assertEquals(str(results.at(0)), "[1, 4, 9, 16, 25]");
+		assertEquals(str(results.at(1)), "[1, 3, 5, 7]");
+		assertEquals(results.at(2).number(), 1015);
+		assertEquals(str(results.at(3)), "[]");
+
+		bool failed = false;
+		try
+		{
+			execute(interpreter, "(defun boom (n) (/ n 0)) (parallel_map boom (array 1 2 3))");
+		}
+		catch (const ExternalFunctionError &e)
+		{
+			failed = std::string(e.what()).find("cannot divide by zero") != std::string::npos;
+		}
+		assertTrue(failed, "Expected an error in a worker to be reported by the caller");
+
+		// The chunks share the globals they only read, and assign their own
+		Source assigning;
+		assigning << "(var parallelOffset 100)";
+		assigning << "(defun offset (n) (set parallelOffset (+ parallelOffset 1)) (- parallelOffset n))";
+		assigning << "(array (array_length (parallel_map offset (array 1 2 3 4 5 6 7 8))) parallelOffset)";
+		Value assigned = execute(interpreter, assigning);
+		assertEquals(str(assigned), "[8, 100]");
+
+		// Tasks running tasks, on more tasks than threads
+		WorkStealingPool pool(2);
+		std::atomic<int> total(0);
+		std::vector<WorkStealingPool::Task> tasks;
+		for (int i = 0 ; i < 8 ; ++i)
+		{
+			tasks.push_back([&pool, &total]() {
+				std::vector<WorkStealingPool::Task> nested(4, [&total]() { ++total; });
+				pool.run(nested);
+			});
+		}
+		pool.run(tasks);
+		assertEquals(total.load(), 32);
+	}
+
+	void testAsyncTasksAwaitedInsideTasks(Interpreter &interpreter)
+	{
+		Source source;
+		source << "(defun fib (n)";
+		source << "  (if (< n 2)";
+		source << "    n";
+		source << "  else";
+		source << "    (+ (await (async fib (- n 1))) (fib (- n 2)))))";
+		source << "(var future (async fib 12))";
+		source << "(await future)";
+		Value result = execute(interpreter, source);
+		assertEquals(result.type(), Value::TNumber);
+		assertEquals(result.number(), 144);
+
+		bool failed = false;
+		try
+		{
+			execute(interpreter, "(await future)");
+		}
+		catch (const ExternalFunctionError &e)
+		{
+			failed = std::string(e.what()).find("already awaited") != std::string::npos;
+		}
+		assertTrue(failed, "Expected a future to be awaited once");
+
+		failed = false;
+		try
+		{
+			execute(interpreter, "(defun boom () (/ 1 0)) (await (async boom))");
+		}
+		catch (const ExternalFunctionError &e)
+		{
+			failed = std::string(e.what()).find("cannot divide by zero") != std::string::npos;
+		}
+		assertTrue(failed, "Expected awaiting a failed task to rethrow its error");
+
+		// A task awaiting itself, given its own future through a channel
+		failed = false;
+		try
+		{
+			Source selfish;
+			selfish << "(defun await_self (channel) (await (chan_recv channel)))";
+			selfish << "(var selfChannel (chan_new 1))";
+			selfish << "(var selfFuture (async await_self selfChannel))";
+			selfish << "(chan_send selfChannel selfFuture)";
+			selfish << "(await selfFuture)";
+			execute(interpreter, selfish);
+		}
+		catch (const ExternalFunctionError &e)
+		{
+			failed = std::string(e.what()).find("would deadlock") != std::string::npos;
+		}
+		assertTrue(failed, "Expected a task awaiting itself to fail rather than deadlock");
+	}
+
+	void testGeneratorsYieldUntilFinished(Interpreter &interpreter)
+	{
+		Source source;
+		source << "(defun count_up (n)";
+		source << "  (var i 0)";
+		source << "  (while (< i n)";
+		source << "    (set i (+ i 1))";
+		source << "    (yield i)))";
+		source << "(defun doubled (generator)";
+		source << "  (var value (next generator))";
+		source << "  (while value";
+		source << "    (yield (* value 2))";
+		source << "    (set value (next generator))))";
+		source << "(var numbers (doubled (count_up 4)))";
+		source << "(var total 0)";
+		source << "(var value (next numbers))";
+		source << "(while value";
+		source << "  (set total (+ total value))";
+		source << "  (set value (next numbers)))";
+		source << "(+ total (if (next numbers) 100 else 0))";
+		Value result = execute(interpreter, source);
+		assertEquals(result.type(), Value::TNumber);
+		assertEquals(result.number(), 20);
+
+		Source twice;
+		twice << "(defun from (n) (yield n) (yield (+ n 1)))";
+		twice << "(var pair (from 5))";
+		twice << "(var first (next pair))";
+		twice << "(var second (next pair))";
+		twice << "(var last (next pair))";
+		twice << "(if last 0 else (+ (* first 10) second))";
+		result = execute(interpreter, twice);
+		assertEquals(result.number(), 56);
+
+		result = execute(interpreter, "(var j 0) (while (< j 3) (set j (+ j 1)) (* j 10))");
+		assertEquals(result.number(), 30);
+
+		// A generator's frame belongs to the interpreter that made it, so
+		// what another isolate or task is handed cannot be resumed
+		execute(interpreter, "(defun make_count () (count_up 3)) (var generatorChannel (chan_new 1))");
+		const char *crossings[] =
+		{
+			"(next (await (async make_count)))",
+			"(next (array_element (parallel_map count_up (array 1 2 3)) 0))",
+			"(chan_send generatorChannel (count_up 3)) (next (chan_recv generatorChannel))",
+		};
+		for (const char *crossing : crossings)
+		{
+			bool detached = false;
+			try
+			{
+				execute(interpreter, crossing);
+			}
+			catch (const ExecutionError &e)
+			{
+				detached = std::string(e.what()).find("belongs to another isolate") != std::string::npos;
+			}
+			assertTrue(detached, std::string("Expected a detached generator from ") + crossing);
+		}
+
+		Token token = lex("(yield 1)");
+		Declarations declarations = interpreter.declarations();
+		try
+		{
+			parse(token, declarations, interpreter.settings());
+			fail("Expected ParseError");
+		}
+		catch (const ParseError &e)
+		{
+			assertEquals(e.what(), "Keyword 'yield' can only be used inside a defun");
+		}
+	}
+
+	void testEventLoopRunsIoCallbacks(Interpreter &interpreter)
+	{
+		int fds[2];
+		assertTrue(::pipe(fds) == 0, "Expected a pipe");
+		assertTrue(::write(fds[1], "piped", 5) == 5, "Expected to write to the pipe");
+		::close(fds[1]);
+
+		std::string filename = "rasp-unit-test-events.txt";
+		Source source;
+		source << "(var event_log \"\")";
+		source << "(defun logged (text) (set event_log (concat event_log text \";\")))";
+		source << "(defun on_read (text) (logged text))";
+		source << "(defun on_written (count)";
+		source << "  (logged (to_str count))";
+		source << "  (file_read \"" + filename + "\" on_read))";
+		source << "(defun on_timer () (logged \"timer\"))";
+		source << "(defun on_chunk (text) (logged (if (is_nil text) \"eof\" else text)))";
+		source << "(timer 20 on_timer)";
+		source << "(file_write \"" + filename + "\" \"written\" on_written)";
+		source << "(pipe_read \"/dev/fd/" + str(fds[0]) + "\" on_chunk)";
+		source << "(var callbacks (run_events))";
+		source << "(concat callbacks \":\" event_log)";
+		Value result = execute(interpreter, source);
+		::close(fds[0]);
+		std::remove(filename.c_str());
+		const std::string &text = result.string();
+		assertTrue(text.find("5:") == 0, "Expected 5 callbacks: " + text);
+		assertTrue(text.find("7;") != std::string::npos && text.find("7;") < text.find("written;"), "Expected the write before the read: " + text);
+		assertTrue(text.find("piped;eof;") != std::string::npos, "Expected the pipe's chunk then its end: " + text);
+		assertTrue(text.find("timer;") == text.size() - 6, "Expected the timer last: " + text);
+
+		bool failed = false;
+		try
+		{
+			execute(interpreter, "(file_read \"rasp-unit-test-missing.txt\" on_read)");
+		}
+		catch (const ExternalFunctionError &e)
+		{
+			failed = std::string(e.what()).find("Cannot open 'rasp-unit-test-missing.txt'") != std::string::npos;
+		}
+		assertTrue(failed, "Expected reading a missing file to fail");
+	}
+
+	// Whatever is waiting in the pipe, without blocking
+	std::string readAvailable(int fd)
+	{
+		char buffer[256];
+		ssize_t count = ::read(fd, buffer, sizeof(buffer));
+		return count > 0 ? std::string(buffer, count) : "";
+	}
+
+	void testOutputSinkWritesWholeLines(Interpreter &interpreter)
+	{
+		int fds[2];
+		assertTrue(::pipe(fds) == 0, "Expected a pipe");
+		::fcntl(fds[0], F_SETFL, O_NONBLOCK);
+		{
+			OutputSink sink(fds[1], 16);
+			sink.stream() << "first line\n" << "second";
+			assertEquals(readAvailable(fds[0]), "first line\n");
+			assertTrue(sink.flush(), "Expected to write to the pipe");
+			assertEquals(readAvailable(fds[0]), "second");
+			sink.stream() << " and last\n";
+			assertEquals(readAvailable(fds[0]), "");
+		}
+		assertEquals(readAvailable(fds[0]), " and last\n");
+
+		Settings settings = interpreter.settings();
+		settings.outputFd = fds[1];
+		Interpreter printer(interpreter.globals(), settings);
+		execute(printer, "(print \"a\" 1) (println \"b\") (debug \"c\")");
+		assertEquals(readAvailable(fds[0]), "");
+		execute(printer, "(flush)");
+		assertEquals(readAvailable(fds[0]), "a1b\nc\n");
+		::close(fds[0]);
+		::close(fds[1]);
+	}
+
+	void testFileLinesAreReadFromTheMapping(Interpreter &interpreter)
+	{
+		std::string filename = "rasp-unit-test-lines.txt";
+		std::ofstream(filename.c_str()) << "one\n\nthree";
+
+		Source source;
+		source << "(var mapped (file_open_mmap \"" + filename + "\"))";
+		source << "(var lines (file_lines mapped))";
+		source << "(var copy lines)";
+		source << "(var first (next lines))";
+		source << "(var empty (next copy))";
+		source << "(var third (next lines))";
+		source << "(var end (next copy))";
+		source << "(file_close mapped)";
+		source << "(if (is_nil end) (concat first \",\" empty \",\" third) else \"not finished\")";
+		Value result = execute(interpreter, source);
+		assertEquals(result.string(), "one,,three");
+
+		result = execute(interpreter, "(file_read_all \"" + filename + "\")");
+		std::remove(filename.c_str());
+		assertEquals(result.string(), "one\n\nthree");
+
+		bool failed = false;
+		try
+		{
+			execute(interpreter, "(file_close mapped)");
+		}
+		catch (const ExternalFunctionError &e)
+		{
+			failed = std::string(e.what()).find("Expected 1 open file argument") != std::string::npos;
+		}
+		assertTrue(failed, "Expected a file to be closed once");
+	}
+
+	void testFloatsAndInt64Arithmetic(Interpreter &interpreter)
+	{
+		Value result = execute(interpreter, "(* 3000000000 3)");
+		assertEquals(result.number(), 9000000000LL);
+
+		result = execute(interpreter, "(/ 7 2)");
+		assertEquals(result.number(), 3);
+
+		result = execute(interpreter, "(+ 1 2.5)");
+		assertTrue(result.isFloat(), "Expected an integer and a float to add to a float");
+		assertEquals(result.floating(), 3.5);
+
+		result = execute(interpreter, "(concat (/ 7.0 2) \",\" 2.0 \",\" 1e3 \",\" (== 1 1.0))");
+		assertEquals(result.string(), "3.5,2.0,1000.0,true");
+
+		// Past 2^53 an integer rounded to a double equals its neighbours
+		result = execute(interpreter, "(concat (== 9007199254740993 9007199254740992.0) \",\" (> 9007199254740993 9007199254740992.0) \",\" (< 9223372036854775807 9223372036854775808.0) \",\" (<= -1 -0.5) \",\" (>= 2.5 2))");
+		assertEquals(result.string(), "false,true,true,true,true");
+
+		result = execute(interpreter, "(array_index_of (float_array 9007199254740992.0) 9007199254740993)");
+		assertEquals(result.number(), -1);
+
+		const char *badSizes[] = { "(array_new -1)", "(array_new 9223372036854775807)" };
+		for (const char *badSize : badSizes)
+		{
+			bool rejected = false;
+			try
+			{
+				execute(interpreter, badSize);
+			}
+			catch (const ExternalFunctionError &e)
+			{
+				rejected = std::string(e.what()).find("array_new") != std::string::npos;
+			}
+			assertTrue(rejected, std::string("Expected an error from ") + badSize);
+		}
+
+		bool failed = false;
+		try
+		{
+			execute(interpreter, "(* 9223372036854775807 2)");
+		}
+		catch (const ExternalFunctionError &e)
+		{
+			failed = std::string(e.what()).find("integer overflow") != std::string::npos;
+		}
+		assertTrue(failed, "Expected integer overflow to be an error");
+	}
+
+	void testPackedArrayKernelsAgreeAtEveryLevel(Interpreter &interpreter)
+	{
+		Value result = execute(interpreter, "(array_sum (array_add (int_array 1 2 3 4 5) (array 10 20 30 40 50)))");
+		assertEquals(result.number(), 165);
+
+		result = execute(interpreter, "(array_index_of (array_scale (float_array 1 3 5) 0.5) 2.5)");
+		assertEquals(result.number(), 2);
+
+		result = execute(interpreter, "(== (int_array 1 2 3) (array 1 2 3.0))");
+		assertTrue(result.boolean(), "Expected packed and boxed arrays of equal numbers to be equal");
+
+		// Enough elements for every vector width plus a tail, with halves that
+		// carry when summed, and floats whose sums are exact in any order
+		std::vector<long long> ints;
+		std::vector<double> floats;
+		for (int i = 0 ; i < 11 ; ++i)
+		{
+			ints.push_back((i % 3 == 0 ? -1 : 1) * 0x1234567890LL * (i + 1));
+			floats.push_back((i % 2 == 0 ? -1 : 1) * 0.5 * i);
+		}
+		SimdLevel detected = detectedSimdLevel();
+		for (std::size_t size = 1 ; size <= ints.size() ; ++size)
+		{
+			setSimdLevel(SIMD_SCALAR);
+			long long intSum = 0;
+			assertTrue(sumInts(ints.data(), size, intSum), "Expected no overflow");
+			double floatSum = sumFloats(floats.data(), size);
+			std::vector<long long> intTotals(size);
+			assertTrue(addInts(ints.data(), ints.data(), intTotals.data(), size), "Expected no overflow");
+			std::vector<double> floatTotals(size);
+			addFloats(floats.data(), floats.data(), floatTotals.data(), size);
+
+			for (int level = SIMD_SSE42 ; level <= detected ; ++level)
+			{
+				setSimdLevel(static_cast<SimdLevel>(level));
+				long long sum = 0;
+				assertTrue(sumInts(ints.data(), size, sum), "Expected no overflow");
+				assertEquals(sum, intSum);
+				assertEquals(sumFloats(floats.data(), size), floatSum);
+				assertEquals(minInt(ints.data(), size), *std::min_element(ints.begin(), ints.begin() + size));
+				assertEquals(maxInt(ints.data(), size), *std::max_element(ints.begin(), ints.begin() + size));
+				assertEquals(minFloat(floats.data(), size), *std::min_element(floats.begin(), floats.begin() + size));
+				assertEquals(maxFloat(floats.data(), size), *std::max_element(floats.begin(), floats.begin() + size));
+				std::vector<long long> totals(size);
+				assertTrue(addInts(ints.data(), ints.data(), totals.data(), size), "Expected no overflow");
+				assertTrue(totals == intTotals, "Expected the same sums at every level");
+				std::vector<double> sums(size);
+				addFloats(floats.data(), floats.data(), sums.data(), size);
+				assertTrue(sums == floatTotals, "Expected the same sums at every level");
+				assertEquals(indexOfInt(ints.data(), size, ints[size - 1]), size - 1);
+				assertEquals(indexOfFloat(floats.data(), size, 1000.0), size);
+			}
+		}
+
+		// Only the whole sum overflowing counts, at every level
+		long long max = std::numeric_limits<long long>::max();
+		long long carried[] = { max, 1, 0, 0, -1, 0, 0 };
+		long long overflowing[] = { max, 1, 0, 0, 0, 0, 0 };
+		for (int level = SIMD_SCALAR ; level <= detected ; ++level)
+		{
+			setSimdLevel(static_cast<SimdLevel>(level));
+			long long sum = 0;
+			assertTrue(sumInts(carried, 7, sum) && sum == max, "Expected a sum back in range");
+			assertTrue(!sumInts(overflowing, 7, sum), "Expected the sum to overflow");
+		}
+		setSimdLevel(detected);
+	}
+
 }
 
 namespace
@@ -1205,6 +2013,26 @@ static UnitTest tests[] = {
 	TEST_CASE(testCannotFormatFunctions),
 	TEST_CASE(testCannotPrintTypes),
 	TEST_CASE(testCannotPrintlnObjects),
+	TEST_CASE(testBytecodeRoundTrip),
+	TEST_CASE(testTruncatedBytecodeIsRejected),
+	TEST_CASE(testGlobalNamesConsistency),
+	TEST_CASE(testDeclarationsScopeChain),
+	TEST_CASE(testSnapshotPreservesSharedClosureState),
+	TEST_CASE(testProfilerCountsOpcodesAndLines),
+	TEST_CASE(testSamplingProfilerRecordsCallStacks),
+	TEST_CASE(testAllocationsAreAccountedAndAttributed),
+	TEST_CASE(testTraceBufferKeepsTheLastInstructions),
+	TEST_CASE(testTraceEventsRecordFormsAndTopLevelCalls),
+	TEST_CASE(testIsolatesShareNoState),
+	TEST_CASE(testChannelsPassValuesBetweenIsolates),
+	TEST_CASE(testParallelBuiltinsKeepOrder),
+	TEST_CASE(testAsyncTasksAwaitedInsideTasks),
+	TEST_CASE(testGeneratorsYieldUntilFinished),
+	TEST_CASE(testEventLoopRunsIoCallbacks),
+	TEST_CASE(testOutputSinkWritesWholeLines),
+	TEST_CASE(testFileLinesAreReadFromTheMapping),
+	TEST_CASE(testFloatsAndInt64Arithmetic),
+	TEST_CASE(testPackedArrayKernelsAgreeAtEveryLevel),
 };
 
 int runUnitTests(const Settings &settings)
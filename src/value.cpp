@@ -1,5 +1,8 @@
 #include "value.h"
 
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <iostream>
 #include <algorithm>
@@ -8,6 +11,7 @@
 #include "bug.h"
 #include "utils.h"
 #include "escape.h"
+#include "allocations.h"
 #include "function.h"
 #include "type_definition.h"
 #include "execution_error.h"
@@ -17,12 +21,18 @@ Value::Value()
 {
 }
 
-Value::Value(int number)
+Value::Value(long long number)
 	: type_(TNumber)
 {
 	data_.number = number;
 }
 
+Value::Value(double number)
+	: type_(TFloat)
+{
+	data_.floating = number;
+}
+
 Value::Value(bool boolean)
 	: type_(TBoolean)
 {
@@ -32,30 +42,56 @@ Value::Value(bool boolean)
 Value::Value(const Function &function)
 	: type_(TFunction)
 {
+	AllocationScope allocationScope(ALLOCATION_FUNCTION);
 	data_.function = function.clone();
 }
 
 Value::Value(const Object &object)
 	: type_(TObject)
 {
+	AllocationScope allocationScope(ALLOCATION_OBJECT);
 	data_.object = new Object(object);
 }
 
 Value::Value(const std::string &text)
 	: type_(TString)
 {
+	AllocationScope allocationScope(ALLOCATION_STRING);
 	data_.string = new std::string(text);
 }
 
+Value::Value(const char *text, std::size_t size)
+	: type_(TString)
+{
+	AllocationScope allocationScope(ALLOCATION_STRING);
+	data_.string = new std::string(text, size);
+}
+
 Value::Value(const Array &elements)
 	: type_(TArray)
 {
+	AllocationScope allocationScope(ALLOCATION_ARRAY);
 	data_.array = new Array(elements);
 }
 
+Value::Value(const IntArray &elements)
+	: type_(TIntArray)
+{
+	AllocationScope allocationScope(ALLOCATION_ARRAY);
+	data_.intArray = new IntArray(elements);
+}
+
+Value::Value(const FloatArray &elements)
+	: type_(TFloatArray)
+{
+	AllocationScope allocationScope(ALLOCATION_ARRAY);
+	data_.floatArray = new FloatArray(elements);
+}
+
 Value::Value(const TypePointer &typeDefinition)
 	: type_(TTypeDefinition)
 {
+	AllocationScope allocationScope(ALLOCATION_TYPE_DEFINITION);
 	data_.typeDefinition = new TypePointer(typeDefinition);
 }
 
@@ -77,6 +113,14 @@ Value::~Value()
 	{
 		delete data_.array;
 	}
+	else if(type_ == TIntArray)
+	{
+		delete data_.intArray;
+	}
+	else if(type_ == TFloatArray)
+	{
+		delete data_.floatArray;
+	}
 	else if(type_ == TTypeDefinition)
 	{
 		delete data_.typeDefinition;
@@ -86,24 +130,40 @@ Value::~Value()
 Value::Value(const Value &value)
 	: type_(value.type_)
 {
+	// Elements and members are copied in their own scopes
 	if(type_ == TFunction)
 	{
+		AllocationScope allocationScope(ALLOCATION_FUNCTION);
 		data_.function = value.data_.function->clone();
 	}
 	else if(type_ == TString)
 	{
+		AllocationScope allocationScope(ALLOCATION_STRING);
 		data_.string = new std::string(*value.data_.string);
 	}
 	else if(type_ == TObject)
 	{
+		AllocationScope allocationScope(ALLOCATION_OBJECT);
 		data_.object = new Object(*value.data_.object);
 	}
 	else if(type_ == TArray)
 	{
+		AllocationScope allocationScope(ALLOCATION_ARRAY);
 		data_.array = new Array(*value.data_.array);
 	}
+	else if(type_ == TIntArray)
+	{
+		AllocationScope allocationScope(ALLOCATION_ARRAY);
+		data_.intArray = new IntArray(*value.data_.intArray);
+	}
+	else if(type_ == TFloatArray)
+	{
+		AllocationScope allocationScope(ALLOCATION_ARRAY);
+		data_.floatArray = new FloatArray(*value.data_.floatArray);
+	}
 	else if(type_ == TTypeDefinition)
 	{
+		AllocationScope allocationScope(ALLOCATION_TYPE_DEFINITION);
 		data_.typeDefinition = new TypePointer(*value.data_.typeDefinition);
 	}
 	else
@@ -129,12 +189,27 @@ Value Value::array(const Array &array)
 	return Value(array);
 }
 
+Value Value::intArray(const IntArray &array)
+{
+	return Value(array);
+}
+
+Value Value::floatArray(const FloatArray &array)
+{
+	return Value(array);
+}
+
 Value Value::boolean(bool boolean)
 {
 	return Value(boolean);
 }
 
-Value Value::number(int number)
+Value Value::number(long long number)
+{
+	return Value(number);
+}
+
+Value Value::floating(double number)
 {
 	return Value(number);
 }
@@ -149,6 +224,11 @@ Value Value::string(const std::string &text)
 	return Value(text);
 }
 
+Value Value::string(const char *text, std::size_t size)
+{
+	return Value(text, size);
+}
+
 Value Value::function(const Function &function)
 {
 	return Value(function);
@@ -176,6 +256,8 @@ bool Value::isTruthy() const
 		return !data_.string->empty();
 	case Value::TNumber:
 		return data_.number != 0;
+	case Value::TFloat:
+		return data_.floating != 0;
 	case Value::TObject:
 		return true;
 	case Value::TBoolean:
@@ -184,6 +266,10 @@ bool Value::isTruthy() const
 		return true;
 	case Value::TArray:
 		return !data_.array->empty();
+	case Value::TIntArray:
+		return !data_.intArray->empty();
+	case Value::TFloatArray:
+		return !data_.floatArray->empty();
 	case Value::TTypeDefinition:
 		return true;
 	default:
@@ -191,6 +277,50 @@ bool Value::isTruthy() const
 	}
 }
 
+namespace
+{
+	// The fewest digits that read back as the same double, and still looking
+	// like a float when whole, e.g. 0.1 and 2.0
+	std::ostream &printFloat(std::ostream &out, double number)
+	{
+		char text[32];
+		for (int precision = 15 ; precision <= 17 ; ++precision)
+		{
+			std::snprintf(text, sizeof(text), "%.*g", precision, number);
+			if (std::strtod(text, nullptr) == number)
+			{
+				break;
+			}
+		}
+		out << text;
+		if (std::isfinite(number) && !std::strpbrk(text, ".e"))
+		{
+			out << ".0";
+		}
+		return out;
+	}
+
+	template <typename Elements, typename Printer>
+	std::ostream &printElements(std::ostream &out, const Elements &elements, Printer printer)
+	{
+		out << '[';
+		for (std::size_t i = 0 ; i < elements.size() ; ++i)
+		{
+			if (i > 0)
+			{
+				out << ", ";
+			}
+			printer(out, elements[i]);
+		}
+		return out << ']';
+	}
+
+	std::ostream &printInt(std::ostream &out, long long number)
+	{
+		return out << number;
+	}
+}
+
 std::ostream &operator<<(std::ostream &out, const Value::Type &type)
 {
 	switch(type)
@@ -211,6 +341,12 @@ std::ostream &operator<<(std::ostream &out, const Value::Type &type)
 		return out << "TFunction";
 	case Value::TTypeDefinition:
 		return out << "TTypeDefinition";
+	case Value::TFloat:
+		return out << "TFloat";
+	case Value::TIntArray:
+		return out << "TIntArray";
+	case Value::TFloatArray:
+		return out << "TFloatArray";
 	default:
 		throw CompilerBug("Type " + str(static_cast<int>(type)) + " not implemented");
 	}
@@ -241,6 +377,12 @@ std::ostream &operator<<(std::ostream &out, const Value &value)
 		return out << '\"' << addEscapes(*value.data_.string) << '\"';
 	case Value::TNumber:
 		return out << value.data_.number;
+	case Value::TFloat:
+		return printFloat(out, value.data_.floating);
+	case Value::TIntArray:
+		return printElements(out, *value.data_.intArray, &printInt);
+	case Value::TFloatArray:
+		return printElements(out, *value.data_.floatArray, &printFloat);
 	case Value::TObject:
 		{
 			out << '{';
@@ -285,6 +427,68 @@ namespace {
 		return true;
 	}
 
+	bool intArraysEqual(const Value::IntArray &left, const Value::IntArray &right)
+	{
+		// Integers are equal exactly when their bytes are
+		return left.size() == right.size() && (left.empty() || std::memcmp(left.data(), right.data(), left.size() * sizeof(long long)) == 0);
+	}
+
+	bool floatArraysEqual(const Value::FloatArray &left, const Value::FloatArray &right)
+	{
+		// Not so doubles, with NaN and -0.0
+		return left.size() == right.size() && std::equal(left.begin(), left.end(), right.begin());
+	}
+
+	bool isAnyArray(const Value &value)
+	{
+		return value.isArray() || value.isIntArray() || value.isFloatArray();
+	}
+
+	std::size_t arraySize(const Value &value)
+	{
+		if (value.isIntArray())
+		{
+			return value.intArray().size();
+		}
+		if (value.isFloatArray())
+		{
+			return value.floatArray().size();
+		}
+		return value.array().size();
+	}
+
+	Value arrayElement(const Value &value, std::size_t index)
+	{
+		if (value.isIntArray())
+		{
+			return Value::number(value.intArray()[index]);
+		}
+		if (value.isFloatArray())
+		{
+			return Value::floating(value.floatArray()[index]);
+		}
+		return value.array()[index];
+	}
+
+	// Packed and boxed arrays are equal when their elements are, numbers
+	// comparing exactly
+	bool mixedArraysEqual(const Value &left, const Value &right)
+	{
+		std::size_t size = arraySize(left);
+		if (size != arraySize(right))
+		{
+			return false;
+		}
+		for (std::size_t i = 0 ; i < size ; ++i)
+		{
+			if (arrayElement(left, i) != arrayElement(right, i))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
 	bool objectsEquals(const Value::Object &leftObject, const Value::Object &rightObject)
 	{
 		if (leftObject.size() != rightObject.size())
@@ -306,13 +510,68 @@ namespace {
 		}
 		return true;
 	}
+
+	template<typename T>
+	int threeWay(T left, T right)
+	{
+		return (left < right) ? -1 : (right < left) ? 1 : 0;
+	}
+
+	// The floating point number must not be NaN. Every double outside of
+	// [-2^63, 2^63) is beyond any integer, and every one inside has an
+	// integral part that converts exactly.
+	int compareIntegerToFloat(long long integer, double floating)
+	{
+		if (floating >= 9223372036854775808.0)
+		{
+			return -1;
+		}
+		if (floating < -9223372036854775808.0)
+		{
+			return 1;
+		}
+		double integral = std::trunc(floating);
+		int order = threeWay(integer, static_cast<long long>(integral));
+		return order ? order : threeWay(0.0, floating - integral);
+	}
+}
+
+bool compareNumbers(const Value &left, const Value &right, int &order)
+{
+	if (left.isNumber() && right.isNumber())
+	{
+		order = threeWay(left.number(), right.number());
+		return true;
+	}
+	if ((left.isFloat() && std::isnan(left.floating())) || (right.isFloat() && std::isnan(right.floating())))
+	{
+		return false;
+	}
+	if (left.isFloat() && right.isFloat())
+	{
+		order = threeWay(left.floating(), right.floating());
+	}
+	else if (left.isNumber())
+	{
+		order = compareIntegerToFloat(left.number(), right.floating());
+	}
+	else
+	{
+		order = -compareIntegerToFloat(right.number(), left.floating());
+	}
+	return true;
 }
 
 bool operator==(const Value &left, const Value &right)
 {
 	if (left.type_ != right.type_)
 	{
-		return false;
+		if (isAnyArray(left) && isAnyArray(right))
+		{
+			return mixedArraysEqual(left, right);
+		}
+		int order;
+		return left.isNumeric() && right.isNumeric() && compareNumbers(left, right, order) && order == 0;
 	}
 	switch(left.type_)
 	{
@@ -320,10 +579,16 @@ bool operator==(const Value &left, const Value &right)
 		return true;
 	case Value::TArray:
 		return arraysEqual(*left.data_.array, *right.data_.array);
+	case Value::TIntArray:
+		return intArraysEqual(*left.data_.intArray, *right.data_.intArray);
+	case Value::TFloatArray:
+		return floatArraysEqual(*left.data_.floatArray, *right.data_.floatArray);
 	case Value::TString:
 		return *left.data_.string == *right.data_.string;
 	case Value::TNumber:
 		return left.data_.number == right.data_.number;
+	case Value::TFloat:
+		return left.data_.floating == right.data_.floating;
 	case Value::TObject:
 		return objectsEquals(*left.data_.object, *right.data_.object);
 	case Value::TBoolean:
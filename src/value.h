@@ -17,15 +17,21 @@ class Value
 public:
 	typedef std::vector<Value> Array;
 	typedef std::map<std::string, Value> Object;
+	// Packed numbers, contiguous for the array kernels
+	typedef std::vector<long long> IntArray;
+	typedef std::vector<double> FloatArray;
 private:
 	union Data
 	{
 		bool boolean;
-		int number;
+		long long number;
+		double floating;
 		Function *function;
 		std::string *string;
 		Array *array;
 		Object *object;
+		IntArray *intArray;
+		FloatArray *floatArray;
 		TypePointer *typeDefinition;
 	};
 
@@ -40,6 +46,9 @@ public:
 		TBoolean,
 		TFunction,
 		TTypeDefinition,
+		TFloat,
+		TIntArray,
+		TFloatArray,
 	};
 
 	Value();
@@ -52,10 +61,15 @@ public:
 
 	static Value nil();
 	static Value array(const Array &elements);
+	static Value intArray(const IntArray &elements);
+	static Value floatArray(const FloatArray &elements);
 	static Value boolean(bool boolean);
-	static Value number(int number);
+	static Value number(long long number);
+	static Value floating(double number);
 	static Value object(const Object &object);
 	static Value string(const std::string &text);
+	// Copied once, e.g. straight out of a mapped file
+	static Value string(const char *text, std::size_t size);
 	static Value function(const Function &function);
 	static Value typeDefinition(const TypePointer &typeDefinition);
 
@@ -69,11 +83,33 @@ public:
 		return type_ == TArray;
 	}
 
+	bool isIntArray() const
+	{
+		return type_ == TIntArray;
+	}
+
+	bool isFloatArray() const
+	{
+		return type_ == TFloatArray;
+	}
+
+	// An integer
 	bool isNumber() const 
 	{ 
 		return type_ == TNumber; 
 	}
 
+	bool isFloat() const
+	{
+		return type_ == TFloat;
+	}
+
+	// Either kind of number
+	bool isNumeric() const
+	{
+		return type_ == TNumber || type_ == TFloat;
+	}
+
 	bool isString() const
 	{
 		return type_ == TString;
@@ -99,12 +135,25 @@ public:
 		return type_ == TTypeDefinition;
 	}
 
-	int number() const
+	long long number() const
 	{
 		assert(isNumber());
 		return data_.number;
 	}
 
+	double floating() const
+	{
+		assert(isFloat());
+		return data_.floating;
+	}
+
+	// Either kind of number, as a double
+	double numeric() const
+	{
+		assert(isNumeric());
+		return isFloat() ? data_.floating : static_cast<double>(data_.number);
+	}
+
 	bool boolean() const
 	{
 		assert(isBoolean());
@@ -146,6 +195,18 @@ public:
 		return *data_.array;	
 	}
 
+	const IntArray &intArray() const
+	{
+		assert(isIntArray());
+		return *data_.intArray;
+	}
+
+	const FloatArray &floatArray() const
+	{
+		assert(isFloatArray());
+		return *data_.floatArray;
+	}
+
 	bool isTruthy() const;
   bool isFalsey() const
   {
@@ -163,10 +224,14 @@ public:
 
 private:
 	explicit Value(bool boolean);
-	explicit Value(int number);
+	explicit Value(long long number);
+	explicit Value(double number);
 	explicit Value(const std::string &text);
+	Value(const char *text, std::size_t size);
 	explicit Value(const Function &function);
 	explicit Value(const Array &array);
+	explicit Value(const IntArray &array);
+	explicit Value(const FloatArray &array);
 	explicit Value(const Object &object);
 	explicit Value(const TypePointer &typeDefinition);
 
@@ -174,4 +239,10 @@ private:
 	Data data_;
 };
 
+// Orders two numbers exactly, rather than rounding an integer to the nearest
+// double, so 2^53 + 1 is greater than 2^53 as a float. Sets order negative,
+// zero or positive as left is less than, equal to or greater than right.
+// False if either is NaN, which is unordered.
+bool compareNumbers(const Value &left, const Value &right, int &order);
+
 #endif
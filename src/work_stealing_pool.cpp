@@ -0,0 +1,191 @@
+#include "work_stealing_pool.h"
+
+#include <exception>
+#include <algorithm>
+
+namespace
+{
+	// Which queue is the current thread's, if it is one of a pool's
+	thread_local const WorkStealingPool *currentPool = nullptr;
+	thread_local int currentQueue = -1;
+
+	struct Batch
+	{
+		explicit Batch(std::size_t tasks)
+		:
+			remaining(tasks)
+		{
+		}
+
+		std::atomic<std::size_t> remaining;
+		std::mutex mutex;
+		std::condition_variable done;
+		std::exception_ptr error;
+	};
+}
+
+WorkStealingPool::WorkStealingPool(unsigned threads)
+:
+	queued_(0),
+	nextQueue_(0),
+	stopping_(false)
+{
+	for (unsigned i = 0 ; i < threads ; ++i)
+	{
+		queues_.push_back(std::unique_ptr<Queue>(new Queue()));
+	}
+	for (unsigned i = 0 ; i < threads ; ++i)
+	{
+		threads_.push_back(std::thread(&WorkStealingPool::work, this, i));
+	}
+}
+
+WorkStealingPool::~WorkStealingPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stopping_ = true;
+	}
+	available_.notify_all();
+	for (std::thread &thread : threads_)
+	{
+		thread.join();
+	}
+}
+
+unsigned WorkStealingPool::threads() const
+{
+	return threads_.size();
+}
+
+void WorkStealingPool::run(const std::vector<Task> &tasks)
+{
+	std::shared_ptr<Batch> batch = std::make_shared<Batch>(tasks.size());
+	for (const Task &task : tasks)
+	{
+		submit([batch, task]() {
+			try
+			{
+				task();
+			}
+			catch (...)
+			{
+				std::lock_guard<std::mutex> lock(batch->mutex);
+				if (!batch->error)
+				{
+					batch->error = std::current_exception();
+				}
+			}
+			if (--batch->remaining == 0)
+			{
+				std::lock_guard<std::mutex> lock(batch->mutex);
+				batch->done.notify_all();
+			}
+		});
+	}
+	helpUntil(batch->mutex, batch->done, [&batch]() { return batch->remaining == 0; });
+	if (batch->error)
+	{
+		std::rethrow_exception(batch->error);
+	}
+}
+
+void WorkStealingPool::submit(const Task &task)
+{
+	// A worker's own tasks go on its queue, to be stolen by idle ones
+	int queue = self();
+	push(queue >= 0 ? queue : nextQueue_++ % queues_.size(), task);
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+	}
+	available_.notify_one();
+}
+
+void WorkStealingPool::helpUntil(std::mutex &mutex, std::condition_variable &changed, const std::function<bool()> &done)
+{
+	int queue = self();
+	while (!done())
+	{
+		if (!runOne(queue))
+		{
+			// None left to take, so the rest are running
+			std::unique_lock<std::mutex> lock(mutex);
+			changed.wait(lock, done);
+		}
+	}
+}
+
+int WorkStealingPool::self() const
+{
+	return currentPool == this ? currentQueue : -1;
+}
+
+void WorkStealingPool::push(std::size_t queue, const Task &task)
+{
+	std::lock_guard<std::mutex> lock(queues_[queue]->mutex);
+	queues_[queue]->tasks.push_back(task);
+	++queued_;
+}
+
+bool WorkStealingPool::runOne(int self)
+{
+	Task task;
+	if (self >= 0)
+	{
+		Queue &own = *queues_[self];
+		std::lock_guard<std::mutex> lock(own.mutex);
+		if (!own.tasks.empty())
+		{
+			task = own.tasks.back();
+			own.tasks.pop_back();
+			--queued_;
+		}
+	}
+	for (std::size_t i = 1 ; !task && i <= queues_.size() ; ++i)
+	{
+		std::size_t victim = (self + i) % queues_.size();
+		if (static_cast<int>(victim) == self)
+		{
+			continue;
+		}
+		Queue &other = *queues_[victim];
+		std::lock_guard<std::mutex> lock(other.mutex);
+		if (!other.tasks.empty())
+		{
+			task = other.tasks.front();
+			other.tasks.pop_front();
+			--queued_;
+		}
+	}
+	if (!task)
+	{
+		return false;
+	}
+	task();
+	return true;
+}
+
+void WorkStealingPool::work(int self)
+{
+	currentPool = this;
+	currentQueue = self;
+	while (true)
+	{
+		if (runOne(self))
+		{
+			continue;
+		}
+		std::unique_lock<std::mutex> lock(mutex_);
+		available_.wait(lock, [this]() { return stopping_ || queued_ > 0; });
+		if (stopping_ && queued_ == 0)
+		{
+			return;
+		}
+	}
+}
+
+WorkStealingPool &sharedWorkStealingPool(unsigned threads)
+{
+	static WorkStealingPool pool(threads > 0 ? threads : std::max(std::thread::hardware_concurrency(), 1u));
+	return pool;
+}
@@ -0,0 +1,68 @@
+#ifndef WORK_STEALING_POOL_H
+#define WORK_STEALING_POOL_H
+
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+
+// Threads for splitting a job into tasks. Each thread has its own queue,
+// taking its newest task first and, when it has none, stealing the oldest
+// task of another. A thread waiting for its tasks runs them too, so tasks
+// may themselves run tasks.
+class WorkStealingPool
+{
+public:
+	typedef std::function<void()> Task;
+
+	explicit WorkStealingPool(unsigned threads);
+	~WorkStealingPool();
+
+	unsigned threads() const;
+
+	// Returns once all the tasks have run, rethrowing the first exception
+	// any of them threw
+	void run(const std::vector<Task> &tasks);
+
+	// Queues a task, which must not throw, returning at once
+	void submit(const Task &task);
+
+	// Runs queued tasks on this thread until done() holds. When there are
+	// none, sleeps on changed, which must be notified under mutex whenever
+	// done() may have become true.
+	void helpUntil(std::mutex &mutex, std::condition_variable &changed, const std::function<bool()> &done);
+
+private:
+	// Deliberately private & unimplemented
+	WorkStealingPool(const WorkStealingPool &);
+	WorkStealingPool &operator=(const WorkStealingPool &);
+
+	struct Queue
+	{
+		std::mutex mutex;
+		std::deque<Task> tasks;
+	};
+
+	int self() const;
+	void push(std::size_t queue, const Task &task);
+	bool runOne(int self);
+	void work(int self);
+
+	std::vector<std::unique_ptr<Queue>> queues_;
+	std::atomic<std::size_t> queued_;
+	std::atomic<std::size_t> nextQueue_;
+	std::mutex mutex_;
+	std::condition_variable available_;
+	bool stopping_;
+	std::vector<std::thread> threads_;
+};
+
+// The pool shared by the interpreters, created on first use with the given
+// number of threads, or one per hardware thread if that is 0
+WorkStealingPool &sharedWorkStealingPool(unsigned threads);
+
+#endif